@@ -0,0 +1,745 @@
+// Microbenchmarks for the hot paths in server.cpp
+//
+// Every result is printed to stdout as one JSON object per line, so a run can be saved, diffed, or
+// handed back in with --baseline to make the process exit non-zero when something got slower:
+//
+//     counting-server-bench > before.jsonl
+//     ... hack hack hack ...
+//     counting-server-bench --baseline before.jsonl --threshold 10
+//
+// The server logs every command to stderr, which is part of what we're measuring, but we don't want
+// to see it; stderr is pointed at /dev/null while the benchmarks run unless --verbose is given.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "dedupe-window.hpp"
+#include "event-loop.hpp"
+#include "heavy-hitters.hpp"
+#include "histogram.hpp"
+#include "http.hpp"
+#include "hyperloglog.hpp"
+#include "pn-counter.hpp"
+#include "posix-resource-handle.hpp"
+#include "raft.hpp"
+#include "server.hpp"
+#include "shard-map.hpp"
+#include "sharded-counter.hpp"
+#include "shm-producer.hpp"
+#include "shm-transport.hpp"
+
+namespace {
+
+struct options {
+    std::string filter;
+    std::string baseline;
+    double threshold_percent = 10.0;
+    double min_time_ms = 200.0;
+    int samples = 5;
+    bool verbose = false;
+};
+
+struct result {
+    std::string name;
+    uint64_t iterations;
+    double median_ns;
+    double min_ns;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+// Runs `body(n)` with increasing n until one run takes a reasonable slice of the time budget, then
+// takes a handful of samples at that size and reports the per-iteration median and minimum
+auto measure(std::string name, options const& opts, std::function<void(uint64_t)> const& body) -> result
+{
+    auto time_once = [&](uint64_t n) {
+        auto start = clock_type::now();
+        body(n);
+        return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+    };
+
+    auto const target_ns = opts.min_time_ms * 1e6 / opts.samples;
+    uint64_t n = 1;
+    for (double elapsed = time_once(n); elapsed < target_ns && n < (uint64_t(1) << 40); elapsed = time_once(n)) {
+        n = elapsed > 0 ? std::max(n * 2, uint64_t(double(n) * target_ns / elapsed * 1.2)) : n * 2;
+    }
+
+    std::vector<double> per_op;
+    for (int i = 0; i < opts.samples; ++i) {
+        per_op.push_back(time_once(n) / double(n));
+    }
+
+    std::sort(per_op.begin(), per_op.end());
+    return { std::move(name), n, per_op[per_op.size() / 2], per_op.front() };
+}
+
+// Both ends of a non-blocking AF_UNIX stream socket pair; `server` is what parse_and_handle writes to,
+// `client` is where those writes pile up until we drain them
+struct socket_pair {
+    resource_handle server;
+    resource_handle client;
+
+    socket_pair()
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+            throw_system_error();
+        }
+
+        server = resource_handle(fds[0]);
+        client = resource_handle(fds[1]);
+    }
+
+    void drain() const
+    {
+        static char sink[64 * 1024];
+        while (recv(client.get().fd, sink, sizeof(sink), MSG_DONTWAIT) > 0) {}
+    }
+};
+
+// Small sends each cost a whole skb of socket buffer, so peers fill up after a few hundred writes
+constexpr uint64_t drain_interval = 64;
+
+void bench_parse(std::vector<result>* results, options const& opts)
+{
+    auto pair = socket_pair();
+    auto loop = event_loop();
+    auto count = sharded_counter(worker_slot_count);
+    auto server = server_context { &loop, &count };
+    auto conn = connection { std::move(pair.server), "bench" };
+
+    for (auto command : { "INCR 1\r\n", "DECR 1\r\n", "OUTPUT\r\n", "RATE 1m\r\n", "BOGUS 1\r\n" }) {
+        auto name = "parse_and_handle/" + std::string(command, strcspn(command, "\r"));
+        std::replace(name.begin(), name.end(), ' ', '_');
+
+        auto line = std::string(command);
+        results->push_back(measure(name, opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                parse_and_handle(&server, &conn, line);
+                if (i % drain_interval == 0) {
+                    pair.drain();
+                }
+            }
+            pair.drain();
+        }));
+    }
+
+    // A RESP request arrives as one line per header and argument; this is what a pipelined Redis
+    // client costs us per command
+    auto resp_conn = connection { resource_handle(dup(conn.fd())), "bench" };
+    auto resp_lines = std::vector<std::string> { "*3\r\n", "$6\r\n", "INCRBY\r\n", "$5\r\n", "count\r\n", "$1\r\n", "1\r\n" };
+    results->push_back(measure("parse_and_handle/RESP_INCRBY", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            for (auto const& line : resp_lines) {
+                parse_and_handle(&server, &resp_conn, line);
+            }
+            if (i % drain_interval == 0) {
+                pair.drain();
+            }
+        }
+        pair.drain();
+    }));
+}
+
+void bench_read_lines(std::vector<result>* results, options const& opts)
+{
+    auto pair = socket_pair();
+    auto conn = connection { std::move(pair.server), "client" };
+
+    for (int lines : { 1, 16, 256 }) {
+        auto payload = std::string();
+        for (int i = 0; i < lines; ++i) {
+            payload += "INCR " + std::to_string(i) + "\r\n";
+        }
+
+        results->push_back(measure("receive_lines/" + std::to_string(lines), opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                if (write(pair.client.get().fd, payload.data(), payload.size()) != ssize_t(payload.size())) {
+                    throw_system_error();
+                }
+
+                auto got = receive_lines(&conn, { SIZE_MAX, SIZE_MAX });
+                if (got.lines.size() != size_t(lines)) {
+                    fprintf(stderr, "receive_lines returned %zu lines, expected %d\n", got.lines.size(), lines);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }));
+    }
+
+    // A flooding client's turns: 4096 lines at once, taken 256 at a time, most of them out of what
+    // the turn before left in the connection's buffer
+    auto flood = std::string();
+    for (int i = 0; i < 4096; ++i) {
+        flood += "INCR " + std::to_string(i) + "\r\n";
+    }
+
+    results->push_back(measure("receive_lines/turn_of_256", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            if (i % 16 == 0 && write(pair.client.get().fd, flood.data(), flood.size()) != ssize_t(flood.size())) {
+                throw_system_error();
+            }
+
+            auto got = receive_lines(&conn, { 64 * 1024, 256 });
+            asm volatile("" : : "r"(got.lines.data()) : "memory");
+        }
+        while (!receive_lines(&conn, { SIZE_MAX, SIZE_MAX }).lines.empty()) {}
+    }));
+}
+
+// An update going out to N subscribers, flushed after every update and after bursts of 16 the way
+// the end of a loop iteration flushes them
+void bench_fan_out(std::vector<result>* results, options const& opts)
+{
+    auto origin = socket_pair();
+    auto origin_conn = connection { std::move(origin.server), "origin" };
+    auto loop = event_loop();
+
+    for (size_t fan_out : { 1, 16, 128 }) {
+        std::vector<socket_pair> pairs(fan_out);
+        std::vector<connection> subscribers;
+        subscribers.reserve(fan_out);
+
+        auto count = sharded_counter(worker_slot_count);
+        auto server = server_context { &loop, &count };
+        for (auto& pair : pairs) {
+            subscribers.push_back(connection { resource_handle(dup(pair.server.get().fd)), "subscriber" });
+            server.connections.push_back(&subscribers.back());
+        }
+
+        auto line = std::string("INCR 1\r\n");
+        for (auto [suffix, burst] : { std::pair("", 1), std::pair("/burst_16", 16) }) {
+            results->push_back(measure("broadcast/" + std::to_string(fan_out) + suffix, opts, [&, burst = burst](uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) {
+                    parse_and_handle(&server, &origin_conn, line);
+                    if ((i + 1) % burst == 0) {
+                        flush_batched_output(&server);
+                    }
+                    if (i % drain_interval == 0) {
+                        for (auto const& pair : pairs) pair.drain();
+                    }
+                }
+                flush_batched_output(&server);
+                for (auto const& pair : pairs) pair.drain();
+            }));
+        }
+    }
+}
+
+// The same push_back / std::erase dance serve_connection does on every connect and hang-up
+void bench_connection_table(std::vector<result>* results, options const& opts)
+{
+    for (size_t size : { 16, 256, 768 }) {
+        std::vector<connection> storage(size);
+        std::vector<connection*> connections;
+        connections.reserve(1024);
+        for (auto& conn : storage) {
+            connections.push_back(&conn);
+        }
+
+        results->push_back(measure("connection_table/" + std::to_string(size), opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                auto hung_up = &storage[(i * 7919) % size];
+                std::erase(connections, hung_up);
+                connections.push_back(hung_up);
+            }
+        }));
+    }
+}
+
+// Parsing alone, no sockets: what a typical client's request head costs before we act on it
+void bench_http(std::vector<result>* results, options const& opts)
+{
+    auto requests = std::vector<std::pair<char const*, std::string>> {
+        { "http/parse_minimal", "POST /incr?by=1 HTTP/1.1\r\n\r\n" },
+        { "http/parse_curl",    "GET /count?after=12345 HTTP/1.1\r\nHost: localhost:8090\r\nUser-Agent: curl/7.88.1\r\nAccept: */*\r\n\r\n" },
+    };
+
+    for (auto const& [name, text] : requests) {
+        results->push_back(measure(name, opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                auto request = http::request{};
+                size_t length = 0;
+                if (http::parse_request(text, &request, &length) != http::parse_status::complete) {
+                    fprintf(stderr, "%s did not parse\n", name);
+                    exit(EXIT_FAILURE);
+                }
+                asm volatile("" : : "r"(request.query.data()) : "memory");
+            }
+        }));
+    }
+}
+
+// Checking a request ID: one client counting up, and many clients interleaved with the odd retry,
+// which keeps the LRU list moving and lands some checks inside the window rather than at its top
+void bench_dedupe(std::vector<result>* results, options const& opts)
+{
+    results->push_back(measure("dedupe/one_client", opts, [&](uint64_t n) {
+        auto dedupe = dedupe_window();
+        for (uint64_t i = 0; i < n; ++i) {
+            if (dedupe.check("client", i + 1) != dedupe_window::verdict::fresh) {
+                fprintf(stderr, "dedupe/one_client: request %lu was not fresh\n", i + 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }));
+
+    auto names = std::vector<std::string>();
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back("client-" + std::to_string(i));
+    }
+
+    results->push_back(measure("dedupe/1000_clients", opts, [&](uint64_t n) {
+        auto dedupe = dedupe_window();
+        for (uint64_t i = 0; i < n; ++i) {
+            auto sequence = i / names.size() + 1;
+            auto verdict = dedupe.check(names[i % names.size()], i % 7 == 0 && sequence > 1 ? sequence - 1 : sequence);
+            asm volatile("" : : "r"(verdict) : "memory");
+        }
+    }));
+}
+
+// HyperLogLog: adding an item, a fresh estimate of a sparse and of a full sketch (add() throws the
+// cached one away), and merging two sketches, which is what PFCOUNT with several keys costs per key
+void bench_distinct(std::vector<result>* results, options const& opts)
+{
+    auto items = std::vector<std::string>();
+    for (int i = 0; i < 4096; ++i) {
+        items.push_back("visitor-" + std::to_string(i));
+    }
+
+    auto sketch = std::make_unique<hyperloglog>();
+    results->push_back(measure("distinct/add", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto changed = sketch->add(items[i % items.size()]);
+            asm volatile("" : : "r"(changed) : "memory");
+        }
+    }));
+
+    auto sparse = std::make_unique<hyperloglog>();
+    auto full = std::make_unique<hyperloglog>();
+    for (int i = 0; i < 1000000; ++i) {
+        full->add("filler-" + std::to_string(i));
+    }
+
+    for (auto [name, target] : { std::pair("distinct/estimate_sparse", sparse.get()), std::pair("distinct/estimate_full", full.get()) }) {
+        results->push_back(measure(name, opts, [&, target = target](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                target->add(items[i % items.size()]);
+                target->merge(*sparse);  // forgets the cached estimate even when add() changed nothing
+                auto estimate = target->estimate();
+                asm volatile("" : : "r"(estimate) : "memory");
+            }
+        }));
+    }
+
+    results->push_back(measure("distinct/merge", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            sketch->merge(*full);
+            asm volatile("" : : "r"(sketch.get()) : "memory");
+        }
+    }));
+}
+
+// Keyed increments into the Count-Min sketch with a skewed key mix, so the leaders keep moving
+// within the heap and the long tail keeps knocking at its root; then asking for the leaders
+void bench_heavy_hitters(std::vector<result>* results, options const& opts)
+{
+    auto keys = std::vector<std::string>();
+    for (int i = 0; i < 4096; ++i) {
+        keys.push_back("/page/" + std::to_string(i * i % 1009) + "/" + std::to_string(i));
+    }
+
+    auto hitters = heavy_hitters();
+    results->push_back(measure("heavy_hitters/add", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto estimate = hitters.add(keys[(i * i) % keys.size()], 1);
+            asm volatile("" : : "r"(estimate) : "memory");
+        }
+    }));
+
+    results->push_back(measure("heavy_hitters/top_10", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto top = hitters.top(10);
+            asm volatile("" : : "r"(top.data()) : "memory");
+        }
+    }));
+}
+
+// Recording latencies spread over four orders of magnitude, reading a percentile back out (a walk
+// over the buckets in use), and merging two such histograms the way HISTMERGE does
+void bench_histogram(std::vector<result>* results, options const& opts)
+{
+    auto values = std::vector<uint64_t>();
+    for (uint64_t i = 0; i < 4096; ++i) {
+        values.push_back(100 + (i * i * 7919) % 1000000);
+    }
+
+    auto latencies = histogram();
+    results->push_back(measure("histogram/record", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            latencies.record(values[i % values.size()]);
+        }
+    }));
+
+    results->push_back(measure("histogram/percentile_99", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto value = latencies.percentile(99.0);
+            asm volatile("" : : "r"(value) : "memory");
+        }
+    }));
+
+    auto merged = histogram();
+    results->push_back(measure("histogram/merge", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            merged.merge(latencies);
+            asm volatile("" : : "r"(&merged) : "memory");
+        }
+    }));
+}
+
+// Per-entry cost of getting a write into a one-member Raft log and applying it, flushed after every
+// entry and after batches of 256: the fdatasync dominates, so batching is the difference
+void bench_raft(std::vector<result>* results, options const& opts)
+{
+    char directory[] = "/tmp/counting-server-bench-raft-XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("Failed to create a directory for the Raft log");
+        return;
+    }
+
+    {
+        auto log = raft_log(directory);
+        auto now = raft_node::clock::now();
+        auto node = raft_node(0, 1, &log, now, 4096);
+        node.tick(now + raft_node::election_max);  // a cluster of one elects itself
+
+        for (uint64_t batch : { 1, 256 }) {
+            results->push_back(measure("raft/commit/batch_" + std::to_string(batch), opts, [&](uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) {
+                    node.propose(1, {});
+                    if ((i + 1) % batch == 0 || i + 1 == n) {
+                        node.flush(raft_node::clock::now());
+                        while (auto entry = node.next_to_apply()) {
+                            asm volatile("" : : "r"(entry->entry) : "memory");
+                        }
+                        node.compact({ int64_t(node.applied()), node.applied() });
+                    }
+                }
+            }));
+        }
+    }
+
+    for (auto name : { "meta", "snapshot", "log" }) {
+        unlink((std::string(directory) + "/" + name).c_str());
+    }
+    rmdir(directory);
+}
+
+// A gossip round's worth of work on a PN-counter that knows 16 replicas: merging a line another
+// node sent (a changed one, then a stale one), and turning our own change into the next delta
+void bench_pn_counter(std::vector<result>* results, options const& opts)
+{
+    auto state = pn_counter("bench.0");
+    for (int i = 0; i < 16; ++i) {
+        state.merge("node-" + std::to_string(i) + ".0", { 1000, 10 });
+    }
+    state.take_changes();
+
+    uint64_t grown = 1000;
+    results->push_back(measure("pn_counter/merge_changed", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto line = "node-" + std::to_string(i % 16) + ".0 " + std::to_string(++grown) + " 10";
+            auto moved = state.merge_encoded(line);
+            asm volatile("" : : "r"(&moved) : "memory");
+        }
+    }));
+    state.take_changes();
+
+    results->push_back(measure("pn_counter/merge_stale", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto moved = state.merge_encoded("node-7.0 5 5");
+            asm volatile("" : : "r"(&moved) : "memory");
+        }
+    }));
+
+    results->push_back(measure("pn_counter/record_and_take", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            state.record(1);
+            auto lines = state.take_changes();
+            asm volatile("" : : "r"(lines.data()) : "memory");
+        }
+    }));
+}
+
+// What every named command pays to find out which node holds its name: a hash of the name and a
+// jump through the nodes, which grows with the log of how many there are
+void bench_shard_map(std::vector<result>* results, options const& opts)
+{
+    auto names = std::vector<std::string>();
+    for (int i = 0; i < 4096; ++i) {
+        names.push_back("latency:/page/" + std::to_string(i));
+    }
+
+    for (size_t nodes : { 4, 64 }) {
+        auto shards = shard_map(std::vector<peer_address>(nodes, { "127.0.0.1", 8089 }), 0);
+        results->push_back(measure("shard_map/owner/" + std::to_string(nodes), opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                auto owner = shards.owner(names[i % names.size()]);
+                asm volatile("" : : "r"(owner) : "memory");
+            }
+        }));
+    }
+}
+
+// What admission control adds to every command (a clock read and a counter), and what a shed
+// command costs instead of being carried out: the BUSY reply and nothing else
+void bench_admission(std::vector<result>* results, options const& opts)
+{
+    auto pair = socket_pair();
+    auto loop = event_loop();
+    auto count = sharded_counter(worker_slot_count);
+    auto server = server_context { &loop, &count };
+    auto conn = connection { std::move(pair.server), "bench" };
+
+    server.max_commands_per_second = SIZE_MAX;
+    results->push_back(measure("admission/admit", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto admitted = admit_command(&server, &conn);
+            asm volatile("" : : "r"(admitted) : "memory");
+        }
+    }));
+
+    server.max_commands_per_second = 1;
+    auto line = std::string("INCR 1\r\n");
+    results->push_back(measure("admission/shed_INCR_1", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            parse_and_handle(&server, &conn, line);
+            if (i % drain_interval == 0) {
+                pair.drain();
+            }
+        }
+        pair.drain();
+    }));
+}
+
+// Per-thread cost of an increment with T threads hammering the counter at once; flat numbers as T grows
+// mean increments scale with cores. The single shared atomic is there for comparison.
+void bench_counter(std::vector<result>* results, options const& opts)
+{
+    auto run_threads = [](unsigned threads, uint64_t n, auto const& per_thread) {
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; ++t) {
+            pool.emplace_back([&, t] { per_thread(t, n); });
+        }
+        for (auto& thread : pool) thread.join();
+    };
+
+    auto max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        auto sharded = sharded_counter(threads);
+        results->push_back(measure("counter/sharded/" + std::to_string(threads), opts, [&](uint64_t n) {
+            run_threads(threads, n, [&](unsigned t, uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) sharded.add(t, 1);
+            });
+        }));
+
+        alignas(cache_line_size) std::atomic<int64_t> shared = 0;
+        results->push_back(measure("counter/shared_atomic/" + std::to_string(threads), opts, [&](uint64_t n) {
+            run_threads(threads, n, [&](unsigned, uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) shared.fetch_add(1, std::memory_order_relaxed);
+            });
+        }));
+
+        results->push_back(measure("counter/snapshot/" + std::to_string(threads), opts, [&](uint64_t n) {
+            int64_t sink = 0;
+            for (uint64_t i = 0; i < n; ++i) sink += sharded.snapshot();
+            asm volatile("" : : "r"(sink));
+        }));
+
+        // What CAS and INCRIF pay over a plain add: a collect of every other slot
+        results->push_back(measure("counter/add_if/" + std::to_string(threads), opts, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                sharded.add_if(0, [](versioned_value current) { return std::optional(current.value % 2 ? -1 : 1); });
+            }
+        }));
+    }
+}
+
+// End-to-end cost per increment through the shared-memory transport: one producer pushing records
+// while the drain thread applies them, timed until the counter has seen every one
+void bench_shm(std::vector<result>* results, options const& opts)
+{
+    auto path = "/tmp/counting-server-bench-" + std::to_string(getpid()) + ".sock";
+    auto listen_socket = listen_on_unix_socket(path, SOCK_SEQPACKET);
+
+    auto count = sharded_counter(worker_slot_count);
+    auto transport = shm_transport(&count, shm_drain_worker, 1);
+
+    std::optional<shm_producer> producer;
+    auto attacher = std::thread([&] { producer = shm_producer::attach(path); });
+
+    auto pfd = pollfd { listen_socket.get().fd, POLLIN };
+    poll(&pfd, 1, -1);
+    auto attachment = transport.accept_producer(listen_socket.get().fd);
+    attacher.join();
+    unlink(path.c_str());
+
+    int64_t expected = 0;
+    results->push_back(measure("shm/increment", opts, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            producer->add(1);
+        }
+
+        expected += int64_t(n);
+        while (count.total() != expected) {
+            sched_yield();
+        }
+    }));
+}
+
+auto load_baseline(std::string const& path) -> std::map<std::string, double>
+{
+    auto file = fopen(path.c_str(), "r");
+    if (!file) {
+        perror(("Failed to open baseline " + path).c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    std::map<std::string, double> ret;
+    char name[256];
+    double median;
+
+    char* line = nullptr;
+    size_t length = 0;
+    while (getline(&line, &length, file) > 0) {
+        if (sscanf(line, "{\"name\":\"%255[^\"]\",%*[^,],\"median_ns\":%lf", name, &median) == 2) {
+            ret[name] = median;
+        }
+    }
+    free(line);
+    fclose(file);
+
+    return ret;
+}
+
+void print_usage(char const* argv0)
+{
+    fprintf(stderr,
+        "Usage: %s [--filter SUBSTRING] [--min-time MS] [--samples N]\n"
+        "          [--baseline FILE.jsonl [--threshold PERCENT]] [--verbose]\n", argv0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    auto opts = options{};
+    for (int i = 1; i < argc; ++i) {
+        auto arg = std::string(argv[i]);
+        auto next = [&]() -> char const* {
+            if (i + 1 >= argc) {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if      (arg == "--filter")    opts.filter = next();
+        else if (arg == "--baseline")  opts.baseline = next();
+        else if (arg == "--threshold") opts.threshold_percent = atof(next());
+        else if (arg == "--min-time")  opts.min_time_ms = atof(next());
+        else if (arg == "--samples")   opts.samples = std::max(1, atoi(next()));
+        else if (arg == "--verbose")   opts.verbose = true;
+        else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The broadcast and connection table benchmarks hold a few hundred descriptors open at once
+    if (auto limit = rlimit{}; getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    auto real_stderr = dup(STDERR_FILENO);
+    if (!opts.verbose) {
+        if (!freopen("/dev/null", "w", stderr)) {
+            perror("Failed to silence stderr");
+        }
+    }
+
+    std::vector<result> all;
+    std::vector<std::pair<char const*, void(*)(std::vector<result>*, options const&)>> suites = {
+        { "parse_and_handle",   bench_parse },
+        { "receive_lines",      bench_read_lines },
+        { "broadcast",          bench_fan_out },
+        { "connection_table",   bench_connection_table },
+        { "counter",            bench_counter },
+        { "shm",                bench_shm },
+        { "http",               bench_http },
+        { "dedupe",             bench_dedupe },
+        { "distinct",           bench_distinct },
+        { "heavy_hitters",      bench_heavy_hitters },
+        { "histogram",          bench_histogram },
+        { "raft",               bench_raft },
+        { "pn_counter",         bench_pn_counter },
+        { "shard_map",          bench_shard_map },
+        { "admission",          bench_admission },
+    };
+
+    for (auto [name, suite] : suites) {
+        if (opts.filter.empty() || std::string(name).find(opts.filter) != std::string::npos) {
+            suite(&all, opts);
+        }
+    }
+
+    fflush(stderr);
+    dup2(real_stderr, STDERR_FILENO);
+    close(real_stderr);
+
+    for (auto const& r : all) {
+        printf("{\"name\":\"%s\",\"iterations\":%lu,\"median_ns\":%.1f,\"min_ns\":%.1f}\n",
+               r.name.c_str(), r.iterations, r.median_ns, r.min_ns);
+    }
+
+    if (opts.baseline.empty()) {
+        return EXIT_SUCCESS;
+    }
+
+    int regressions = 0;
+    auto baseline = load_baseline(opts.baseline);
+    for (auto const& r : all) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0) {
+            continue;
+        }
+
+        auto change = (r.median_ns / it->second - 1.0) * 100.0;
+        if (change > opts.threshold_percent) {
+            fprintf(stderr, "REGRESSION %s: %.1f ns -> %.1f ns (%+.1f%%)\n", r.name.c_str(), it->second, r.median_ns, change);
+            ++regressions;
+        }
+    }
+
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <iterator>
+#include <vector>
+
+#include "dedupe-window.hpp"
+
+namespace {
+
+auto next_word(std::string_view* text) -> std::string_view
+{
+    auto start = std::min(text->find_first_not_of(' '), text->size());
+    auto end = std::min(text->find(' ', start), text->size());
+    auto word = text->substr(start, end - start);
+    text->remove_prefix(end);
+    return word;
+}
+
+template <typename Number>
+auto parse_number(std::string_view text, Number* out, int base = 10) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out, base);
+    return !text.empty() && err == std::errc() && end == text.data() + text.size();
+}
+
+}  // namespace
+
+auto dedupe_window::find_or_add(std::string_view client) -> client_state&
+{
+    if (auto it = by_name.find(client); it != by_name.end()) {
+        recent.splice(recent.begin(), recent, it->second);
+        return *it->second;
+    }
+
+    if (by_name.size() == max_clients) {
+        by_name.erase(recent.back().name);
+        recent.pop_back();
+    }
+
+    recent.push_front(client_state { std::string(client) });
+    by_name.emplace(recent.front().name, recent.begin());
+    return recent.front();
+}
+
+auto dedupe_window::check(std::string_view client, uint64_t sequence) -> verdict
+{
+    auto& state = find_or_add(client);
+    auto& seen = state.seen;
+
+    // Newer than anything so far (or the very first from this client): slide the window up, which
+    // shifts the bitmap by the difference
+    if (sequence > state.highest || (state.highest == 0 && !(seen[0] & 1))) {
+        auto shift = sequence - state.highest;
+        if (shift >= window) {
+            seen.fill(0);
+        }
+        else if (shift > 0) {
+            auto words = shift / 64;
+            auto bits = shift % 64;
+            for (size_t i = seen.size(); i-- > 0; ) {
+                uint64_t moved = i >= words ? seen[i - words] << bits : 0;
+                if (bits && i > words) {
+                    moved |= seen[i - words - 1] >> (64 - bits);
+                }
+                seen[i] = moved;
+            }
+        }
+
+        state.highest = sequence;
+        seen[0] |= 1;
+        return verdict::fresh;
+    }
+
+    auto age = state.highest - sequence;
+    if (age >= window) {
+        return verdict::too_old;
+    }
+
+    auto& word = seen[age / 64];
+    auto bit = uint64_t(1) << (age % 64);
+    if (word & bit) {
+        return verdict::duplicate;
+    }
+
+    word |= bit;
+    return verdict::fresh;
+}
+
+void dedupe_window::save(std::string& out) const
+{
+    for (auto const& state : recent) {
+        if (&state != &recent.front()) {
+            out += ' ';
+        }
+        out += state.name;
+        out += ' ';
+        out += std::to_string(state.highest);
+        out += ' ';
+
+        auto used = state.seen.size();
+        while (used > 1 && !state.seen[used - 1]) {
+            --used;
+        }
+        for (size_t i = 0; i < used; ++i) {
+            char digits[17];
+            snprintf(digits, sizeof(digits), "%016lx", state.seen[i]);
+            out.append(digits, 16);
+        }
+    }
+}
+
+auto dedupe_window::restore(std::string_view saved) -> bool
+{
+    std::vector<client_state> loaded;
+    for (auto name = next_word(&saved); !name.empty(); name = next_word(&saved)) {
+        auto& state = loaded.emplace_back(client_state { std::string(name) });
+        auto highest = next_word(&saved);
+        auto bitmap = next_word(&saved);
+        if (name.size() > max_client_name || !parse_number(highest, &state.highest) ||
+            bitmap.empty() || bitmap.size() % 16 || bitmap.size() / 16 > state.seen.size()) {
+            return false;
+        }
+
+        for (size_t i = 0; i < bitmap.size() / 16; ++i) {
+            if (!parse_number(bitmap.substr(i * 16, 16), &state.seen[i], 16)) {
+                return false;
+            }
+        }
+    }
+
+    recent.clear();
+    by_name.clear();
+    for (auto& state : loaded) {
+        if (by_name.size() == max_clients) {
+            break;
+        }
+        recent.push_back(std::move(state));
+        if (!by_name.emplace(recent.back().name, std::prev(recent.end())).second) {
+            recent.pop_back();  // named twice; the more recent one stands
+        }
+    }
+    return true;
+}
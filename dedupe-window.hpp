@@ -0,0 +1,65 @@
+#ifndef DEDUPE_WINDOW_HPP
+#define DEDUPE_WINDOW_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Which request IDs have already been applied, so a retried INCR/DECR counts once
+
+// A request ID is a client name plus a sequence number the client counts up. Per client we keep the
+// highest sequence number seen and a bitmap of the `window` numbers below it (the same sliding
+// window IPsec uses against replays), so checking an ID is a hash lookup and a bit test. Numbers that
+// have slid out of the window can't be told apart from repeats any more and are refused, which errs
+// on the side of never counting anything twice.
+//
+// The number of clients remembered is capped; past that, the one heard from least recently is
+// forgotten, and a retry from it could then be applied again. Size the cap to the number of clients
+// that may be retrying at once.
+
+class dedupe_window {
+public:
+    static constexpr uint64_t window = 1024;
+    static constexpr size_t max_client_name = 64;
+
+    enum class verdict {
+        fresh,      // never seen: apply it (it's been recorded)
+        duplicate,  // seen before: don't
+        too_old,    // slid out of the window; might be new, but we can't tell, so don't
+    };
+
+    dedupe_window() = default;
+    explicit dedupe_window(size_t max_clients) : max_clients(max_clients ? max_clients : 1) {}
+
+    auto check(std::string_view client, uint64_t sequence) -> verdict;
+
+    auto clients() const -> size_t { return by_name.size(); }
+
+    // The whole window as text, for Raft snapshots: "name highest bitmap" per client, most recently
+    // heard from first, all separated by spaces. The bitmap is its words in hex, 16 digits each,
+    // without the zero words at the end. restore() replaces everything, or nothing if it can't read
+    // all of it; past max_clients, the least recent clients are dropped.
+    void save(std::string& out) const;
+    auto restore(std::string_view saved) -> bool;
+
+private:
+    struct client_state {
+        std::string name;
+        uint64_t highest = 0;
+        std::array<uint64_t, window / 64> seen = {};  // bit i: highest - i was applied
+    };
+
+    using lru_list = std::list<client_state>;
+
+    auto find_or_add(std::string_view client) -> client_state&;
+
+    size_t max_clients = 4096;
+    lru_list recent;  // most recently heard from first
+    std::unordered_map<std::string_view, lru_list::iterator> by_name;  // keys point into `recent`
+};
+
+#endif  // DEDUPE_WINDOW_HPP
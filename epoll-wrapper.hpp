@@ -9,7 +9,7 @@ struct epoll {
     resource_handle handle;
 
     epoll() noexcept
-      : handle(epoll_create(1))
+      : handle(epoll_create1(EPOLL_CLOEXEC))
     {
         if (handle.get().fd < 0) {
             throw_system_error();
@@ -17,28 +17,52 @@ struct epoll {
     }
 
     void add(resource_handle const& other, unsigned events)
+    {
+        add(other.get().fd, events);
+    }
+
+    void add(int fd, unsigned events)
     {
         auto event = epoll_event {
             .events = events,
-            .data = { .fd = other.get().fd }
+            .data = { .fd = fd }
         };
 
-        if (epoll_ctl(handle.get().fd, EPOLL_CTL_ADD, other.get().fd, &event) < 0) {
+        if (epoll_ctl(handle.get().fd, EPOLL_CTL_ADD, fd, &event) < 0) {
             throw_system_error();
         }
     }
 
-    auto wait() -> epoll_event
+    void modify(int fd, unsigned events)
+    {
+        auto event = epoll_event {
+            .events = events,
+            .data = { .fd = fd }
+        };
+
+        if (epoll_ctl(handle.get().fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+            throw_system_error();
+        }
+    }
+
+    // Closing a descriptor removes it implicitly, so failing here is not worth an exception
+    void remove(int fd) noexcept
+    {
+        epoll_ctl(handle.get().fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    // Fills up to `max` events and returns how many there were; a signal just means zero events
+    auto wait(epoll_event* events, int max, int timeout_ms) -> int
     {
-        auto event = epoll_event{};
-        if (int err = epoll_wait(handle.get().fd, &event, 1, -1); err < 0) {
+        int count = epoll_wait(handle.get().fd, events, max, timeout_ms);
+        if (count < 0) {
             if (errno == EINTR)
-                return {};
+                return 0;
 
             throw_system_error();
         }
 
-        return event;
+        return count;
     }
 };
 
@@ -0,0 +1,281 @@
+#include <stdexcept>
+
+#include <sys/eventfd.h>
+
+#include "event-loop.hpp"
+
+namespace {
+
+constexpr uint32_t read_interest  = EPOLLIN | EPOLLRDHUP;
+constexpr uint32_t write_interest = EPOLLOUT;
+constexpr uint32_t edge_interest  = EPOLLIN | EPOLLRDHUP | EPOLLOUT | EPOLLET;
+
+// Errors and hang-ups are reported whether we ask for them or not, and both sides want to hear them
+constexpr uint32_t wakes_reader = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+constexpr uint32_t wakes_writer = EPOLLOUT | EPOLLHUP | EPOLLERR;
+
+constexpr int max_events_per_wait = 64;
+
+}  // namespace
+
+event_loop::event_loop()
+  : wakeup(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    if (wakeup.get().fd < 0) {
+        wakeup.release();
+        throw_system_error();
+    }
+
+    poller.add(wakeup, EPOLLIN);
+}
+
+void event_loop::stop() noexcept
+{
+    stopping = true;
+
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = write(wakeup.get().fd, &one, sizeof(one));
+}
+
+void event_loop::suspend_on_fd(fd_awaiter* awaiter, std::coroutine_handle<> handle)
+{
+    auto fd = awaiter->fd;
+    if (size_t(fd) >= fds.size()) {
+        fds.resize(size_t(fd) + 1);
+    }
+
+    auto& state = fds[fd];
+    auto& slot = awaiter->writer ? state.writer : state.reader;
+    if (slot) {
+        throw std::logic_error("two coroutines waiting on the same side of one descriptor");
+    }
+
+    awaiter->self.handle = handle;
+    if (awaiter->timeout != no_timeout) {
+        awaiter->self.timer = arm_timer(&awaiter->self, awaiter->timeout);
+        live_timers[awaiter->self.timer].second = fd;
+    }
+    slot = &awaiter->self;
+
+    if (state.edge) {
+        if (!state.added) {
+            poller.add(fd, edge_interest);
+            state.added = true;
+            state.registered = edge_interest;
+        }
+        return;
+    }
+
+    auto wanted = state.registered | (awaiter->writer ? write_interest : read_interest);
+    update_interest(fd, state, wanted);
+}
+
+void event_loop::suspend_on_timer(sleep_awaiter* awaiter, std::coroutine_handle<> handle)
+{
+    awaiter->self.handle = handle;
+    awaiter->self.timer = arm_timer(&awaiter->self, awaiter->duration);
+}
+
+void event_loop::suspend_on_list(list_awaiter* awaiter, std::coroutine_handle<> handle)
+{
+    awaiter->self.handle = handle;
+    if (awaiter->timeout != no_timeout) {
+        awaiter->self.timer = arm_timer(&awaiter->self, awaiter->timeout);
+    }
+    awaiter->list->waiters.push_back(&awaiter->self);
+}
+
+auto event_loop::list_awaiter::await_resume() noexcept -> wait_result
+{
+    // A timer woke us, so we're still on the list
+    if (self.outcome.result == wait_result::timed_out) {
+        std::erase(list->waiters, &self);
+    }
+
+    return self.outcome.result;
+}
+
+void event_loop::notify_all(wait_list& list)
+{
+    for (auto w : std::exchange(list.waiters, {})) {
+        wake(w, { wait_result::ready, 0 });
+    }
+}
+
+auto event_loop::arm_timer(waiter* w, clock::duration timeout) -> uint64_t
+{
+    auto id = next_timer_id++;
+    timers.push({ clock::now() + timeout, id });
+    live_timers.emplace(id, std::pair { w, -1 });
+    return id;
+}
+
+void event_loop::update_interest(int fd, fd_state& state, uint32_t wanted)
+{
+    if (wanted == state.registered && state.added) {
+        return;
+    }
+
+    // Hang-ups are reported even with an empty interest set, so an unwatched descriptor has to leave
+    // the set entirely or a dead peer would wake us on every iteration
+    if (wanted == 0) {
+        if (state.added) {
+            poller.remove(fd);
+        }
+        state.added = false;
+        state.registered = 0;
+        return;
+    }
+
+    if (!state.added) {
+        poller.add(fd, wanted);
+        state.added = true;
+    }
+    else {
+        poller.modify(fd, wanted);
+    }
+
+    state.registered = wanted;
+}
+
+void event_loop::forget(int fd)
+{
+    if (size_t(fd) >= fds.size()) {
+        return;
+    }
+
+    auto state = std::exchange(fds[fd], fd_state{});
+    if (state.added) {
+        poller.remove(fd);
+    }
+
+    for (auto w : { state.reader, state.writer }) {
+        if (w) {
+            wake(w, { wait_result::cancelled, 0 });
+        }
+    }
+}
+
+void event_loop::watch_edges(int fd)
+{
+    if (size_t(fd) >= fds.size()) {
+        fds.resize(size_t(fd) + 1);
+    }
+
+    auto& state = fds[fd];
+    state.edge = true;
+    if (state.added) {
+        poller.modify(fd, edge_interest);
+        state.registered = edge_interest;
+    }
+}
+
+void event_loop::wake(waiter* w, io_event outcome)
+{
+    if (w->timer) {
+        live_timers.erase(w->timer);
+    }
+
+    w->outcome = outcome;
+    w->handle.resume();
+}
+
+void event_loop::dispatch(epoll_event const& event)
+{
+    auto fd = event.data.fd;
+    if (fd == wakeup.get().fd) {
+        uint64_t value;
+        [[maybe_unused]] auto ret = read(fd, &value, sizeof(value));
+        return;
+    }
+
+    if (size_t(fd) >= fds.size()) {
+        return;
+    }
+
+    auto& state = fds[fd];
+    auto reader = (event.events & wakes_reader) ? std::exchange(state.reader, nullptr) : nullptr;
+
+    // Level-triggered: whatever nobody is waiting for would keep firing, so stop asking for it
+    auto wanted = (state.reader || reader ? read_interest : 0) | (state.writer ? write_interest : 0);
+    if (state.added && !state.edge && wanted != state.registered) {
+        update_interest(fd, state, wanted);
+    }
+
+    if (reader) {
+        wake(reader, { wait_result::ready, event.events });
+    }
+
+    // The reader may have closed fd, cancelling the writer, so look it up again (and the table may
+    // have grown under us)
+    if (event.events & wakes_writer) {
+        if (auto writer = std::exchange(fds[fd].writer, nullptr)) {
+            wake(writer, { wait_result::ready, event.events });
+        }
+    }
+}
+
+void event_loop::fire_timers()
+{
+    auto now = clock::now();
+    while (!timers.empty() && timers.top().deadline <= now) {
+        auto id = timers.top().id;
+        timers.pop();
+
+        auto it = live_timers.find(id);
+        if (it == live_timers.end()) {
+            continue;  // its waiter was woken some other way
+        }
+
+        auto [w, fd] = it->second;
+        if (fd >= 0) {
+            auto& state = fds[fd];
+            if (state.reader == w) state.reader = nullptr;
+            if (state.writer == w) state.writer = nullptr;
+        }
+
+        wake(w, { wait_result::timed_out, 0 });
+    }
+}
+
+auto event_loop::next_timeout_ms() -> int
+{
+    // Somebody has work left over for the end of the next iteration; it mustn't wait on an event
+    if (!iteration_end.waiters.empty()) {
+        return 0;
+    }
+
+    while (!timers.empty() && !live_timers.contains(timers.top().id)) {
+        timers.pop();
+    }
+
+    if (timers.empty()) {
+        return -1;
+    }
+
+    auto remaining = timers.top().deadline - clock::now();
+    if (remaining <= clock::duration::zero()) {
+        return 0;
+    }
+
+    // Round up, or we'd wake just before the deadline and spin until it passes
+    return int(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+}
+
+void event_loop::run()
+{
+    epoll_event events[max_events_per_wait];
+
+    while (!stopping) {
+        auto count = poller.wait(events, max_events_per_wait, next_timeout_ms());
+        for (int i = 0; i < count; ++i) {
+            dispatch(events[i]);
+        }
+
+        fire_timers();
+        notify_all(iteration_end);
+    }
+
+    // Re-arm, so the loop can be run again (to drain, say) after it was stopped
+    stopping = false;
+}
@@ -0,0 +1,184 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "epoll-wrapper.hpp"
+#include "posix-resource-handle.hpp"
+
+// Awaitable readiness and timers on top of struct epoll
+
+// Coroutines running on the loop suspend with
+//
+//     co_await loop.readable(fd)      co_await loop.writable(fd)      co_await loop.sleep(d)
+//
+// and are resumed from run() when epoll says so or the time is up. The descriptor waits also take an
+// optional timeout. A coroutine can also wait on a wait_list (co_await loop.wait(list, timeout)) for
+// something that isn't a descriptor, until somebody calls loop.notify_all(list). Each descriptor can
+// have one reader and one writer waiting at a time, which is what lets a connection's read loop and
+// its flush loop run side by side.
+//
+// Registration is lazy: a descriptor is added to the epoll set the first time anybody waits on it,
+// and its interest set is only trimmed when an event shows up that nobody is waiting for, so a
+// coroutine that goes straight back to waiting on the same descriptor costs no epoll_ctl at all.
+// Because of that, call forget() before closing a descriptor: it takes it out of the set and resumes
+// anyone still waiting on it with wait_result::cancelled.
+//
+// A descriptor can be switched to edge-triggered with watch_edges() before anybody waits on it. It's
+// then registered once for both directions and never touched again until forget(), and each edge is
+// reported once: whoever is woken has to read (or write) until EAGAIN before waiting again, or yield
+// (end_of_iteration() below) and carry on where it left off.
+//
+// Work that's cheaper done once for everything an iteration's events asked for can wait for
+// co_await loop.end_of_iteration(), which resumes once they've all been dispatched.
+//
+// The loop also owns an eventfd in its own epoll set, which is how other threads get its attention:
+// stop() may be called from anywhere and makes run() return after the current iteration.
+
+enum class wait_result {
+    ready,
+    timed_out,
+    cancelled,
+};
+
+struct io_event {
+    wait_result result;
+    uint32_t events;  // what epoll reported, when result is ready
+
+    explicit operator bool() const noexcept { return result == wait_result::ready; }
+};
+
+class event_loop {
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr auto no_timeout = clock::duration::max();
+
+private:
+    struct waiter {
+        std::coroutine_handle<> handle;
+        io_event outcome = { wait_result::ready, 0 };
+        uint64_t timer = 0;  // 0 when there's no deadline
+    };
+
+public:
+    class fd_awaiter {
+    public:
+        auto await_ready() const noexcept -> bool { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { loop->suspend_on_fd(this, handle); }
+        auto await_resume() const noexcept -> io_event { return self.outcome; }
+
+    private:
+        friend class event_loop;
+        fd_awaiter(event_loop* loop, int fd, bool writer, clock::duration timeout)
+          : loop(loop), fd(fd), writer(writer), timeout(timeout) {}
+
+        event_loop* loop;
+        int fd;
+        bool writer;
+        clock::duration timeout;
+        waiter self;
+    };
+
+    class sleep_awaiter {
+    public:
+        auto await_ready() const noexcept -> bool { return duration <= clock::duration::zero(); }
+        void await_suspend(std::coroutine_handle<> handle) { loop->suspend_on_timer(this, handle); }
+        void await_resume() const noexcept {}
+
+    private:
+        friend class event_loop;
+        sleep_awaiter(event_loop* loop, clock::duration duration) : loop(loop), duration(duration) {}
+
+        event_loop* loop;
+        clock::duration duration;
+        waiter self;
+    };
+
+    // Everybody waiting for the same thing to happen; any number of coroutines may be on it at once
+    class wait_list {
+    private:
+        friend class event_loop;
+        std::vector<waiter*> waiters;
+    };
+
+    class list_awaiter {
+    public:
+        auto await_ready() const noexcept -> bool { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { loop->suspend_on_list(this, handle); }
+        auto await_resume() noexcept -> wait_result;
+
+    private:
+        friend class event_loop;
+        list_awaiter(event_loop* loop, wait_list* list, clock::duration timeout)
+          : loop(loop), list(list), timeout(timeout) {}
+
+        event_loop* loop;
+        wait_list* list;
+        clock::duration timeout;
+        waiter self;
+    };
+
+    event_loop();
+    event_loop(event_loop const&) = delete;
+    event_loop& operator=(event_loop const&) = delete;
+
+    auto readable(int fd, clock::duration timeout = no_timeout) -> fd_awaiter { return { this, fd, false, timeout }; }
+    auto writable(int fd, clock::duration timeout = no_timeout) -> fd_awaiter { return { this, fd, true, timeout }; }
+    auto sleep(clock::duration duration) -> sleep_awaiter { return { this, duration }; }
+    auto wait(wait_list& list, clock::duration timeout = no_timeout) -> list_awaiter { return { this, &list, timeout }; }
+    auto end_of_iteration() -> list_awaiter { return wait(iteration_end); }
+
+    // Resumes everyone on the list, right away; whoever waits on it again during that waits for the next one
+    void notify_all(wait_list& list);
+
+    void forget(int fd);
+    void watch_edges(int fd);
+
+    // Dispatches events and timers until somebody calls stop(); can be called again afterwards
+    void run();
+    void stop() noexcept;
+
+private:
+    struct fd_state {
+        waiter* reader = nullptr;
+        waiter* writer = nullptr;
+        uint32_t registered = 0;  // interest currently in the epoll set
+        bool added = false;
+        bool edge = false;        // registered edge-triggered for both directions, once and for all
+    };
+
+    struct timer_entry {
+        clock::time_point deadline;
+        uint64_t id;
+
+        auto operator>(timer_entry const& other) const noexcept -> bool { return deadline > other.deadline; }
+    };
+
+    void suspend_on_fd(fd_awaiter* awaiter, std::coroutine_handle<> handle);
+    void suspend_on_timer(sleep_awaiter* awaiter, std::coroutine_handle<> handle);
+    void suspend_on_list(list_awaiter* awaiter, std::coroutine_handle<> handle);
+    auto arm_timer(waiter* w, clock::duration timeout) -> uint64_t;
+    void update_interest(int fd, fd_state& state, uint32_t wanted);
+    void dispatch(epoll_event const& event);
+    void fire_timers();
+    auto next_timeout_ms() -> int;
+    void wake(waiter* w, io_event outcome);
+
+    epoll poller;
+    resource_handle wakeup;
+    std::atomic<bool> stopping = false;
+    std::vector<fd_state> fds;  // indexed by descriptor, which the kernel keeps small and dense
+    wait_list iteration_end;
+
+    std::priority_queue<timer_entry, std::vector<timer_entry>, std::greater<>> timers;
+    std::unordered_map<uint64_t, std::pair<waiter*, int>> live_timers;  // id -> waiter and fd (-1 for sleeps)
+    uint64_t next_timer_id = 1;
+};
+
+#endif  // EVENT_LOOP_HPP
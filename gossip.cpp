@@ -0,0 +1,228 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <utility>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gossip.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto gossip_interval = 50ms;
+constexpr uint64_t full_state_every = 20;
+constexpr size_t max_datagram = 1400;  // fits an Ethernet MTU with room for the headers
+
+// A peer as an IPv6 address (IPv4 ones mapped), which is what our dual-stack socket sends to
+auto resolve(peer_address const& peer, sockaddr_in6* out) -> bool
+{
+    auto hints = addrinfo{};
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_V4MAPPED;
+
+    addrinfo* addresses = nullptr;
+    auto service = std::to_string(peer.port);
+    if (auto err = getaddrinfo(peer.host.c_str(), service.c_str(), &hints, &addresses); err != 0) {
+        fprintf(stderr, "Failed to resolve gossip peer %s: %s\n", peer.host.c_str(), gai_strerror(err));
+        return false;
+    }
+
+    memcpy(out, addresses->ai_addr, sizeof(*out));
+    freeaddrinfo(addresses);
+    return true;
+}
+
+void load_replicas(std::string const& path, pn_counter* state)
+{
+    auto file = std::ifstream(path);
+    std::string line;
+    size_t malformed = 0;
+    while (std::getline(file, line)) {
+        malformed += !state->merge_encoded(line);
+    }
+
+    if (malformed) {
+        fprintf(stderr, "Skipped %zu unreadable lines in %s\n", malformed, path.c_str());
+    }
+}
+
+// Replaced atomically, the same way as the state file
+void save_replicas(std::string const& path, pn_counter const& state)
+{
+    auto temp_path = path + ".tmp";
+    auto file = fopen(temp_path.c_str(), "w");
+    if (!file) {
+        perror(("Failed to create " + temp_path).c_str());
+        return;
+    }
+
+    bool ok = true;
+    for (auto const& line : state.encode()) {
+        ok = ok && fprintf(file, "%s\n", line.c_str()) > 0;
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_path.c_str(), path.c_str()) < 0) {
+        perror(("Failed to write " + path).c_str());
+        unlink(temp_path.c_str());
+    }
+}
+
+auto start_time_ms() -> long
+{
+    using namespace std::chrono;
+    return long(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+}  // namespace
+
+gossip::gossip(server_context* server, gossip_config config)
+  : server(server),
+    config(std::move(config)),
+    state(this->config.id + "." + std::to_string(start_time_ms())),
+    socket(listen_on_dual_udp_socket(this->config.port))
+{
+    for (auto const& address : this->config.peers) {
+        auto resolved = peer { {}, address.host + ":" + std::to_string(address.port) };
+        if (resolve(address, &resolved.address)) {
+            peers.push_back(std::move(resolved));
+        }
+    }
+
+    if (!this->config.state_path.empty()) {
+        load_replicas(this->config.state_path, &state);
+    }
+
+    auto current = server->count->versioned_snapshot();
+    server->count->restore(state.value(), current.version);
+    fprintf(stderr, "Gossiping as %s with %zu peers; %zu replicas known so far\n", state.name().c_str(), peers.size(), state.replicas());
+}
+
+void gossip::start()
+{
+    spawn(send_rounds());
+    spawn(receive_rounds());
+}
+
+void gossip::stop()
+{
+    stopped = true;
+    server->loop->forget(socket.get().fd);
+}
+
+void gossip::finish()
+{
+    send_round(true);
+
+    if (!config.state_path.empty()) {
+        save_replicas(config.state_path, state);
+    }
+}
+
+auto gossip::send_rounds() -> task<>
+{
+    while (!stopped) {
+        co_await server->loop->sleep(gossip_interval);
+        if (!stopped) {
+            send_round(++rounds % full_state_every == 0);
+        }
+    }
+}
+
+auto gossip::receive_rounds() -> task<>
+{
+    auto fd = socket.get().fd;
+    while (co_await server->loop->readable(fd)) {
+        // Kept as a named local on purpose: GCC 12 lays out the frame wrongly otherwise
+        auto received = receive_datagrams();
+        (void)received;
+    }
+}
+
+void gossip::send_round(bool everything)
+{
+    // Whatever moved the count since the last round, other than gossip, was written here
+    state.record(server->count->snapshot() - state.value());
+
+    auto changes = state.take_changes();
+    auto lines = everything ? state.encode() : std::move(changes);
+    if (lines.empty() || peers.empty()) {
+        return;
+    }
+
+    auto header = "PN " + state.name() + "\n";
+    auto datagram = header;
+    auto send_datagram = [&] {
+        for (auto const& to : peers) {
+            auto sent = sendto(socket.get().fd, datagram.data(), datagram.size(), MSG_DONTWAIT,
+                reinterpret_cast<sockaddr const*>(&to.address), sizeof(to.address));
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+                fprintf(stderr, "Failed to gossip to %s: %s\n", to.name.c_str(), strerror(errno));
+            }
+        }
+    };
+
+    for (auto const& line : lines) {
+        if (datagram.size() + line.size() + 1 > max_datagram && datagram.size() > header.size()) {
+            send_datagram();
+            datagram = header;
+        }
+        datagram += line;
+        datagram += '\n';
+    }
+    send_datagram();
+}
+
+// Merges everything waiting on the socket; false once there's nothing left
+auto gossip::receive_datagrams() -> bool
+{
+    constexpr int max_datagrams = 256;  // then back to the loop, which will tell us again right away
+
+    char buffer[max_datagram + 1];
+    int64_t moved = 0;
+    int datagrams = 0;
+    for (; datagrams < max_datagrams; ++datagrams) {
+        auto received = recv(socket.get().fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+                perror("Failed to receive gossip");
+            }
+            break;
+        }
+
+        auto text = std::string_view(buffer, size_t(received));
+        if (!text.starts_with("PN ")) {
+            continue;
+        }
+
+        auto end = std::min(text.find('\n'), text.size());
+        text.remove_prefix(std::min(end + 1, text.size()));
+        while (!text.empty()) {
+            end = std::min(text.find('\n'), text.size());
+            moved += state.merge_encoded(text.substr(0, end)).value_or(0);
+            text.remove_prefix(std::min(end + 1, text.size()));
+        }
+    }
+
+    // Merges and the count move together, so the next round still sees our own writes as ours
+    if (moved) {
+        server->count->add(event_loop_worker, moved);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "Gossip moves the count by %ld to %ld\n", moved, current.value);
+        broadcast_count(server, current);
+    }
+
+    return datagrams > 0;
+}
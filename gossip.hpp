@@ -0,0 +1,69 @@
+#ifndef GOSSIP_HPP
+#define GOSSIP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "options.hpp"
+#include "pn-counter.hpp"
+#include "posix-resource-handle.hpp"
+#include "server.hpp"
+#include "task.hpp"
+
+// Active-active counting: every node takes writes on its own, and they agree on the total by gossip
+
+// The count stays what every client already sees: its value is the PN-counter's merged value.
+// Writes of every kind (INCR over any transport, CAS, the shm drain thread) go into the count as
+// they always have. Each gossip round works out our own part as the count less everybody else's,
+// and records the change since the last round as ours. What other replicas send is merged into the
+// PN-counter, and whatever that moves goes into the count and out to subscribers.
+//
+// A round goes out over UDP every gossip_interval to every peer, with the entries that changed since
+// the last one. Every full_state_every rounds it sends everything instead, which repairs whatever
+// datagrams were lost. With a handful of nodes that's a few hundred bytes a second per peer.
+// Versions stay per node. Values agree once gossip has settled, typically within a round trip.
+
+struct gossip_config {
+    std::string id;                  // unique in the cluster; the process adds its start time
+    uint16_t port = 0;               // our UDP port
+    std::vector<peer_address> peers; // everybody else's
+    std::string state_path;          // where the replicas' totals are saved on exit; empty means nowhere
+};
+
+class gossip {
+public:
+    // Loads the saved totals (if any) and sets the count to their value; the count's version stays
+    gossip(server_context* server, gossip_config config);
+
+    void start();
+    void stop();    // on drain: no more rounds, and nothing more taken in
+    void finish();  // once drained: sends everything one last time and saves it
+
+    auto replicas() const -> pn_counter const& { return state; }
+
+private:
+    struct peer {
+        sockaddr_in6 address;
+        std::string name;
+    };
+
+    auto send_rounds() -> task<>;
+    auto receive_rounds() -> task<>;
+
+    void send_round(bool everything);
+    auto receive_datagrams() -> bool;
+
+    server_context* server;
+    gossip_config config;
+    pn_counter state;
+    std::vector<peer> peers;
+    resource_handle socket;
+    uint64_t rounds = 0;
+    bool stopped = false;
+};
+
+#endif  // GOSSIP_HPP
@@ -0,0 +1,52 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// The hash the sketches share. It has to be the same everywhere a sketch might be merged, which rules
+// out std::hash (free to differ between builds).
+
+// MurmurHash64A, by Austin Appleby (public domain); it's what Redis hashes HyperLogLog items with
+inline auto murmur64(std::string_view bytes) -> uint64_t
+{
+    constexpr uint64_t m = 0xc6a4a7935bd1e995;
+    constexpr int r = 47;
+    constexpr uint64_t seed = 0xadc83b19;
+
+    uint64_t h = seed ^ (bytes.size() * m);
+
+    auto data = bytes.data();
+    auto end = data + bytes.size() / 8 * 8;
+    for (; data != end; data += 8) {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    auto tail = reinterpret_cast<uint8_t const*>(data);
+    switch (bytes.size() & 7) {
+    case 7: h ^= uint64_t(tail[6]) << 48; [[fallthrough]];
+    case 6: h ^= uint64_t(tail[5]) << 40; [[fallthrough]];
+    case 5: h ^= uint64_t(tail[4]) << 32; [[fallthrough]];
+    case 4: h ^= uint64_t(tail[3]) << 24; [[fallthrough]];
+    case 3: h ^= uint64_t(tail[2]) << 16; [[fallthrough]];
+    case 2: h ^= uint64_t(tail[1]) << 8;  [[fallthrough]];
+    case 1: h ^= uint64_t(tail[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+#endif  // HASH_HPP
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <limits>
+
+#include "hash.hpp"
+#include "heavy-hitters.hpp"
+
+heavy_hitters::heavy_hitters(size_t capacity)
+    : capacity(capacity ? capacity : 1)
+    , counters(depth * width)
+{
+    entries.reserve(this->capacity);
+    heap.reserve(this->capacity);
+}
+
+namespace {
+
+// One hash makes all the rows' indexes (Kirsch and Mitzenmacher: h1 + i * h2 is as good as
+// independent hashes for this)
+auto row_index(uint64_t hash, size_t row) -> size_t
+{
+    auto h1 = uint32_t(hash);
+    auto h2 = uint32_t(hash >> 32) | 1;
+    return (h1 + row * h2) % heavy_hitters::width;
+}
+
+}  // namespace
+
+auto heavy_hitters::add(std::string_view key, uint64_t delta) -> uint64_t
+{
+    key = key.substr(0, max_key_length);
+    auto hash = murmur64(key);
+
+    uint64_t* cells[depth];
+    auto lowest = std::numeric_limits<uint64_t>::max();
+    for (size_t row = 0; row < depth; ++row) {
+        cells[row] = &counters[row * width + row_index(hash, row)];
+        lowest = std::min(lowest, *cells[row]);
+    }
+
+    // Conservative update: nothing needs to be above the new estimate, so counters already there stay.
+    // Counts stick at the top rather than wrap around, which would take them down.
+    auto estimate = delta > std::numeric_limits<uint64_t>::max() - lowest ? std::numeric_limits<uint64_t>::max() : lowest + delta;
+    for (auto cell : cells) {
+        *cell = std::max(*cell, estimate);
+    }
+
+    if (auto it = by_key.find(key); it != by_key.end()) {
+        auto& e = entries[it->second];
+        e.count = estimate;
+        sift_down(e.slot);
+        return estimate;
+    }
+
+    if (entries.size() < capacity) {
+        entries.push_back({ estimate, std::string(key), heap.size() });
+        heap.push_back(entries.size() - 1);
+        by_key.emplace(entries.back().key, entries.size() - 1);
+
+        // A new key is the largest only if it really is; walk it up from the bottom
+        for (auto slot = heap.size() - 1; slot > 0; ) {
+            auto parent = (slot - 1) / 2;
+            if (entries[heap[parent]].count <= entries[heap[slot]].count) {
+                break;
+            }
+            swap_slots(slot, parent);
+            slot = parent;
+        }
+        return estimate;
+    }
+
+    // Full: the key only gets in by beating the smallest leader, which it then replaces
+    auto& smallest = entries[heap[0]];
+    if (estimate > smallest.count) {
+        by_key.erase(smallest.key);
+        smallest.key.assign(key);
+        smallest.count = estimate;
+        by_key.emplace(smallest.key, heap[0]);
+        sift_down(0);
+    }
+    return estimate;
+}
+
+auto heavy_hitters::estimate(std::string_view key) const -> uint64_t
+{
+    key = key.substr(0, max_key_length);
+    auto hash = murmur64(key);
+
+    auto lowest = std::numeric_limits<uint64_t>::max();
+    for (size_t row = 0; row < depth; ++row) {
+        lowest = std::min(lowest, counters[row * width + row_index(hash, row)]);
+    }
+    return lowest;
+}
+
+auto heavy_hitters::top(size_t n) const -> std::vector<std::pair<std::string, uint64_t>>
+{
+    std::vector<std::pair<std::string, uint64_t>> leaders;
+    leaders.reserve(entries.size());
+    for (auto const& e : entries) {
+        leaders.emplace_back(e.key, e.count);
+    }
+
+    n = std::min(n, leaders.size());
+    std::partial_sort(leaders.begin(), leaders.begin() + ptrdiff_t(n), leaders.end(), [](auto const& a, auto const& b) {
+        return a.second > b.second;
+    });
+    leaders.resize(n);
+    return leaders;
+}
+
+void heavy_hitters::sift_down(size_t slot)
+{
+    for (;;) {
+        auto smallest = slot;
+        for (auto child : { 2 * slot + 1, 2 * slot + 2 }) {
+            if (child < heap.size() && entries[heap[child]].count < entries[heap[smallest]].count) {
+                smallest = child;
+            }
+        }
+
+        if (smallest == slot) {
+            return;
+        }
+        swap_slots(slot, smallest);
+        slot = smallest;
+    }
+}
+
+void heavy_hitters::swap_slots(size_t a, size_t b)
+{
+    std::swap(heap[a], heap[b]);
+    entries[heap[a]].slot = a;
+    entries[heap[b]].slot = b;
+}
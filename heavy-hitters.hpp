@@ -0,0 +1,64 @@
+#ifndef HEAVY_HITTERS_HPP
+#define HEAVY_HITTERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Per-key counts for more keys than we could ever keep, and the few keys that count the most
+
+// Every key's count goes into a Count-Min sketch: `depth` rows of `width` counters, one counter per
+// row picked by hashing the key. A key's estimate is the smallest of its counters, which is never
+// below the true count and, with 4 rows of 2^14, above it by at most 0.02% of everything counted
+// with 98% confidence. Updates are conservative (only the counters at the minimum move), which
+// tightens that a good deal in practice. The memory is fixed, 512 KiB, whatever the number of keys.
+//
+// Alongside, a min-heap holds the `capacity` keys with the highest estimates so far, with an index
+// from key to entry so a key already there moves in place. A key that isn't takes the root's
+// place once its estimate beats it. Counts only go up: a sketch can't take anything away.
+
+class heavy_hitters {
+public:
+    static constexpr size_t depth = 4;
+    static constexpr size_t width = size_t(1) << 14;
+    static constexpr size_t max_key_length = 256;
+
+    heavy_hitters() : heavy_hitters(64) {}
+    explicit heavy_hitters(size_t capacity);
+
+    // The key index points into our own entries, so copies would point into someone else's
+    heavy_hitters(heavy_hitters const&) = delete;
+    heavy_hitters(heavy_hitters&&) = default;
+    auto operator=(heavy_hitters const&) -> heavy_hitters& = delete;
+    auto operator=(heavy_hitters&&) -> heavy_hitters& = default;
+
+    // Adds `delta` to `key`'s count; returns its new estimate
+    auto add(std::string_view key, uint64_t delta) -> uint64_t;
+
+    auto estimate(std::string_view key) const -> uint64_t;
+
+    // Up to `n` leading keys and their estimates, highest first
+    auto top(size_t n) const -> std::vector<std::pair<std::string, uint64_t>>;
+
+private:
+    struct entry {
+        uint64_t count;
+        std::string key;
+        size_t slot;  // where in `heap`
+    };
+
+    void sift_down(size_t slot);
+    void swap_slots(size_t a, size_t b);
+
+    size_t capacity;
+    std::vector<uint64_t> counters;  // depth rows of width
+    std::vector<entry> entries;      // never grows past `capacity`, so never moves
+    std::vector<size_t> heap;        // indices into `entries`, the smallest count at the root
+    std::unordered_map<std::string_view, size_t> by_key;  // keys point into `entries`
+};
+
+#endif  // HEAVY_HITTERS_HPP
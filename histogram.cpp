@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <utility>
+
+#include "histogram.hpp"
+
+namespace {
+
+constexpr uint64_t exact_values = uint64_t(1) << histogram::significant_bits;
+constexpr uint64_t half = exact_values / 2;
+
+auto bucket_of(uint64_t value) -> size_t
+{
+    if (value < exact_values) {
+        return size_t(value);
+    }
+
+    auto shift = std::bit_width(value) - histogram::significant_bits;
+    auto top = value >> shift;  // in [half, exact_values)
+    return size_t(exact_values + (shift - 1) * half + (top - half));
+}
+
+// The largest value that lands in `bucket`
+auto highest_in(size_t bucket) -> uint64_t
+{
+    if (bucket < exact_values) {
+        return bucket;
+    }
+
+    auto shift = (bucket - exact_values) / half + 1;
+    auto top = (bucket - exact_values) % half + half;
+    return (top << shift) + ((uint64_t(1) << shift) - 1);
+}
+
+template <typename Number>
+auto parse_number(std::string_view text, Number* out) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out);
+    return !text.empty() && err == std::errc() && end == text.data() + text.size();
+}
+
+}  // namespace
+
+void histogram::record(uint64_t value, uint64_t count)
+{
+    counts[bucket_of(value)] += count;
+    total += count;
+    lowest = std::min(lowest, value);
+    highest = std::max(highest, value);
+}
+
+void histogram::merge(histogram const& other)
+{
+    if (!other.total) {
+        return;
+    }
+
+    // Only the stretch of buckets the other one used; a plain loop the compiler vectorises
+    auto first = bucket_of(other.lowest);
+    auto last = bucket_of(other.highest);
+    for (auto i = first; i <= last; ++i) {
+        counts[i] += other.counts[i];
+    }
+
+    total += other.total;
+    lowest = std::min(lowest, other.lowest);
+    highest = std::max(highest, other.highest);
+}
+
+auto histogram::percentile(double percent) const -> uint64_t
+{
+    if (!total) {
+        return 0;
+    }
+
+    // The rank of the observation we're after, counting from 1
+    auto wanted = uint64_t(std::ceil(std::clamp(percent, 0.0, 100.0) / 100.0 * double(total)));
+    wanted = std::clamp<uint64_t>(wanted, 1, total);
+
+    uint64_t seen = 0;
+    auto last = bucket_of(highest);
+    for (auto i = bucket_of(lowest); i <= last; ++i) {
+        seen += counts[i];
+        if (seen >= wanted) {
+            return std::clamp(highest_in(i), lowest, highest);
+        }
+    }
+    return highest;
+}
+
+auto histogram::encode() const -> std::string
+{
+    auto out = std::to_string(min()) + "," + std::to_string(max());
+    if (!total) {
+        return out;
+    }
+
+    auto last = bucket_of(highest);
+    for (auto i = bucket_of(lowest); i <= last; ++i) {
+        if (counts[i]) {
+            out += ',';
+            out += std::to_string(i);
+            out += ':';
+            out += std::to_string(counts[i]);
+        }
+    }
+    return out;
+}
+
+auto histogram::merge_encoded(std::string_view encoded) -> bool
+{
+    auto next_field = [&encoded] {
+        auto end = std::min(encoded.find(','), encoded.size());
+        auto field = encoded.substr(0, end);
+        encoded.remove_prefix(std::min(end + 1, encoded.size()));
+        return field;
+    };
+
+    // A trailing comma would otherwise end the loop below as if nothing followed it
+    if (encoded.ends_with(',')) {
+        return false;
+    }
+
+    uint64_t low, high;
+    if (!parse_number(next_field(), &low) || !parse_number(next_field(), &high) || low > high) {
+        return false;
+    }
+
+    // Everything is checked before anything is added, so a bad line can't leave half of itself behind
+    std::vector<std::pair<size_t, uint64_t>> buckets;
+    uint64_t added = 0;
+    while (!encoded.empty()) {
+        auto field = next_field();
+        auto colon = field.find(':');
+        size_t bucket;
+        uint64_t count;
+        if (colon == std::string_view::npos || !parse_number(field.substr(0, colon), &bucket) ||
+            !parse_number(field.substr(colon + 1), &count) || bucket >= bucket_count ||
+            bucket < bucket_of(low) || bucket > bucket_of(high)) {
+            return false;
+        }
+        // Counts that would wrap the total (and with it every percentile) are as bad as ones that don't parse
+        if (__builtin_add_overflow(added, count, &added) || added > UINT64_MAX - total) {
+            return false;
+        }
+        buckets.emplace_back(bucket, count);
+    }
+
+    if (!added) {
+        return true;
+    }
+
+    for (auto [bucket, count] : buckets) {
+        counts[bucket] += count;
+    }
+    total += added;
+    lowest = std::min(lowest, low);
+    highest = std::max(highest, high);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// How observed values (latencies, sizes) are distributed, to within 0.8%, over the whole uint64_t range
+
+// Log-linear buckets, the way HdrHistogram lays them out: values below 2^significant_bits get a
+// bucket each, and every power of two above that is split into 2^(significant_bits - 1) equal
+// buckets, so a bucket is never wider than 1/128th of the values in it. That's 7424 buckets,
+// 58 KiB, for any range of values, and finding a value's bucket is a bit_width and a shift.
+//
+// Two histograms merge by adding their buckets, so shards (or other processes, through encode()
+// and merge_encoded()) can each keep their own and the percentiles of the merged one are the
+// percentiles of everything they saw together. Percentiles answer with the highest value the bucket
+// they land in could hold, so they never understate, clamped to the largest value really observed.
+
+class histogram {
+public:
+    static constexpr int significant_bits = 8;
+    static constexpr size_t bucket_count = (size_t(1) << significant_bits) + (64 - significant_bits) * (size_t(1) << (significant_bits - 1));
+
+    histogram() : counts(bucket_count) {}
+
+    void record(uint64_t value, uint64_t count = 1);
+    void merge(histogram const& other);
+
+    auto count() const -> uint64_t { return total; }
+    auto min() const -> uint64_t { return total ? lowest : 0; }
+    auto max() const -> uint64_t { return highest; }
+
+    // The value `percent` of observations are at or below; 0 when nothing was observed
+    auto percentile(double percent) const -> uint64_t;
+
+    // "min,max,bucket:count,bucket:count..." with only the buckets in use, and its way back in
+    auto encode() const -> std::string;
+    auto merge_encoded(std::string_view encoded) -> bool;  // false, and nothing merged, if it's malformed
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t lowest = UINT64_MAX;
+    uint64_t highest = 0;
+};
+
+#endif  // HISTOGRAM_HPP
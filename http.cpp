@@ -0,0 +1,183 @@
+#include <charconv>
+#include <cstdio>
+#include <strings.h>
+
+#include "http.hpp"
+
+namespace http {
+
+namespace {
+
+auto equals_ignoring_case(std::string_view a, std::string_view b) -> bool
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+auto trim(std::string_view text) -> std::string_view
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+// Pops everything up to the next `separator` off the front of `text`; all of it if there's none
+auto next_token(std::string_view* text, char separator) -> std::string_view
+{
+    auto end = text->find(separator);
+    auto token = text->substr(0, end);
+    text->remove_prefix(end == std::string_view::npos ? text->size() : end + 1);
+    return token;
+}
+
+auto parse_request_line(std::string_view line, request* out) -> bool
+{
+    out->method = next_token(&line, ' ');
+    auto target = next_token(&line, ' ');
+    auto version = line;
+
+    if (out->method.empty() || target.empty() || target.front() != '/') {
+        return false;
+    }
+
+    if (version.size() != 8 || !version.starts_with("HTTP/1.") || version[7] < '0' || version[7] > '9') {
+        return false;
+    }
+    out->minor_version = version[7] - '0';
+    out->keep_alive = out->minor_version >= 1;
+
+    out->path = next_token(&target, '?');
+    out->query = target;
+    return true;
+}
+
+auto parse_header(std::string_view line, request* out) -> bool
+{
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        return false;
+    }
+
+    auto name = line.substr(0, colon);
+    auto value = trim(line.substr(colon + 1));
+
+    if (equals_ignoring_case(name, "Content-Length")) {
+        auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), out->content_length);
+        return err == std::errc() && end == value.data() + value.size() && out->content_length <= max_request_size;
+    }
+
+    if (equals_ignoring_case(name, "Transfer-Encoding")) {
+        out->chunked = true;
+    }
+    else if (equals_ignoring_case(name, "Connection")) {
+        while (!value.empty()) {
+            auto option = trim(next_token(&value, ','));
+            if (equals_ignoring_case(option, "close")) {
+                out->keep_alive = false;
+            }
+            else if (equals_ignoring_case(option, "keep-alive")) {
+                out->keep_alive = true;
+            }
+            else if (equals_ignoring_case(option, "upgrade")) {
+                out->connection_upgrade = true;
+            }
+        }
+    }
+    else if (equals_ignoring_case(name, "Upgrade")) {
+        out->websocket_upgrade = equals_ignoring_case(value, "websocket");
+    }
+    else if (equals_ignoring_case(name, "Sec-WebSocket-Key")) {
+        out->websocket_key = value;
+    }
+    else if (equals_ignoring_case(name, "Sec-WebSocket-Version")) {
+        std::from_chars(value.data(), value.data() + value.size(), out->websocket_version);
+    }
+
+    return true;
+}
+
+}  // namespace
+
+auto parse_request(std::string_view buffer, request* out, size_t* length) -> parse_status
+{
+    auto head_end = buffer.find("\r\n\r\n");
+    if (head_end == std::string_view::npos) {
+        return parse_status::incomplete;
+    }
+
+    *out = request{};
+    auto head = buffer.substr(0, head_end + 2);  // every line, each with its CRLF
+
+    auto next_line = [&] {
+        auto line = next_token(&head, '\n');
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        return line;
+    };
+
+    if (!parse_request_line(next_line(), out)) {
+        return parse_status::malformed;
+    }
+
+    while (!head.empty()) {
+        if (!parse_header(next_line(), out)) {
+            return parse_status::malformed;
+        }
+    }
+
+    out->websocket_upgrade = out->websocket_upgrade && out->connection_upgrade;
+
+    // The body has to fit alongside the head; one that can't would never all arrive
+    *length = head_end + 4 + out->content_length;
+    if (*length > max_request_size) {
+        return parse_status::malformed;
+    }
+    return buffer.size() >= *length ? parse_status::complete : parse_status::incomplete;
+}
+
+auto query_parameter(std::string_view query, std::string_view name) -> std::optional<std::string_view>
+{
+    while (!query.empty()) {
+        auto pair = next_token(&query, '&');
+        auto key = next_token(&pair, '=');
+        if (key == name) {
+            return pair;
+        }
+    }
+
+    return std::nullopt;
+}
+
+auto format_response(char* out, size_t capacity, int status, std::string_view body, uint64_t version, bool keep_alive) -> size_t
+{
+    auto reason = [&] {
+        switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 421: return "Misdirected Request";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default:  return "Unknown";
+        }
+    }();
+
+    auto written = snprintf(out, capacity,
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: %zu\r\n"
+        "Count-Version: %lu\r\n"
+        "Connection: %s\r\n"
+        "\r\n"
+        "%.*s",
+        status, reason, body.size(), version, keep_alive ? "keep-alive" : "close", int(body.size()), body.data());
+
+    return written < 0 ? capacity : size_t(written);
+}
+
+}  // namespace http
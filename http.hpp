@@ -0,0 +1,53 @@
+#ifndef HTTP_HPP
+#define HTTP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// The sliver of HTTP/1.1 the counter endpoint needs
+
+// Requests are parsed in place: everything in a request is a view into the connection's receive
+// buffer, so nothing here allocates, and a request stays valid until the buffer is shifted past it.
+// Bodies are skipped (everything we take arrives in the query string) but still counted, so a client
+// sending one doesn't derail the next request on a kept-alive connection. Chunked bodies aren't
+// supported. A WebSocket upgrade request is recognised, but answering it is up to the caller.
+
+namespace http {
+
+// The whole request, head and body, has to fit; nobody has a good reason to send us more
+constexpr size_t max_request_size = 4096;
+
+struct request {
+    std::string_view method;
+    std::string_view path;
+    std::string_view query;    // after the '?', without it
+    int minor_version = 1;     // HTTP/1.x
+    bool keep_alive = true;
+    bool chunked = false;
+    size_t content_length = 0;
+
+    // Upgrade: websocket with Connection: upgrade; the handshake itself is websocket.hpp's business
+    bool connection_upgrade = false;
+    bool websocket_upgrade = false;
+    std::string_view websocket_key;
+    int websocket_version = 0;
+};
+
+enum class parse_status { incomplete, complete, malformed };
+
+// Parses the request at the front of `buffer`; when complete, *length is how many bytes it took up,
+// body included. A request whose head announces more than max_request_size in all is malformed.
+auto parse_request(std::string_view buffer, request* out, size_t* length) -> parse_status;
+
+// The value of `name` in a query string, as-is (we only ever look for numbers, so no unescaping)
+auto query_parameter(std::string_view query, std::string_view name) -> std::optional<std::string_view>;
+
+// Writes a complete response with a text/plain body into `out`; returns its length, which is
+// `capacity` or more if it didn't fit
+auto format_response(char* out, size_t capacity, int status, std::string_view body, uint64_t version, bool keep_alive) -> size_t;
+
+}  // namespace http
+
+#endif  // HTTP_HPP
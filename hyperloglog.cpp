@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "hash.hpp"
+#include "hyperloglog.hpp"
+
+namespace {
+
+// Bits of the hash left after the register index, and so the largest rank one can hold, less one
+constexpr int rank_bits = 64 - hyperloglog::precision;
+
+// What the estimate needs from the registers: how many are empty, how many saturated, and the sum
+// of 2^-rank over the rest. (Ertl's estimator is usually written as a loop over a histogram of
+// ranks, but that loop unrolls into exactly this sum, which vectorises where a histogram doesn't.)
+struct register_summary {
+    uint32_t zeros = 0;
+    uint32_t saturated = 0;
+    double sum = 0.0;
+};
+
+auto summarize(uint8_t const* registers) -> register_summary
+{
+    register_summary summary;
+    constexpr uint8_t saturated_rank = rank_bits + 1;
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 2^-rank is built straight from its float bits, (127 - rank) << 23, four registers per vector;
+    // empty registers are masked out rather than added as 1.0 and taken away again, which would cost
+    // the small terms their precision. Counts and sums build up in bytes and floats over a block of
+    // chunks (few enough that neither can overflow or lose much) before going into the totals.
+    auto const zero = _mm_setzero_si128();
+    auto const saturated = _mm_set1_epi8(char(saturated_rank));
+    auto const bias = _mm_set1_epi32(127);
+    auto total = _mm_setzero_pd();
+    auto counts = _mm_setzero_si128();  // zeros in the low 64 bits, saturated registers in the high
+
+    auto powers = [&](__m128i ranks) {
+        auto bits = _mm_slli_epi32(_mm_sub_epi32(bias, ranks), 23);
+        return _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(ranks, zero)), _mm_castsi128_ps(bits));
+    };
+
+    constexpr size_t block = 16 * 16;
+    for (; i < hyperloglog::register_count; i += block) {
+        auto zeros = _mm_setzero_si128();
+        auto saturations = _mm_setzero_si128();
+        auto sum = _mm_setzero_ps();
+
+        for (size_t j = i; j < i + block; j += 16) {
+            auto chunk = _mm_load_si128(reinterpret_cast<__m128i const*>(registers + j));
+            zeros = _mm_sub_epi8(zeros, _mm_cmpeq_epi8(chunk, zero));
+            saturations = _mm_sub_epi8(saturations, _mm_cmpeq_epi8(chunk, saturated));
+
+            auto low = _mm_unpacklo_epi8(chunk, zero);
+            auto high = _mm_unpackhi_epi8(chunk, zero);
+            sum = _mm_add_ps(sum, _mm_add_ps(
+                _mm_add_ps(powers(_mm_unpacklo_epi16(low, zero)), powers(_mm_unpackhi_epi16(low, zero))),
+                _mm_add_ps(powers(_mm_unpacklo_epi16(high, zero)), powers(_mm_unpackhi_epi16(high, zero)))));
+        }
+
+        // Sixteen byte counters each go into one 64-bit sum per half; both halves of each add up to a count
+        auto zero_sums = _mm_sad_epu8(zeros, zero);
+        auto saturated_sums = _mm_sad_epu8(saturations, zero);
+        counts = _mm_add_epi64(counts, _mm_add_epi64(_mm_unpacklo_epi64(zero_sums, saturated_sums), _mm_unpackhi_epi64(zero_sums, saturated_sums)));
+        total = _mm_add_pd(total, _mm_add_pd(_mm_cvtps_pd(sum), _mm_cvtps_pd(_mm_movehl_ps(sum, sum))));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, total);
+    summary.sum = lanes[0] + lanes[1];
+
+    uint64_t totals[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(totals), counts);
+    summary.zeros = uint32_t(totals[0]);
+    summary.saturated = uint32_t(totals[1]);
+#endif
+
+    for (; i < hyperloglog::register_count; ++i) {
+        summary.zeros += registers[i] == 0;
+        summary.saturated += registers[i] == saturated_rank;
+        summary.sum += registers[i] ? std::ldexp(1.0, -registers[i]) : 0.0;
+    }
+
+    // Saturated registers went into the sum along with the rest; they belong in tau's term instead
+    summary.sum -= summary.saturated * std::ldexp(1.0, -saturated_rank);
+    return summary;
+}
+
+// The two series from Ertl's paper, correcting for empty registers (sigma) and saturated ones (tau)
+auto sigma(double x) -> double
+{
+    if (x == 1.0) {
+        return INFINITY;
+    }
+
+    double y = 1.0;
+    double z = x;
+    double previous;
+    do {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (z != previous);
+
+    return z;
+}
+
+auto tau(double x) -> double
+{
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+
+    double y = 1.0;
+    double z = 1.0 - x;
+    double previous;
+    do {
+        x = std::sqrt(x);
+        previous = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != previous);
+
+    return z / 3.0;
+}
+
+}  // namespace
+
+auto hyperloglog::add(std::string_view item) -> bool
+{
+    auto hash = murmur64(item);
+    auto index = hash & (register_count - 1);
+
+    // A sentinel bit above the rest keeps the count of trailing zeros in range when they're all zero
+    auto rest = (hash >> precision) | (uint64_t(1) << rank_bits);
+    auto rank = uint8_t(std::countr_zero(rest) + 1);
+
+    if (registers[index] >= rank) {
+        return false;
+    }
+
+    registers[index] = rank;
+    cached_estimate.reset();
+    return true;
+}
+
+void hyperloglog::merge(hyperloglog const& other)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i < register_count; i += 16) {
+        auto mine = _mm_load_si128(reinterpret_cast<__m128i const*>(registers.data() + i));
+        auto theirs = _mm_load_si128(reinterpret_cast<__m128i const*>(other.registers.data() + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(registers.data() + i), _mm_max_epu8(mine, theirs));
+    }
+#endif
+
+    for (; i < register_count; ++i) {
+        registers[i] = std::max(registers[i], other.registers[i]);
+    }
+
+    cached_estimate.reset();
+}
+
+auto hyperloglog::estimate() const -> uint64_t
+{
+    if (cached_estimate) {
+        return *cached_estimate;
+    }
+
+    auto summary = summarize(registers.data());
+
+    constexpr double m = register_count;
+    auto z = m * tau((m - summary.saturated) / m) * std::ldexp(1.0, -rank_bits) + summary.sum + m * sigma(summary.zeros / m);
+
+    constexpr double alpha = 0.5 / M_LN2;
+    cached_estimate = uint64_t(std::llround(alpha * m * m / z));
+    return *cached_estimate;
+}
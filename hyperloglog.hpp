@@ -0,0 +1,41 @@
+#ifndef HYPERLOGLOG_HPP
+#define HYPERLOGLOG_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// An estimate of how many distinct items were added, in 16 KiB whatever the count
+
+// Each item is hashed to 64 bits; the low `precision` bits pick a register, and the register keeps
+// the longest run of trailing zeros seen in the rest (plus one). With 2^14 registers the standard
+// error is about 0.81%. The estimate uses Ertl's improved estimator ("New cardinality estimation
+// algorithms for HyperLogLog sketches", 2017), the same one Redis uses, which needs no empirical bias
+// tables and holds up from zero to billions.
+//
+// Registers are a byte each rather than packed into six bits: it costs a quarter more memory but
+// turns merging into a byte-wise max, which SSE2 does 16 registers per instruction, and lets the
+// estimate widen registers into floats 16 at a time. The hash is MurmurHash64A, so sketches
+// built by different processes (or machines) agree on what an item maps to and can be merged.
+
+class hyperloglog {
+public:
+    static constexpr int precision = 14;
+    static constexpr size_t register_count = size_t(1) << precision;
+
+    // Whether the item moved any register, i.e. whether the estimate might have changed
+    auto add(std::string_view item) -> bool;
+
+    // Makes this the sketch of the union of both sets
+    void merge(hyperloglog const& other);
+
+    auto estimate() const -> uint64_t;
+
+private:
+    alignas(64) std::array<uint8_t, register_count> registers = {};
+    mutable std::optional<uint64_t> cached_estimate = 0;  // forgotten whenever a register moves
+};
+
+#endif  // HYPERLOGLOG_HPP
@@ -0,0 +1,267 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "posix-resource-handle.hpp"
+#include "event-loop.hpp"
+#include "gossip.hpp"
+#include "options.hpp"
+#include "raft-cluster.hpp"
+#include "replication.hpp"
+#include "server.hpp"
+#include "shm-transport.hpp"
+#include "task.hpp"
+
+namespace {
+
+auto handle_signals(server_context* server, int signal_fd) -> task<>
+{
+    while (co_await server->loop->readable(signal_fd)) {
+        auto info = signalfd_siginfo{};
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            fprintf(stderr, "Received %s\n", strsignal(int(info.ssi_signo)));
+
+            if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+                server->loop->stop();
+            }
+        }
+    }
+}
+
+// Nothing is ever sent on an attach socket, so readable means the producer hung up
+auto watch_shm_producer(server_context* server, shm_transport* shm, resource_handle producer) -> task<>
+{
+    auto fd = producer.get().fd;
+    co_await server->loop->readable(fd);
+
+    server->loop->forget(fd);
+    shm->detach_producer(fd);
+}
+
+auto accept_shm_producers(server_context* server, shm_transport* shm, int listen_socket) -> task<>
+{
+    while (co_await server->loop->readable(listen_socket)) {
+        if (auto producer = shm->accept_producer(listen_socket)) {
+            spawn(watch_shm_producer(server, shm, std::move(producer)));
+        }
+    }
+}
+
+// The drain thread can't touch connections, so it pokes us and we do the broadcast
+auto relay_shm_updates(server_context* server, shm_transport* shm) -> task<>
+{
+    // Hoisted on purpose: GCC 12 mangles the coroutine frame when the handle's pointer temporary
+    // lives in the same full-expression as the co_await
+    auto updates_fd = shm->updates().get().fd;
+    while (co_await server->loop->readable(updates_fd)) {
+        shm->clear_updates();
+        broadcast_count(server, server->count->versioned_snapshot());
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    auto opts = parse_options(argc, argv);
+
+    // Before any threads exist, so they all inherit the blocked mask and signals only ever show up here
+    auto signal_fd = listen_for_signals({ SIGINT, SIGTERM });
+
+    std::vector<resource_handle> listen_sockets;
+    listen_sockets.push_back(listen_on_dual_tcp_socket(opts.port));
+    if (!opts.unix_stream_path.empty()) {
+        listen_sockets.push_back(listen_on_unix_socket(opts.unix_stream_path, SOCK_STREAM));
+    }
+    if (!opts.unix_seqpacket_path.empty()) {
+        listen_sockets.push_back(listen_on_unix_socket(opts.unix_seqpacket_path, SOCK_SEQPACKET));
+    }
+
+    resource_handle http_listen_socket;
+    if (opts.http_port) {
+        http_listen_socket = listen_on_dual_tcp_socket(opts.http_port);
+    }
+
+    resource_handle udp_socket;
+    if (opts.udp_port) {
+        udp_socket = listen_on_dual_udp_socket(opts.udp_port);
+    }
+
+    auto loop = event_loop();
+
+    auto count = sharded_counter(worker_slot_count);
+    if (!opts.state_file.empty()) {
+        auto saved = load_count(opts.state_file);
+        count.restore(saved.value, saved.version);
+    }
+    auto server = server_context { &loop, &count };
+
+    // A cluster member's count comes from its own snapshot and log
+    std::unique_ptr<raft_cluster> raft;
+    if (!opts.raft_members.empty()) {
+        raft = std::make_unique<raft_cluster>(&server, raft_config { opts.raft_members, opts.raft_id, opts.raft_directory, opts.port, opts.dedupe_clients });
+        server.raft = raft.get();
+    }
+
+    // A gossiping node's count is everybody's totals merged, ours included
+    std::unique_ptr<gossip> gossiping;
+    if (opts.gossip_port) {
+        auto state_path = opts.state_file.empty() ? std::string() : opts.state_file + ".pn";
+        gossiping = std::make_unique<gossip>(&server, gossip_config { opts.gossip_id, opts.gossip_port, opts.gossip_peers, state_path });
+    }
+
+    auto initial = count.versioned_snapshot();
+    fprintf(stderr, "Starting up... count initialized to %ld@%lu\n", initial.value, initial.version);
+
+    server.dedupe = dedupe_window(opts.dedupe_clients);
+    server.rates = rate_window(initial.value);
+    server.hitters = heavy_hitters(opts.top_keys);
+    server.max_distinct = opts.max_distinct;
+    server.max_histograms = opts.max_histograms;
+    server.edge_triggered = opts.edge_triggered;
+    server.max_connections = opts.max_connections;
+    server.max_outbound = opts.max_outbound;
+    server.max_commands_per_second = opts.max_commands_per_second;
+    server.shards = shard_map(opts.shard_nodes, opts.shard_id);
+    if (server.shards.sharded()) {
+        fprintf(stderr, "Holding the names that hash to node %zu of %zu\n", opts.shard_id, server.shards.size());
+    }
+    server.connections.reserve(1024);  // 8 KiB in exchange for zero reallocations on the first 1024 connections is a no-brainer
+
+    spawn(send_batched_output(&server));
+    spawn(serve_ready_connections(&server));
+
+    spawn(handle_signals(&server, signal_fd.get().fd));
+
+    for (auto const& listen_socket : listen_sockets) {
+        spawn(accept_connections(&server, listen_socket.get().fd));
+    }
+    if (http_listen_socket) {
+        spawn(accept_http_connections(&server, http_listen_socket.get().fd));
+    }
+    if (udp_socket) {
+        spawn(serve_udp(&server, udp_socket.get().fd));
+    }
+
+    int leader_fd = -1;
+    if (!opts.leader_host.empty()) {
+        server.read_only = true;
+        spawn(follow_leader(&server, leader_address { opts.leader_host, opts.leader_port }, &leader_fd));
+    }
+
+    if (raft) {
+        raft->start();
+    }
+
+    if (gossiping) {
+        gossiping->start();
+    }
+
+    // Producers attach through their own seqpacket listener, kept apart from the line-protocol ones
+    resource_handle shm_listen_socket;
+    std::unique_ptr<shm_transport> shm;
+    if (!opts.shm_socket_path.empty()) {
+        shm_listen_socket = listen_on_unix_socket(opts.shm_socket_path, SOCK_SEQPACKET);
+        shm = std::make_unique<shm_transport>(&count, shm_drain_worker, opts.shm_rings);
+        spawn(accept_shm_producers(&server, shm.get(), shm_listen_socket.get().fd));
+        spawn(relay_shm_updates(&server, shm.get()));
+    }
+
+    loop.run();
+
+    // Drain: stop taking on new work, finish what's already here, give every client what it's owed,
+    // and only then let go of the count
+    fprintf(stderr, "Draining...\n");
+    server.draining = true;
+    server.drain_deadline = event_loop::clock::now() + opts.drain_timeout;
+
+    for (auto const& listen_socket : listen_sockets) {
+        loop.forget(listen_socket.get().fd);
+    }
+    listen_sockets.clear();
+
+    if (http_listen_socket) {
+        loop.forget(http_listen_socket.get().fd);
+        http_listen_socket.reset();
+    }
+
+    if (udp_socket) {
+        loop.forget(udp_socket.get().fd);  // serve_udp applies what's still queued on its way out
+    }
+
+    if (leader_fd != -1) {
+        loop.forget(leader_fd);  // whatever the leader says from here on, we're not listening
+    }
+
+    if (raft) {
+        raft->stop();  // writes still arriving get NOTLEADER; the cluster carries on without us
+    }
+
+    if (gossiping) {
+        gossiping->stop();  // what the others send from here on waits for our next run
+    }
+
+    if (shm) {
+        loop.forget(shm_listen_socket.get().fd);
+        loop.forget(shm->updates().get().fd);
+        shm->stop();
+        broadcast_count(&server, count.versioned_snapshot());
+    }
+
+    // Long polls get the count as it stands, and some of them hang up right away, so this goes first
+    loop.notify_all(server.count_changed);
+
+    // Commands clients already sent are sitting in our socket buffers; they get applied (and
+    // broadcast) before anybody is told goodbye. HTTP and WebSocket connections read their own on
+    // the way out.
+    auto remaining = server.connections;
+    for (auto conn : remaining) {
+        if (conn->protocol == wire_protocol::http || conn->protocol == wire_protocol::websocket) {
+            continue;
+        }
+
+        for (auto const& line : receive_lines(conn, { SIZE_MAX, SIZE_MAX }).lines) {
+            parse_and_handle(&server, conn, line);
+        }
+    }
+
+    // Cancelling a connection's wait sends it into flush_before_close; the loop stops by itself once
+    // the last one has flushed or given up at the deadline
+    for (auto conn : remaining) {
+        loop.forget(conn->fd());
+    }
+
+    if (!server.connections.empty()) {
+        loop.run();
+    }
+
+    if (gossiping) {
+        gossiping->finish();  // includes whatever the drain applied
+    }
+
+    auto final_count = count.versioned_snapshot();
+    if (!opts.state_file.empty()) {
+        save_count(opts.state_file, final_count);
+    }
+
+    auto const& overload = server.overload;
+    if (overload.refused || overload.shed || overload.paused || overload.dropped) {
+        fprintf(stderr, "Under overload: refused %zu connections, shed %zu commands, paused reads %zu times, dropped %zu clients\n",
+            overload.refused, overload.shed, overload.paused, overload.dropped);
+    }
+
+    fprintf(stderr, "Shutting down... final count is %ld@%lu\n", final_count.value, final_count.version);
+
+    for (auto const& path : { opts.unix_stream_path, opts.unix_seqpacket_path, opts.shm_socket_path }) {
+        if (!path.empty()) {
+            unlink(path.c_str());
+        }
+    }
+}
@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "options.hpp"
+
+namespace {
+
+void print_usage(char const* argv0)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -p, --port PORT               TCP port to listen on (default 8089)\n"
+        "      --http-port PORT          also serve the count over HTTP/1.1 on PORT\n"
+        "      --udp-port PORT           also accept unacknowledged INCR/DECR datagrams on PORT\n"
+        "  -u, --unix-socket PATH        also listen on a Unix stream socket at PATH\n"
+        "      --unix-seqpacket PATH     also listen on a Unix seqpacket socket at PATH\n"
+        "      --shm-socket PATH         accept shared-memory producers on a Unix socket at PATH\n"
+        "      --shm-rings N             number of producer rings in the shared region (default 16)\n"
+        "      --follow HOST:PORT        mirror the count of the server at HOST:PORT, read-only\n"
+        "      --raft-members LIST       comma-separated HOST:PORT Raft addresses of a 3- or 5-member cluster\n"
+        "      --raft-id N               which of the members we are, counting from 0\n"
+        "      --raft-dir PATH           where our Raft log lives (instead of --state-file)\n"
+        "      --gossip-port PORT        count active-active, gossiping with other nodes over UDP on PORT\n"
+        "      --gossip-peers LIST       comma-separated HOST:PORT gossip addresses of the other nodes\n"
+        "      --gossip-id NAME          our name among them (default: the hostname)\n"
+        "      --shard-nodes LIST        comma-separated HOST:PORT client addresses of every node sharing out the names\n"
+        "      --shard-id N              which of those nodes we are, counting from 0\n"
+        "      --dedupe-clients N        clients whose request IDs are remembered (default 4096; the same on every Raft member)\n"
+        "      --top-keys K              leading keys tracked for TOPK (default 64)\n"
+        "      --max-distinct N          HyperLogLog sketches PFADD may create (default 1024)\n"
+        "      --max-histograms N        histograms OBSERVE may create (default 1024)\n"
+        "      --edge-triggered          register client connections with epoll edge-triggered\n"
+        "      --max-clients N           tell clients beyond N connections BUSY (default 0, no limit)\n"
+        "      --max-outbound BYTES      stop reading from a client owing more than BYTES (default 0, no limit)\n"
+        "      --max-commands N          answer a connection's commands beyond N a second BUSY (default 0, no limit)\n"
+        "  -s, --state-file PATH         load the count from PATH at startup and save it there on exit\n"
+        "      --drain-timeout MS        time allowed for flushing clients on shutdown (default 5000)\n"
+        "  -h, --help                    show this message\n",
+        argv0);
+}
+
+auto parse_number(char const* argv0, char const* text, unsigned long min, unsigned long max) -> unsigned long
+{
+    char* end = nullptr;
+    auto value = strtoul(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value < min || value > max) {
+        fprintf(stderr, "Invalid value: %s (expected %lu to %lu)\n", text, min, max);
+        print_usage(argv0);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+// HOST:PORT, with brackets around an IPv6 address ([::1]:8089)
+auto parse_address(char const* argv0, std::string const& text) -> peer_address
+{
+    auto colon = text.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        fprintf(stderr, "Invalid address: %s (expected HOST:PORT)\n", text.c_str());
+        print_usage(argv0);
+        exit(EXIT_FAILURE);
+    }
+
+    auto host = text.substr(0, colon);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    return { host, uint16_t(parse_number(argv0, text.c_str() + colon + 1, 1, 65535)) };
+}
+
+void parse_leader(char const* argv0, char const* text, server_options* opts)
+{
+    auto leader = parse_address(argv0, text);
+    opts->leader_host = leader.host;
+    opts->leader_port = leader.port;
+}
+
+auto parse_addresses(char const* argv0, char const* text) -> std::vector<peer_address>
+{
+    auto list = std::string_view(text);
+    std::vector<peer_address> addresses;
+    while (!list.empty()) {
+        auto comma = std::min(list.find(','), list.size());
+        addresses.push_back(parse_address(argv0, std::string(list.substr(0, comma))));
+        list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+    return addresses;
+}
+
+// It goes into the gossip datagrams as a word of its own
+auto parse_name(char const* argv0, char const* text) -> std::string
+{
+    auto name = std::string(text);
+    if (name.empty() || name.size() > 64 || name.find_first_of(" \t\r\n") != std::string::npos) {
+        fprintf(stderr, "Invalid name: %s (expected up to 64 characters and no spaces)\n", text);
+        print_usage(argv0);
+        exit(EXIT_FAILURE);
+    }
+
+    return name;
+}
+
+}  // namespace
+
+auto parse_options(int argc, char** argv) -> server_options
+{
+    enum long_only : int {
+        unix_seqpacket = 256,
+        shm_socket,
+        shm_rings,
+        udp_port,
+        drain_timeout,
+        http_port,
+        follow,
+        dedupe_clients,
+        max_distinct,
+        top_keys,
+        max_histograms,
+        raft_members,
+        raft_id,
+        raft_dir,
+        gossip_port,
+        gossip_peers,
+        gossip_id,
+        shard_nodes,
+        shard_id,
+        edge_triggered,
+        max_clients,
+        max_outbound,
+        max_commands,
+    };
+
+    static option const long_options[] = {
+        { "port",           required_argument, nullptr, 'p' },
+        { "http-port",      required_argument, nullptr, http_port },
+        { "udp-port",       required_argument, nullptr, udp_port },
+        { "unix-socket",    required_argument, nullptr, 'u' },
+        { "unix-seqpacket", required_argument, nullptr, unix_seqpacket },
+        { "shm-socket",     required_argument, nullptr, shm_socket },
+        { "shm-rings",      required_argument, nullptr, shm_rings },
+        { "follow",         required_argument, nullptr, follow },
+        { "raft-members",   required_argument, nullptr, raft_members },
+        { "raft-id",        required_argument, nullptr, raft_id },
+        { "raft-dir",       required_argument, nullptr, raft_dir },
+        { "gossip-port",    required_argument, nullptr, gossip_port },
+        { "gossip-peers",   required_argument, nullptr, gossip_peers },
+        { "gossip-id",      required_argument, nullptr, gossip_id },
+        { "shard-nodes",    required_argument, nullptr, shard_nodes },
+        { "shard-id",       required_argument, nullptr, shard_id },
+        { "dedupe-clients", required_argument, nullptr, dedupe_clients },
+        { "max-distinct",   required_argument, nullptr, max_distinct },
+        { "top-keys",       required_argument, nullptr, top_keys },
+        { "max-histograms", required_argument, nullptr, max_histograms },
+        { "edge-triggered", no_argument,       nullptr, edge_triggered },
+        { "max-clients",    required_argument, nullptr, max_clients },
+        { "max-outbound",   required_argument, nullptr, max_outbound },
+        { "max-commands",   required_argument, nullptr, max_commands },
+        { "state-file",     required_argument, nullptr, 's' },
+        { "drain-timeout",  required_argument, nullptr, drain_timeout },
+        { "help",           no_argument,       nullptr, 'h' },
+        { nullptr,          0,                 nullptr, 0   },
+    };
+
+    auto opts = server_options{};
+    for (int opt; (opt = getopt_long(argc, argv, "p:u:s:h", long_options, nullptr)) != -1; ) {
+        switch (opt) {
+        case 'p':            opts.port = uint16_t(parse_number(argv[0], optarg, 0, 65535)); break;
+        case http_port:      opts.http_port = uint16_t(parse_number(argv[0], optarg, 1, 65535)); break;
+        case udp_port:       opts.udp_port = uint16_t(parse_number(argv[0], optarg, 1, 65535)); break;
+        case 'u':            opts.unix_stream_path = optarg; break;
+        case unix_seqpacket: opts.unix_seqpacket_path = optarg; break;
+        case shm_socket:     opts.shm_socket_path = optarg; break;
+        case shm_rings:      opts.shm_rings = uint32_t(parse_number(argv[0], optarg, 1, 4096)); break;
+        case follow:         parse_leader(argv[0], optarg, &opts); break;
+        case raft_members:   opts.raft_members = parse_addresses(argv[0], optarg); break;
+        case raft_id:        opts.raft_id = parse_number(argv[0], optarg, 0, 6); break;
+        case raft_dir:       opts.raft_directory = optarg; break;
+        case gossip_port:    opts.gossip_port = uint16_t(parse_number(argv[0], optarg, 1, 65535)); break;
+        case gossip_peers:   opts.gossip_peers = parse_addresses(argv[0], optarg); break;
+        case gossip_id:      opts.gossip_id = parse_name(argv[0], optarg); break;
+        case shard_nodes:    opts.shard_nodes = parse_addresses(argv[0], optarg); break;
+        case shard_id:       opts.shard_id = parse_number(argv[0], optarg, 0, 65535); break;
+        case dedupe_clients: opts.dedupe_clients = parse_number(argv[0], optarg, 1, 1 << 24); break;
+        case max_distinct:   opts.max_distinct = parse_number(argv[0], optarg, 0, 1 << 20); break;
+        case top_keys:       opts.top_keys = parse_number(argv[0], optarg, 1, 1 << 16); break;
+        case max_histograms: opts.max_histograms = parse_number(argv[0], optarg, 0, 1 << 20); break;
+        case edge_triggered: opts.edge_triggered = true; break;
+        case max_clients:    opts.max_connections = parse_number(argv[0], optarg, 0, 1 << 24); break;
+        case max_outbound:   opts.max_outbound = parse_number(argv[0], optarg, 0, 1ul << 32); break;
+        case max_commands:   opts.max_commands_per_second = parse_number(argv[0], optarg, 0, 1ul << 32); break;
+        case 's':            opts.state_file = optarg; break;
+        case drain_timeout:  opts.drain_timeout = std::chrono::milliseconds(parse_number(argv[0], optarg, 0, 3600000)); break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        default:
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The shm drain thread writes to the count from a thread of its own, which a follower's mirroring
+    // can't allow, and a follower has nothing for producers to do anyway
+    if (!opts.leader_host.empty() && !opts.shm_socket_path.empty()) {
+        fprintf(stderr, "A follower is read-only; it can't take shared-memory producers\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A cluster agrees on the count through its log alone: nothing else may write to it or replace it
+    if (!opts.raft_members.empty()) {
+        auto members = opts.raft_members.size();
+        if (members != 1 && members != 3 && members != 5 && members != 7) {
+            fprintf(stderr, "A Raft cluster needs an odd number of members, 7 at most (3 or 5 is usual)\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opts.raft_id >= members || opts.raft_directory.empty()) {
+            fprintf(stderr, "A Raft member needs --raft-id (one of the %zu members) and --raft-dir\n", members);
+            exit(EXIT_FAILURE);
+        }
+        if (!opts.leader_host.empty() || !opts.shm_socket_path.empty() || !opts.state_file.empty()) {
+            fprintf(stderr, "A Raft member can't also --follow, take shared-memory producers, or use a --state-file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Gossip lets every node write; a follower can't, and a Raft member writes only through its log
+    if (opts.gossip_port) {
+        if (!opts.leader_host.empty() || !opts.raft_members.empty()) {
+            fprintf(stderr, "A gossiping node can't also --follow or be a Raft member\n");
+            exit(EXIT_FAILURE);
+        }
+        if (opts.gossip_id.empty()) {
+            char host[256] = {};
+            gethostname(host, sizeof(host) - 1);
+            opts.gossip_id = parse_name(argv[0], host);
+        }
+    }
+    else if (!opts.gossip_peers.empty() || !opts.gossip_id.empty()) {
+        fprintf(stderr, "--gossip-peers and --gossip-id need --gossip-port\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.shard_id >= std::max<size_t>(opts.shard_nodes.size(), 1)) {
+        fprintf(stderr, "--shard-id must be one of the %zu --shard-nodes\n", opts.shard_nodes.size());
+        exit(EXIT_FAILURE);
+    }
+
+    if (optind < argc) {
+        fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    return opts;
+}
@@ -0,0 +1,88 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Everything that can be tweaked from the command line; the defaults reproduce the original
+// hard-coded behaviour, so running with no arguments serves plain TCP on port 8089
+
+struct peer_address {
+    std::string host;
+    uint16_t port = 0;
+};
+
+struct server_options {
+    uint16_t port = 8089;
+
+    // GET /count, POST /incr and long polls over HTTP/1.1; 0 means no HTTP listener
+    uint16_t http_port = 0;
+
+    // Fire-and-forget INCR/DECR datagrams; 0 means no UDP socket
+    uint16_t udp_port = 0;
+
+    // Same-host clients can skip the loopback TCP stack entirely; empty means don't listen
+    std::string unix_stream_path;
+    std::string unix_seqpacket_path;
+
+    // Producers on this host attach here to get a shared-memory ring; empty disables the transport
+    std::string shm_socket_path;
+    uint32_t shm_rings = 16;
+
+    // Follow the leader at this address, mirroring its count read-only; empty host means we lead
+    std::string leader_host;
+    uint16_t leader_port = 0;
+
+    // Be one member of a Raft cluster: every member's Raft address, our place among them, and where
+    // our log lives; no members means we stand alone
+    std::vector<peer_address> raft_members;
+    size_t raft_id = 0;
+    std::string raft_directory;
+
+    // Count active-active with other nodes, each taking writes and gossiping its totals over UDP on
+    // gossip_port; 0 means we count alone. The ID names us among them (the hostname by default).
+    uint16_t gossip_port = 0;
+    std::vector<peer_address> gossip_peers;
+    std::string gossip_id;
+
+    // Share the named sketches, histograms and keyed counts out between several servers: every
+    // server's client address, in the same order everywhere, and which of them we are. Names another
+    // server holds get MOVED; no nodes means we hold them all.
+    std::vector<peer_address> shard_nodes;
+    size_t shard_id = 0;
+
+    // How many clients' request IDs are remembered for deduplicating retried INCR/DECR
+    size_t dedupe_clients = 4096;
+
+    // How many leading keys TOPK can report
+    size_t top_keys = 64;
+
+    // How many HyperLogLog sketches PFADD may create, at 16 KiB each
+    size_t max_distinct = 1024;
+
+    // How many histograms OBSERVE may create, at 58 KiB each
+    size_t max_histograms = 1024;
+
+    // Register client connections edge-triggered: one epoll_ctl per connection for its whole life,
+    // and each socket read until EAGAIN (or its turn is up) instead of reported again and again
+    bool edge_triggered = false;
+
+    // Admission control, 0 meaning no limit: clients beyond max_connections are told BUSY and hung
+    // up on, a client owing more than max_outbound bytes isn't read from until it catches up, and
+    // commands beyond max_commands_per_second (per connection) are answered BUSY
+    size_t max_connections = 0;
+    size_t max_outbound = 0;
+    size_t max_commands_per_second = 0;
+
+    // Where the count is loaded from at startup and saved to on shutdown; empty means start from zero
+    std::string state_file;
+
+    // How long a shutdown may spend flushing pending output to clients
+    std::chrono::milliseconds drain_timeout { 5000 };
+};
+
+auto parse_options(int argc, char** argv) -> server_options;
+
+#endif  // OPTIONS_HPP
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <charconv>
+
+#include "pn-counter.hpp"
+
+namespace {
+
+template <typename Number>
+auto parse_number(std::string_view text, Number* out) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out);
+    return !text.empty() && err == std::errc() && end == text.data() + text.size();
+}
+
+}  // namespace
+
+void pn_counter::record(int64_t delta)
+{
+    if (!delta) {
+        return;
+    }
+
+    auto& own = by_name[self];
+    if (delta > 0) {
+        own.p += uint64_t(delta);
+    }
+    else {
+        own.n += 0 - uint64_t(delta);  // INT64_MIN has no positive int64_t
+    }
+    changed.insert(self);
+}
+
+auto pn_counter::merge(std::string_view replica, totals seen) -> int64_t
+{
+    if (replica == self) {
+        return 0;
+    }
+
+    auto found = by_name.find(replica);
+    if (found == by_name.end()) {
+        found = by_name.emplace(std::string(replica), totals{}).first;
+    }
+
+    auto& known = found->second;
+    auto grew_p = seen.p > known.p ? seen.p - known.p : 0;
+    auto grew_n = seen.n > known.n ? seen.n - known.n : 0;
+    if (!grew_p && !grew_n) {
+        return 0;
+    }
+
+    known.p += grew_p;
+    known.n += grew_n;
+    changed.insert(found->first);
+
+    auto moved = int64_t(grew_p - grew_n);
+    others += moved;
+    return moved;
+}
+
+auto pn_counter::own_value() const -> int64_t
+{
+    auto own = by_name.find(self);
+    return own == by_name.end() ? 0 : int64_t(own->second.p - own->second.n);
+}
+
+auto pn_counter::encode() const -> std::vector<std::string>
+{
+    std::vector<std::string> lines;
+    for (auto const& [replica, entry] : by_name) {
+        lines.push_back(format(replica, entry));
+    }
+    return lines;
+}
+
+auto pn_counter::take_changes() -> std::vector<std::string>
+{
+    std::vector<std::string> lines;
+    for (auto const& replica : changed) {
+        lines.push_back(format(replica, by_name.find(replica)->second));
+    }
+    changed.clear();
+    return lines;
+}
+
+auto pn_counter::merge_encoded(std::string_view line) -> std::optional<int64_t>
+{
+    auto first = line.find(' ');
+    auto second = first == std::string_view::npos ? first : line.find(' ', first + 1);
+    auto seen = totals{};
+    if (second == std::string_view::npos || first == 0 ||
+        !parse_number(line.substr(first + 1, second - first - 1), &seen.p) ||
+        !parse_number(line.substr(second + 1), &seen.n)) {
+        return std::nullopt;
+    }
+
+    return merge(line.substr(0, first), seen);
+}
+
+auto pn_counter::format(std::string const& replica, totals const& entry) const -> std::string
+{
+    return replica + " " + std::to_string(entry.p) + " " + std::to_string(entry.n);
+}
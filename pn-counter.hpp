@@ -0,0 +1,69 @@
+#ifndef PN_COUNTER_HPP
+#define PN_COUNTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The count as a PN-counter, a CRDT: every replica's increments and decrements, mergeable in any order
+
+// Each replica keeps two totals that only ever grow, P for what it added and N for what it took
+// away. The value is the sum of P - N over every replica. Merging another replica's view takes the
+// larger of each total, so merges can be repeated, reordered or lost and resent, and every replica
+// that has seen the same updates has the same value. No replica ever waits for another.
+//
+// Only a replica's own entry moves because of its own writes, so a replica must never come back
+// under a name it used before with totals lower than it had. A process uses a fresh name every time
+// it starts ("<id>.<start time>"). Its earlier names' totals come back through its saved state, or
+// from the other replicas, which still hold them.
+//
+// Replicas pass on what changed since they last sent (delta-state), including what they learned
+// from others, so an update spreads even between replicas that don't talk to each other directly.
+
+class pn_counter {
+public:
+    struct totals {
+        uint64_t p = 0;
+        uint64_t n = 0;
+    };
+
+    explicit pn_counter(std::string self) : self(std::move(self)) {}
+
+    auto name() const -> std::string const& { return self; }
+
+    // Our own writes, however many, as one net change; any split into P and N that only grows is
+    // as good as another
+    void record(int64_t delta);
+
+    // Someone's totals as another replica saw them; returns how far that moved the value. Our own
+    // entry is ours alone to move.
+    auto merge(std::string_view replica, totals seen) -> int64_t;
+
+    auto value() const -> int64_t { return own_value() + others; }
+    auto own_value() const -> int64_t;
+    auto others_value() const -> int64_t { return others; }
+    auto replicas() const -> size_t { return by_name.size(); }
+
+    // "replica p n" lines: every entry, or only those that changed since the last take_changes()
+    auto encode() const -> std::vector<std::string>;
+    auto take_changes() -> std::vector<std::string>;
+
+    // Merges one line of the above; how far it moved the value, or nullopt if it's malformed
+    auto merge_encoded(std::string_view line) -> std::optional<int64_t>;
+
+private:
+    auto format(std::string const& replica, totals const& entry) const -> std::string;
+
+    std::string self;
+    std::map<std::string, totals, std::less<>> by_name;
+    std::set<std::string, std::less<>> changed;
+    int64_t others = 0;  // the sum of P - N over everybody but us
+};
+
+#endif  // PN_COUNTER_HPP
@@ -1,7 +1,12 @@
 #ifndef POSIX_RESOURCE_WRAPPER_HPP
 #define POSIX_RESOURCE_WRAPPER_HPP
 
+#include <cerrno>
+#include <cstdio>
 #include <memory>
+#include <system_error>
+#include <utility>
+
 #include <unistd.h>
 
 // Custom deleter that wraps a POSIX file descriptor
@@ -40,7 +45,7 @@ using resource_handle = std::unique_ptr<void, fd_deleter>;  // file descriptors
 
 // A small utility function for transforming fatal errors into exceptions
 [[noreturn]]
-void throw_system_error()
+inline void throw_system_error()
 {
     throw std::system_error(std::make_error_code(std::errc(errno)));
 }
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "raft-cluster.hpp"
+#include "resp.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto tick_interval = 10ms;
+constexpr auto connect_timeout = 1s;
+constexpr auto first_retry = 100ms;
+constexpr auto last_retry = 2s;
+
+auto host_and_port(std::string const& host, unsigned port) -> std::string
+{
+    auto bracketed = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+    return bracketed + ":" + std::to_string(port);
+}
+
+}  // namespace
+
+raft_cluster::raft_cluster(server_context* server, raft_config config)
+  : server(server),
+    config(std::move(config)),
+    log(this->config.directory),
+    node(this->config.id, this->config.members.size(), &log, raft_node::clock::now(), this->config.dedupe_clients),
+    links(this->config.members.size())
+{
+    auto const& snapshot = log.snapshot();
+    server->count->restore(snapshot.count.value, snapshot.count.version);
+    fprintf(stderr, "Raft member %zu of %zu in term %lu, with a snapshot at %lu and %lu entries after it\n",
+        this->config.id, this->config.members.size(), log.current_term(), snapshot.index, log.last_index() - snapshot.index);
+
+    listen_socket = listen_on_dual_tcp_socket(this->config.members[this->config.id].port);
+    wakeup = resource_handle(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (!wakeup) {
+        throw_system_error();
+    }
+}
+
+void raft_cluster::start()
+{
+    spawn(accept_members(listen_socket.get().fd));
+    for (size_t member = 0; member < config.members.size(); ++member) {
+        if (member != config.id) {
+            spawn(connect_to_member(member));
+        }
+    }
+    spawn(tick());
+    spawn(flush_when_woken());
+}
+
+void raft_cluster::stop()
+{
+    stopped = true;
+    server->loop->forget(listen_socket.get().fd);
+    server->loop->forget(wakeup.get().fd);
+    for (auto fd : inbound) {
+        server->loop->forget(fd);
+    }
+    for (auto& link : links) {
+        if (link.outbound.handle) {
+            server->loop->forget(link.outbound.fd());
+        }
+    }
+}
+
+auto raft_cluster::propose(connection* conn, int64_t delta, std::string request_id, result* outcome) -> bool
+{
+    if (stopped) {
+        return false;
+    }
+
+    auto index = node.propose(delta, std::move(request_id));
+    if (!index) {
+        return false;
+    }
+
+    if (conn && (conn->protocol == wire_protocol::resp || outcome)) {
+        writes.push_back({ index, node.term(), conn, outcome });
+    }
+    wake_flush();
+    return true;
+}
+
+auto raft_cluster::read(connection* conn) -> bool
+{
+    if (stopped || !node.is_leader()) {
+        return false;
+    }
+
+    reads.push_back(conn);
+    answer_reads();
+    return true;
+}
+
+auto raft_cluster::leader_hint() const -> std::string
+{
+    auto leader = node.leader();
+    return leader && *leader != config.id ? links[*leader].client_address : std::string();
+}
+
+void raft_cluster::forget(connection* conn)
+{
+    std::erase_if(writes, [conn](pending_write const& write) { return write.conn == conn; });
+    std::erase(reads, conn);
+}
+
+auto raft_cluster::accept_members(int listen_socket) -> task<>
+{
+    while (co_await server->loop->readable(listen_socket)) {
+        if (auto member = accept_connection(listen_socket)) {
+            spawn(serve_member(std::move(member)));
+        }
+    }
+}
+
+auto raft_cluster::serve_member(resource_handle handle) -> task<>
+{
+    auto fd = handle.get().fd;
+    inbound.push_back(fd);
+
+    auto member = config.members.size();  // nobody, until they introduce themselves
+    auto pending = std::string();
+    while (co_await server->loop->readable(fd)) {
+        if (!receive_from_member(fd, &member, &pending)) {
+            break;
+        }
+    }
+
+    if (member < config.members.size()) {
+        fprintf(stderr, "Raft member %zu disconnected\n", member);
+    }
+    std::erase(inbound, fd);
+    server->loop->forget(fd);
+}
+
+auto raft_cluster::connect_to_member(size_t member) -> task<>
+{
+    auto const& address = config.members[member];
+    auto greeting = "RAFT " + std::to_string(config.id) + " " + std::to_string(config.client_port) + "\n";
+
+    auto retry = std::chrono::milliseconds(first_retry);
+    while (!stopped) {
+        auto handle = start_connect(address.host, address.port);
+        if (handle) {
+            // Hoisted on purpose: GCC 12 mangles the coroutine frame when the handle's pointer
+            // temporary lives in the same full-expression as the co_await
+            auto fd = handle.get().fd;
+            auto connected = co_await server->loop->writable(fd, connect_timeout);
+            if (connected && connect_error(fd) == 0) {
+                retry = first_retry;
+
+                fprintf(stderr, "Connected to Raft member %zu\n", member);
+                auto& link = links[member];
+                link.outbound = connection { std::move(handle), host_and_port(address.host, address.port) };
+                queue_output(server, &link.outbound, greeting);
+                wake_flush();  // whatever it missed while we were apart
+
+                // Nothing ever comes back this way, so readable means they hung up
+                auto hung_up = co_await server->loop->readable(fd);
+                (void)hung_up;
+
+                fprintf(stderr, "Lost the connection to Raft member %zu\n", member);
+                server->loop->forget(fd);  // also stops a flush_outbound still waiting on it
+                link.outbound = connection{};
+                node.lost_peer(member);
+            }
+            else {
+                server->loop->forget(fd);
+            }
+        }
+
+        if (stopped) {
+            break;
+        }
+
+        co_await server->loop->sleep(retry);
+        retry = std::min(std::chrono::milliseconds(last_retry), retry * 2);
+    }
+}
+
+auto raft_cluster::tick() -> task<>
+{
+    while (!stopped) {
+        co_await server->loop->sleep(tick_interval);
+        node.tick(raft_node::clock::now());
+        wake_flush();
+    }
+}
+
+auto raft_cluster::flush_when_woken() -> task<>
+{
+    auto fd = wakeup.get().fd;
+    while (co_await server->loop->readable(fd)) {
+        uint64_t wakeups;
+        auto got = ::read(fd, &wakeups, sizeof(wakeups));
+        (void)got;
+
+        flush_pending = false;
+        flush();
+    }
+}
+
+// Reads everything a member sent and hands it to the node; false once the member is gone. `member`
+// is who they said they were; `pending` holds a line split across reads.
+auto raft_cluster::receive_from_member(int fd, size_t* member, std::string* pending) -> bool
+{
+    char buffer[16384];
+    auto connected = true;
+    while (connected) {
+        auto received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received == 0) {
+            connected = false;
+            break;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to read from a Raft member");
+                connected = false;
+            }
+            break;
+        }
+
+        pending->append(buffer, size_t(received));
+        auto now = raft_node::clock::now();
+        size_t start = 0;
+        for (size_t end; (end = pending->find('\n', start)) != std::string::npos; start = end + 1) {
+            if (*member < config.members.size()) {
+                node.receive(*member, std::string_view(*pending).substr(start, end - start), now);
+                continue;
+            }
+
+            size_t id;
+            unsigned port;
+            if (sscanf(pending->c_str() + start, "RAFT %zu %u", &id, &port) != 2 || id >= config.members.size() || id == config.id) {
+                fprintf(stderr, "Something that isn't a member of this cluster connected to the Raft port\n");
+                return false;
+            }
+
+            *member = id;
+            links[id].client_address = host_and_port(config.members[id].host, port);
+            fprintf(stderr, "Raft member %zu connected; its clients use %s\n", id, links[id].client_address.c_str());
+        }
+        pending->erase(0, start);
+    }
+
+    wake_flush();
+    return connected;
+}
+
+// Everything that happened since the last flush gets one: proposals and peer messages pile up,
+// and the flush runs once the loop has dispatched whatever else was ready alongside them
+void raft_cluster::wake_flush()
+{
+    if (!flush_pending) {
+        flush_pending = true;
+        uint64_t one = 1;
+        auto written = write(wakeup.get().fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void raft_cluster::flush()
+{
+    node.flush(raft_node::clock::now());
+
+    for (auto& message : node.take_messages()) {
+        auto& link = links[message.to];
+        if (link.outbound.handle) {
+            message.text += '\n';
+            queue_output(server, &link.outbound, message.text);
+        }
+    }
+
+    // Writes the snapshot jumped over may or may not have made it into it
+    if (auto snapshot = node.take_snapshot()) {
+        server->count->assign(event_loop_worker, snapshot->count.value, snapshot->count.version);
+        while (!writes.empty() && writes.front().index <= snapshot->index) {
+            answer_write(writes.front(), result::unknown);
+            writes.pop_front();
+        }
+        broadcast_count(server, snapshot->count);
+    }
+
+    size_t changes = 0;
+    int64_t moved = 0;
+    while (auto next = node.next_to_apply()) {
+        auto index = next->index;
+        auto const& entry = *next->entry;
+        if (next->counts) {
+            server->count->add(event_loop_worker, entry.delta);
+            ++changes;
+            moved += entry.delta;
+        }
+
+        // Ours only if the entry that got committed at its index is the one we proposed there
+        while (!writes.empty() && writes.front().index <= index) {
+            auto const& write = writes.front();
+            answer_write(write, write.index == index && write.term == entry.term ? result::applied : result::lost);
+            writes.pop_front();
+        }
+    }
+
+    if (changes) {
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%zu committed entries change the count by %ld to %ld\n", changes, moved, current.value);
+        broadcast_count(server, current);
+    }
+
+    node.compact(server->count->versioned_snapshot());
+    answer_reads();
+}
+
+void raft_cluster::answer_write(pending_write const& write, result outcome)
+{
+    if (write.outcome) {
+        *write.outcome = outcome;
+        server->loop->notify_all(server->count_changed);
+        return;
+    }
+
+    auto reply = std::string();
+    if (outcome == result::applied) {
+        resp::append_integer(reply, server->count->snapshot());
+    }
+    else if (outcome == result::lost) {
+        resp::append_error(reply, "ERR leadership changed before the write was committed; it was not applied");
+    }
+    else {
+        resp::append_error(reply, "ERR leadership changed; the write may or may not have been applied");
+    }
+    queue_output(server, write.conn, reply);
+}
+
+void raft_cluster::answer_reads()
+{
+    if (reads.empty()) {
+        return;
+    }
+
+    if (!node.is_leader()) {
+        for (auto conn : reads) {
+            send_not_leader(server, conn);
+        }
+        reads.clear();
+        return;
+    }
+
+    // Otherwise they wait for a heartbeat round to renew the lease
+    if (!node.can_read(raft_node::clock::now())) {
+        return;
+    }
+
+    auto current = server->count->versioned_snapshot();
+    for (auto conn : reads) {
+        if (conn->protocol == wire_protocol::resp) {
+            auto reply = std::string();
+            resp::append_bulk_string(reply, std::to_string(current.value));
+            queue_output(server, conn, reply);
+        }
+        else {
+            send_count(server, conn, current);
+        }
+    }
+    reads.clear();
+}
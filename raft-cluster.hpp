@@ -0,0 +1,115 @@
+#ifndef RAFT_CLUSTER_HPP
+#define RAFT_CLUSTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.hpp"
+#include "posix-resource-handle.hpp"
+#include "raft-log.hpp"
+#include "raft.hpp"
+#include "server.hpp"
+#include "task.hpp"
+
+// A counting-server as one member of a Raft cluster: the peer connections, timers and durable log
+// around a raft_node, with the count as its state machine
+
+// Every member is started with the same list of members (the Raft port of each) and its own place in
+// it. Each member connects to every other one and sends it requests and replies over that connection
+// only, so each TCP connection carries traffic one way. A new connection starts with "RAFT <id>
+// <client port>"; the port lets the followers send clients to the leader.
+//
+// The count only changes when committed entries are applied, on every member alike, so versions
+// agree across the cluster. Request IDs travel with the entries and are deduplicated as they're
+// applied, against raft_node's own window rather than the server's, so a client retrying against a
+// new leader is counted once. Proposals and peer messages only wake a flush, and that runs once the
+// event loop has dispatched everything that was ready. One fdatasync and one AppendEntries per
+// follower then cover the whole batch.
+//
+// Only the count is replicated. Keyed increments, sketches and histograms stay on the member that
+// took them, as they do with followers. CAS and INCRIF aren't supported here.
+
+struct raft_config {
+    std::vector<peer_address> members;  // the same list, in the same order, everywhere
+    size_t id = 0;                      // our place in it
+    std::string directory;              // our term, vote, log and snapshot
+    uint16_t client_port = 0;           // where our clients connect, for redirecting them to us
+    size_t dedupe_clients = 4096;       // clients whose request IDs are remembered; the same everywhere
+};
+
+class raft_cluster {
+public:
+    // Restores the count from the snapshot; entries after it are applied once the leader says
+    // they're committed
+    raft_cluster(server_context* server, raft_config config);
+
+    void start();
+    void stop();  // on drain: stops talking to the other members
+
+    enum class result {
+        pending,
+        applied,
+        lost,     // another leader's entry was committed in its place
+        unknown,  // a snapshot from another leader skipped past it
+    };
+
+    // A write from a client; false when we aren't the leader. RESP clients are answered once it's
+    // applied, and `outcome` (if given) is set then. Anybody else sees the count move like any other
+    // subscriber. Whatever is waiting on `outcome` has to forget() its connection before giving up.
+    auto propose(connection* conn, int64_t delta, std::string request_id, result* outcome = nullptr) -> bool;
+
+    // A read that sees every write committed before it: answered straight away under the lease,
+    // otherwise once the next heartbeat round renews it. false when we aren't the leader.
+    auto read(connection* conn) -> bool;
+
+    // "host:port" for clients of whoever leads, if we know and it isn't us
+    auto leader_hint() const -> std::string;
+
+    void forget(connection* conn);  // it hung up; nothing more gets sent to it
+
+private:
+    struct peer_link {
+        connection outbound;         // while connected
+        std::string client_address;  // from their greeting
+    };
+
+    struct pending_write {
+        uint64_t index;
+        uint64_t term;
+        connection* conn;
+        result* outcome;
+    };
+
+    auto accept_members(int listen_socket) -> task<>;
+    auto serve_member(resource_handle handle) -> task<>;
+    auto connect_to_member(size_t member) -> task<>;
+    auto tick() -> task<>;
+    auto flush_when_woken() -> task<>;
+
+    auto receive_from_member(int fd, size_t* member, std::string* pending) -> bool;
+    void wake_flush();
+    void flush();
+    void answer_write(pending_write const& write, result outcome);
+    void answer_reads();
+
+    server_context* server;
+    raft_config config;
+    raft_log log;
+    raft_node node;
+    std::vector<peer_link> links;
+
+    resource_handle listen_socket;
+    resource_handle wakeup;  // eventfd
+    bool flush_pending = false;
+    bool stopped = false;
+    std::vector<int> inbound;  // sockets the other members connected to us on
+
+    std::deque<pending_write> writes;  // by index
+    std::vector<connection*> reads;
+};
+
+#endif  // RAFT_CLUSTER_HPP
@@ -0,0 +1,256 @@
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dedupe-window.hpp"
+#include "raft-log.hpp"
+
+namespace {
+
+[[noreturn]]
+void fail(std::string const& what)
+{
+    perror(what.c_str());
+    fprintf(stderr, "The Raft log can't be trusted any more; stopping\n");
+    exit(EXIT_FAILURE);
+}
+
+void write_all(int fd, std::string_view bytes, std::string const& path)
+{
+    while (!bytes.empty()) {
+        auto written = write(fd, bytes.data(), bytes.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Failed to write " + path);
+        }
+        bytes.remove_prefix(size_t(written));
+    }
+}
+
+// A rename only survives a crash once the directory holding it is synced too
+void sync_directory(std::string const& directory)
+{
+    auto dir = resource_handle(open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!dir || fsync(dir.get().fd) < 0) {
+        fail("Failed to sync " + directory);
+    }
+}
+
+// Writes `contents` to a temporary file and renames it over `path`; returns the new file, still
+// open, for whoever wants to keep appending to it
+auto replace_file(std::string const& directory, std::string const& name, std::string_view contents) -> resource_handle
+{
+    auto path = directory + "/" + name;
+    auto temp_path = path + ".tmp";
+    auto file = resource_handle(open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644));
+    if (!file) {
+        fail("Failed to create " + temp_path);
+    }
+
+    write_all(file.get().fd, contents, temp_path);
+    if (fsync(file.get().fd) < 0 || rename(temp_path.c_str(), path.c_str()) < 0) {
+        fail("Failed to replace " + path);
+    }
+    sync_directory(directory);
+    return file;
+}
+
+template <typename Number>
+auto parse_number(std::string_view text, Number* out) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out);
+    return !text.empty() && err == std::errc() && end == text.data() + text.size();
+}
+
+}  // namespace
+
+void append_entry(std::string& out, raft_entry const& entry)
+{
+    out += std::to_string(entry.term);
+    if (entry.noop) {
+        out += ",-";
+        return;
+    }
+
+    out += ',';
+    out += std::to_string(entry.delta);
+    if (!entry.request_id.empty()) {
+        out += ',';
+        out += entry.request_id;
+    }
+}
+
+auto parse_entry(std::string_view text, raft_entry* out) -> bool
+{
+    auto comma = text.find(',');
+    if (comma == std::string_view::npos || !parse_number(text.substr(0, comma), &out->term)) {
+        return false;
+    }
+
+    auto rest = text.substr(comma + 1);
+    out->noop = rest == "-";
+    out->delta = 0;
+    out->request_id.clear();
+    if (out->noop) {
+        return true;
+    }
+
+    comma = rest.find(',');
+    if (comma != std::string_view::npos) {
+        out->request_id = rest.substr(comma + 1);
+        rest = rest.substr(0, comma);
+    }
+    return parse_number(rest, &out->delta);
+}
+
+raft_log::raft_log(std::string directory) : directory(std::move(directory))
+{
+    if (mkdir(this->directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        fail("Failed to create " + this->directory);
+    }
+
+    if (auto meta = std::ifstream(this->directory + "/meta"); meta && !(meta >> term >> vote)) {
+        fprintf(stderr, "%s/meta is unreadable\n", this->directory.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if (auto snapshot = std::ifstream(this->directory + "/snapshot")) {
+        std::string line;
+        if (!std::getline(snapshot, line) ||
+            sscanf(line.c_str(), "%lu %lu %ld %lu", &base.index, &base.term, &base.count.value, &base.count.version) != 4 ||
+            (std::getline(snapshot, base.applied_ids) && !dedupe_window().restore(base.applied_ids))) {
+            fprintf(stderr, "%s/snapshot is unreadable\n", this->directory.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // A crash between writing a snapshot and rewriting the log leaves entries the snapshot already
+    // covers at the front; a log starting past the snapshot means a file went missing
+    if (auto log = std::ifstream(this->directory + "/log")) {
+        std::string line;
+        uint64_t index = 0;
+        if (!std::getline(log, line) || sscanf(line.c_str(), "after %lu", &index) != 1 || index > base.index) {
+            fprintf(stderr, "%s/log doesn't follow on from the snapshot at %lu\n", this->directory.c_str(), base.index);
+            exit(EXIT_FAILURE);
+        }
+
+        auto entry = raft_entry{};
+        while (std::getline(log, line) && !log.eof() && parse_entry(line, &entry)) {
+            if (++index > base.index) {
+                entries.push_back(entry);
+            }
+        }
+    }
+
+    // Starting on a clean copy means appends never land after a torn line
+    rewrite_log();
+}
+
+void raft_log::set_term(uint64_t new_term, int new_vote)
+{
+    meta_changed |= new_term != term || new_vote != vote;
+    term = new_term;
+    vote = new_vote;
+}
+
+auto raft_log::term_at(uint64_t index) const -> std::optional<uint64_t>
+{
+    if (index == base.index) {
+        return base.term;
+    }
+    if (index < base.index || index > last_index()) {
+        return std::nullopt;
+    }
+    return at(index).term;
+}
+
+void raft_log::append(raft_entry entry)
+{
+    if (!needs_rewrite) {
+        append_entry(unwritten, entry);
+        unwritten += '\n';
+    }
+    entries.push_back(std::move(entry));
+}
+
+void raft_log::truncate_from(uint64_t index)
+{
+    if (index <= last_index()) {
+        entries.resize(index - base.index - 1);
+        needs_rewrite = true;
+        unwritten.clear();
+    }
+}
+
+void raft_log::install(raft_snapshot const& snapshot)
+{
+    if (snapshot.index <= base.index) {
+        return;
+    }
+
+    if (term_at(snapshot.index) == snapshot.term) {
+        entries.erase(entries.begin(), entries.begin() + ptrdiff_t(snapshot.index - base.index));
+    }
+    else {
+        entries.clear();
+    }
+
+    base = snapshot;
+    write_snapshot();
+    needs_rewrite = true;
+    unwritten.clear();
+}
+
+void raft_log::sync()
+{
+    if (meta_changed) {
+        write_meta();
+        meta_changed = false;
+    }
+
+    if (needs_rewrite) {
+        rewrite_log();
+    }
+    else if (!unwritten.empty()) {
+        auto path = directory + "/log";
+        write_all(log_file.get().fd, unwritten, path);
+        if (fdatasync(log_file.get().fd) < 0) {
+            fail("Failed to sync " + path);
+        }
+        unwritten.clear();
+    }
+}
+
+void raft_log::write_meta()
+{
+    replace_file(directory, "meta", std::to_string(term) + " " + std::to_string(vote) + "\n");
+}
+
+void raft_log::write_snapshot()
+{
+    char line[96];
+    auto size = snprintf(line, sizeof(line), "%lu %lu %ld %lu\n", base.index, base.term, base.count.value, base.count.version);
+    replace_file(directory, "snapshot", std::string(line, size_t(size)) + base.applied_ids + "\n");
+}
+
+void raft_log::rewrite_log()
+{
+    auto contents = "after " + std::to_string(base.index) + "\n";
+    for (auto const& entry : entries) {
+        append_entry(contents, entry);
+        contents += '\n';
+    }
+
+    log_file = replace_file(directory, "log", contents);
+    unwritten.clear();
+    needs_rewrite = false;
+}
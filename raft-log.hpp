@@ -0,0 +1,93 @@
+#ifndef RAFT_LOG_HPP
+#define RAFT_LOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "posix-resource-handle.hpp"
+#include "sharded-counter.hpp"
+
+// What a Raft member must not forget across a crash: its term, its vote, and its log
+
+// Three files in a directory of their own. "meta" holds the term and the vote on one line,
+// "snapshot" the count as it stood at some applied index and, on a second line, the request IDs
+// applied by then; both are replaced atomically (write, fsync, rename) when they change. The state
+// machine is a single integer and a bounded window of IDs, so snapshots are cheap and the log is cut
+// short often. "log" names the index it follows on its first line, then has one line per entry. New
+// entries are appended and fdatasync'd in batches by sync(), so everything proposed in one turn of the
+// event loop shares one disk flush. Cutting off a conflicting suffix, or everything a snapshot now
+// covers, rewrites the whole file under a new name and renames it over the old one. A crash can
+// leave a torn last line, which nobody was ever told about; it is dropped on load.
+//
+// Nothing here is optional: a member that can't make its log durable must not vote or acknowledge
+// anything, so any I/O failure ends the process.
+
+struct raft_entry {
+    uint64_t term = 0;
+    int64_t delta = 0;
+    bool noop = false;       // what a new leader commits first, to find out what's committed
+    std::string request_id;  // "client:sequence" from the client, or empty; deduplicated when applied
+};
+
+// The same text in the log file and in AppendEntries: "term,delta[,request ID]" or "term,-"
+void append_entry(std::string& out, raft_entry const& entry);
+auto parse_entry(std::string_view text, raft_entry* out) -> bool;
+
+struct raft_snapshot {
+    uint64_t index = 0;  // the last entry it includes
+    uint64_t term = 0;   // and that entry's term
+    versioned_value count = {};
+    std::string applied_ids;  // the request IDs applied up to it, as dedupe_window::save() writes them
+};
+
+class raft_log {
+public:
+    static constexpr int no_vote = -1;
+
+    // Loads whatever the directory holds, creating it if it doesn't exist
+    explicit raft_log(std::string directory);
+
+    auto current_term() const -> uint64_t { return term; }
+    auto voted_for() const -> int { return vote; }
+    void set_term(uint64_t new_term, int new_vote);
+
+    auto snapshot() const -> raft_snapshot const& { return base; }
+    auto last_index() const -> uint64_t { return base.index + entries.size(); }
+    auto last_term() const -> uint64_t { return entries.empty() ? base.term : entries.back().term; }
+
+    // Entries from the snapshot's index on; nothing before it, or past the end
+    auto term_at(uint64_t index) const -> std::optional<uint64_t>;
+    auto at(uint64_t index) const -> raft_entry const& { return entries[index - base.index - 1]; }
+
+    void append(raft_entry entry);
+    void truncate_from(uint64_t index);
+
+    // Forgets the entries the snapshot covers. One from another member may be ahead of our log, or
+    // disagree with it, in which case the whole log goes.
+    void install(raft_snapshot const& snapshot);
+
+    // Everything above is on disk when this returns
+    void sync();
+
+private:
+    void write_meta();
+    void write_snapshot();
+    void rewrite_log();
+
+    std::string directory;
+    uint64_t term = 0;
+    int vote = no_vote;
+    raft_snapshot base;
+    std::vector<raft_entry> entries;  // base.index + 1 onwards
+
+    resource_handle log_file;
+    std::string unwritten;            // appended entries not in the file yet
+    bool meta_changed = false;
+    bool needs_rewrite = false;
+};
+
+#endif  // RAFT_LOG_HPP
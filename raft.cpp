@@ -0,0 +1,516 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <utility>
+
+#include "raft.hpp"
+
+namespace {
+
+// The space-separated fields of a message, one at a time
+class fields {
+public:
+    explicit fields(std::string_view text) : rest(text) {}
+
+    auto next() -> std::string_view
+    {
+        auto start = std::min(rest.find_first_not_of(' '), rest.size());
+        auto end = std::min(rest.find(' ', start), rest.size());
+        auto field = rest.substr(start, end - start);
+        rest.remove_prefix(end);
+        return field;
+    }
+
+    template <typename Number>
+    auto next(Number* out) -> bool
+    {
+        auto field = next();
+        auto [end, err] = std::from_chars(field.data(), field.data() + field.size(), *out);
+        return !field.empty() && err == std::errc() && end == field.data() + field.size();
+    }
+
+    // Whatever fields are left, as they are
+    auto remaining() -> std::string_view
+    {
+        rest.remove_prefix(std::min(rest.find_first_not_of(' '), rest.size()));
+        return std::exchange(rest, {});
+    }
+
+private:
+    std::string_view rest;
+};
+
+template <typename... Numbers>
+auto format_message(char kind, Numbers... numbers) -> std::string
+{
+    auto text = std::string(1, kind);
+    ((text += ' ', text += std::to_string(numbers)), ...);
+    return text;
+}
+
+// Whether an entry's request ID (if it has one) is new, which records it
+auto admit(dedupe_window* dedupe, std::string_view request_id) -> bool
+{
+    auto colon = request_id.rfind(':');
+    uint64_t sequence;
+    if (colon == std::string_view::npos ||
+        std::from_chars(request_id.data() + colon + 1, request_id.data() + request_id.size(), sequence).ec != std::errc()) {
+        return true;
+    }
+
+    return dedupe->check(request_id.substr(0, colon), sequence) == dedupe_window::verdict::fresh;
+}
+
+}  // namespace
+
+raft_node::raft_node(size_t id, size_t members, raft_log* log, clock::time_point now, size_t dedupe_clients)
+  : self(id),
+    log(log),
+    peers(members),
+    random(uint32_t(now.time_since_epoch().count()) ^ uint32_t(id)),
+    votes(members),
+    applied_ids(dedupe_clients),
+    heard_from_leader(now)
+{
+    commit_index = last_applied = log->snapshot().index;
+    applied_ids.restore(log->snapshot().applied_ids);  // raft_log made sure it reads
+    durable = log->last_index();
+    reset_election_timer(now);
+}
+
+void raft_node::receive(size_t from, std::string_view text, clock::time_point now)
+{
+    if (from >= peers.size() || from == self || text.size() < 2) {
+        return;
+    }
+
+    auto args = text.substr(2);
+    switch (text[0]) {
+    case 'V': on_vote_request(from, args, now); break;
+    case 'v': on_vote(from, args, now); break;
+    case 'A': on_append(from, args, now); break;
+    case 'S': on_snapshot(from, args, now); break;
+    case 'a': on_append_reply(from, args, now); break;
+    default:
+        fprintf(stderr, "Raft member %zu sent something we don't understand\n", from);
+    }
+}
+
+void raft_node::tick(clock::time_point now)
+{
+    if (state != role::leader) {
+        if (now >= election_deadline) {
+            start_election(now);
+        }
+        return;
+    }
+
+    // A leader cut off from the majority steps down rather than go on serving reads it can no
+    // longer vouch for; the others will have elected someone else by now
+    if (now - std::max(quorum_contact(now), leader_since) > election_max) {
+        fprintf(stderr, "Lost touch with the majority of the cluster; no longer leading in term %lu\n", term());
+        become_follower(term(), now);
+        return;
+    }
+
+    if (now >= next_heartbeat) {
+        for (size_t peer = 0; peer < peers.size(); ++peer) {
+            if (peer != self) {
+                send_append(peer, now, true);
+            }
+        }
+        next_heartbeat = now + heartbeat_interval;
+    }
+}
+
+void raft_node::lost_peer(size_t peer)
+{
+    auto& progress = peers[peer];
+    progress.next = progress.match + 1;
+    progress.in_flight.clear();
+    progress.resent_at = next_sequence;
+}
+
+auto raft_node::propose(int64_t delta, std::string request_id) -> uint64_t
+{
+    if (state != role::leader) {
+        return 0;
+    }
+
+    log->append({ term(), delta, false, std::move(request_id) });
+    return log->last_index();
+}
+
+void raft_node::flush(clock::time_point now)
+{
+    if (state == role::leader) {
+        for (size_t peer = 0; peer < peers.size(); ++peer) {
+            if (peer != self && peers[peer].next <= log->last_index()) {
+                send_append(peer, now, false);
+            }
+        }
+    }
+
+    log->sync();
+    durable = log->last_index();
+
+    if (state == role::leader) {
+        advance_commit();
+    }
+}
+
+auto raft_node::next_to_apply() -> std::optional<to_apply>
+{
+    if (last_applied >= commit_index) {
+        return std::nullopt;
+    }
+
+    auto const& entry = log->at(++last_applied);
+    return to_apply { last_applied, &entry, !entry.noop && admit(&applied_ids, entry.request_id) };
+}
+
+void raft_node::compact(versioned_value applied_count)
+{
+    if (last_applied - log->snapshot().index >= compact_after) {
+        auto snapshot = raft_snapshot { last_applied, *log->term_at(last_applied), applied_count };
+        applied_ids.save(snapshot.applied_ids);
+        log->install(snapshot);
+    }
+}
+
+auto raft_node::can_read(clock::time_point now) const -> bool
+{
+    return state == role::leader && commit_index >= term_start && last_applied == commit_index &&
+        now < quorum_contact(now) + election_min - lease_margin;
+}
+
+void raft_node::become_follower(uint64_t new_term, clock::time_point now)
+{
+    if (new_term > term()) {
+        log->set_term(new_term, raft_log::no_vote);
+        leader_id.reset();
+    }
+    if (state == role::leader) {
+        leader_id.reset();
+    }
+
+    state = role::follower;
+    reset_election_timer(now);
+}
+
+void raft_node::start_election(clock::time_point now)
+{
+    state = role::candidate;
+    leader_id.reset();
+    log->set_term(term() + 1, int(self));
+    votes.assign(peers.size(), false);
+    votes[self] = true;
+    reset_election_timer(now);
+
+    fprintf(stderr, "Standing for election in term %lu\n", term());
+    if (quorum() == 1) {
+        become_leader(now);
+        return;
+    }
+
+    for (size_t peer = 0; peer < peers.size(); ++peer) {
+        if (peer != self) {
+            send(peer, format_message('V', term(), log->last_index(), log->last_term()));
+        }
+    }
+}
+
+void raft_node::become_leader(clock::time_point now)
+{
+    state = role::leader;
+    leader_id = self;
+    leader_since = now;
+    next_heartbeat = now + heartbeat_interval;
+
+    for (auto& peer : peers) {
+        peer = progress { log->last_index() + 1, 0, next_sequence };
+    }
+
+    // Entries from earlier terms only count as committed once one of ours is; this is that entry
+    term_start = log->last_index() + 1;
+    log->append({ term(), 0, true });
+
+    fprintf(stderr, "Leading the cluster in term %lu\n", term());
+}
+
+void raft_node::reset_election_timer(clock::time_point now)
+{
+    auto spread = std::uniform_int_distribution<long>(0, (election_max - election_min).count());
+    election_deadline = now + election_min + std::chrono::milliseconds(spread(random));
+}
+
+void raft_node::on_vote_request(size_t from, std::string_view args, clock::time_point now)
+{
+    auto in = fields(args);
+    uint64_t candidate_term, last_index, last_term;
+    if (!in.next(&candidate_term) || !in.next(&last_index) || !in.next(&last_term)) {
+        return;
+    }
+
+    // While our leader is alive, a member that lost touch with it can't take over; this is also
+    // what the leader's read lease relies on. A member that just started can't tell whether it
+    // acknowledged a leader right before it went down, so it counts the start as hearing from one.
+    auto leader_alive = state == role::leader || now < heard_from_leader + election_min;
+    if (candidate_term > term() && leader_alive) {
+        send(from, format_message('v', term(), 0));
+        return;
+    }
+
+    if (candidate_term > term()) {
+        become_follower(candidate_term, now);
+    }
+
+    auto up_to_date = last_term > log->last_term() || (last_term == log->last_term() && last_index >= log->last_index());
+    auto free_to_vote = log->voted_for() == raft_log::no_vote || log->voted_for() == int(from);
+    auto granted = candidate_term == term() && up_to_date && free_to_vote;
+    if (granted) {
+        log->set_term(term(), int(from));
+        reset_election_timer(now);
+    }
+
+    send(from, format_message('v', term(), granted ? 1 : 0));
+}
+
+void raft_node::on_vote(size_t from, std::string_view args, clock::time_point now)
+{
+    auto in = fields(args);
+    uint64_t voter_term;
+    int granted;
+    if (!in.next(&voter_term) || !in.next(&granted)) {
+        return;
+    }
+
+    if (voter_term > term()) {
+        become_follower(voter_term, now);
+        return;
+    }
+
+    if (state != role::candidate || voter_term != term() || !granted) {
+        return;
+    }
+
+    votes[from] = true;
+    if (size_t(std::count(votes.begin(), votes.end(), true)) >= quorum()) {
+        become_leader(now);
+    }
+}
+
+void raft_node::on_append(size_t from, std::string_view args, clock::time_point now)
+{
+    auto in = fields(args);
+    uint64_t leader_term, sequence, prev_index, prev_term, leader_commit;
+    if (!in.next(&leader_term) || !in.next(&sequence) || !in.next(&prev_index) || !in.next(&prev_term) || !in.next(&leader_commit)) {
+        return;
+    }
+
+    auto reply = [&](bool success, uint64_t index) {
+        send(from, format_message('a', term(), sequence, success ? 1 : 0, index));
+    };
+
+    if (leader_term < term()) {
+        reply(false, log->last_index());
+        return;
+    }
+
+    if (leader_term > term() || state != role::follower) {
+        become_follower(leader_term, now);
+    }
+    if (leader_id != from) {
+        fprintf(stderr, "Following member %zu in term %lu\n", from, term());
+    }
+    leader_id = from;
+    heard_from_leader = now;
+    reset_election_timer(now);
+
+    std::vector<raft_entry> batch;
+    for (auto field = in.next(); !field.empty(); field = in.next()) {
+        if (!parse_entry(field, &batch.emplace_back())) {
+            return;
+        }
+    }
+
+    // Everything we've committed is in every future leader's log, so a conflict means resending
+    // from there at most
+    if (prev_index > log->last_index()) {
+        reply(false, log->last_index());
+        return;
+    }
+    if (prev_index >= log->snapshot().index && log->term_at(prev_index) != prev_term) {
+        reply(false, std::min(prev_index - 1, commit_index));
+        return;
+    }
+
+    auto index = prev_index;
+    for (auto& entry : batch) {
+        ++index;
+        if (index <= log->snapshot().index) {
+            continue;
+        }
+        if (auto existing = log->term_at(index)) {
+            if (*existing == entry.term) {
+                continue;
+            }
+            log->truncate_from(index);
+        }
+        log->append(std::move(entry));
+    }
+
+    commit_index = std::max(commit_index, std::min(leader_commit, index));
+    reply(true, index);
+}
+
+void raft_node::on_snapshot(size_t from, std::string_view args, clock::time_point now)
+{
+    auto in = fields(args);
+    uint64_t leader_term, sequence;
+    auto snapshot = raft_snapshot{};
+    if (!in.next(&leader_term) || !in.next(&sequence) || !in.next(&snapshot.index) || !in.next(&snapshot.term) ||
+        !in.next(&snapshot.count.value) || !in.next(&snapshot.count.version)) {
+        return;
+    }
+    snapshot.applied_ids = in.remaining();
+
+    if (leader_term < term()) {
+        send(from, format_message('a', term(), sequence, 0, log->last_index()));
+        return;
+    }
+
+    if (leader_term > term() || state != role::follower) {
+        become_follower(leader_term, now);
+    }
+    leader_id = from;
+    heard_from_leader = now;
+    reset_election_timer(now);
+
+    if (snapshot.index > commit_index) {
+        if (!applied_ids.restore(snapshot.applied_ids)) {
+            fprintf(stderr, "The leader's snapshot at %lu has request IDs we can't read\n", snapshot.index);
+            return;
+        }
+        fprintf(stderr, "Catching up from the leader's snapshot at %lu: %ld@%lu\n", snapshot.index, snapshot.count.value, snapshot.count.version);
+        log->install(snapshot);
+        commit_index = last_applied = snapshot.index;
+        durable = std::max(std::min(durable, log->last_index()), snapshot.index);
+        received_snapshot = snapshot;
+    }
+
+    send(from, format_message('a', term(), sequence, 1, snapshot.index));
+}
+
+void raft_node::on_append_reply(size_t from, std::string_view args, clock::time_point now)
+{
+    auto in = fields(args);
+    uint64_t follower_term, sequence, index;
+    int success;
+    if (!in.next(&follower_term) || !in.next(&sequence) || !in.next(&success) || !in.next(&index)) {
+        return;
+    }
+
+    if (follower_term > term()) {
+        become_follower(follower_term, now);
+        return;
+    }
+    if (state != role::leader || follower_term != term()) {
+        return;
+    }
+
+    // Failure or not, an answer in our term means it took us for its leader when it got the message
+    auto& peer = peers[from];
+    while (!peer.in_flight.empty() && peer.in_flight.front().first <= sequence) {
+        if (peer.in_flight.front().first == sequence) {
+            peer.acknowledged = std::max(peer.acknowledged, peer.in_flight.front().second);
+        }
+        peer.in_flight.pop_front();
+    }
+
+    if (success) {
+        peer.match = std::max(peer.match, index);
+        peer.next = std::max(peer.next, peer.match + 1);
+        advance_commit();
+    }
+    else if (sequence >= peer.resent_at) {
+        // Everything pipelined behind the failed one fails too; those answers are ignored
+        peer.next = std::max(peer.match + 1, std::min(peer.next, index + 1));
+        peer.in_flight.clear();
+        peer.resent_at = next_sequence;
+    }
+
+    send_append(from, now, false);
+}
+
+void raft_node::send_append(size_t to, clock::time_point now, bool heartbeat)
+{
+    auto& peer = peers[to];
+    auto sequence = next_sequence;
+
+    // It needs entries we've compacted away; one snapshot on the wire at a time is plenty
+    auto const& snapshot = log->snapshot();
+    if (peer.next <= snapshot.index) {
+        if (!heartbeat && !peer.in_flight.empty()) {
+            return;
+        }
+
+        auto text = format_message('S', term(), sequence, snapshot.index, snapshot.term, snapshot.count.value, snapshot.count.version);
+        if (!snapshot.applied_ids.empty()) {
+            text += ' ';
+            text += snapshot.applied_ids;
+        }
+        send(to, std::move(text));
+        peer.next = snapshot.index + 1;
+    }
+    else {
+        auto count = std::min<uint64_t>(log->last_index() + 1 - peer.next, max_batch);
+        if (peer.in_flight.size() >= max_in_flight) {
+            count = 0;  // the window's full; only heartbeats until it drains
+        }
+        if (!count && !heartbeat) {
+            return;
+        }
+
+        auto prev = peer.next - 1;
+        auto text = format_message('A', term(), sequence, prev, *log->term_at(prev), commit_index);
+        for (auto index = peer.next; index < peer.next + count; ++index) {
+            text += ' ';
+            append_entry(text, log->at(index));
+        }
+        send(to, std::move(text));
+        peer.next += count;
+    }
+
+    ++next_sequence;
+    peer.in_flight.emplace_back(sequence, now);
+    if (peer.in_flight.size() > 2 * max_in_flight) {
+        peer.in_flight.pop_front();  // heartbeats to a member that isn't answering
+    }
+}
+
+void raft_node::advance_commit()
+{
+    // The highest index a majority has (us only once it's on our disk) is committed, as long as it's
+    // from our own term
+    std::vector<uint64_t> matches;
+    for (size_t peer = 0; peer < peers.size(); ++peer) {
+        matches.push_back(peer == self ? durable : peers[peer].match);
+    }
+    std::nth_element(matches.begin(), matches.begin() + ptrdiff_t(quorum() - 1), matches.end(), std::greater<>());
+
+    auto agreed = matches[quorum() - 1];
+    if (agreed > commit_index && log->term_at(agreed) == term()) {
+        commit_index = agreed;
+    }
+}
+
+auto raft_node::quorum_contact(clock::time_point now) const -> clock::time_point
+{
+    std::vector<clock::time_point> contact;
+    for (size_t peer = 0; peer < peers.size(); ++peer) {
+        contact.push_back(peer == self ? now : peers[peer].acknowledged);
+    }
+    std::nth_element(contact.begin(), contact.begin() + ptrdiff_t(quorum() - 1), contact.end(), std::greater<>());
+    return contact[quorum() - 1];
+}
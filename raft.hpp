@@ -0,0 +1,153 @@
+#ifndef RAFT_HPP
+#define RAFT_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "dedupe-window.hpp"
+#include "raft-log.hpp"
+
+// Raft consensus on the count, so it survives any minority of a 3- or 5-member cluster failing
+
+// This is the protocol alone: messages in, messages out, no sockets and no clocks of its own, which
+// raft_cluster provides. Every INCR/DECR the leader takes becomes a log entry. Entries are committed
+// once a majority has them on disk, and applied to the count in log order on every member.
+//
+// Request IDs are deduplicated as entries are applied, against a window of our own that only applied
+// entries feed and that snapshots carry. So every member, however it got its state (applying the
+// log, restarting from its snapshot, or installing the leader's), counts the same retries once and
+// turns the same ones away. That takes the same --dedupe-clients on every member.
+//
+// Three things keep the per-write cost down:
+//  - Batching. propose() only appends to the log in memory. flush() makes the whole batch durable
+//    with one fdatasync and sends each follower a single AppendEntries for it.
+//  - Pipelining. The leader doesn't wait for one AppendEntries to be acknowledged before sending the
+//    next; it assumes success, and up to max_in_flight requests per follower are on the wire at once.
+//    TCP keeps them in order. A follower that turns out to be missing something answers with how far
+//    its log goes, and the leader backs up to there.
+//  - Lease reads. A follower that has heard from its leader in the last election_min won't vote for
+//    anybody else. So once a majority has acknowledged a message the leader sent at time t, no other
+//    leader can exist before t + election_min. Until then (less a margin for clocks running at
+//    different rates), reads are served from the leader's own count without a round trip.
+//
+// Messages are single text lines: V/v for RequestVote and its reply, A/a for AppendEntries and its
+// reply, and S for a snapshot, which is also answered with "a".
+
+class raft_node {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto election_min = std::chrono::milliseconds(300);
+    static constexpr auto election_max = std::chrono::milliseconds(600);
+    static constexpr auto heartbeat_interval = std::chrono::milliseconds(50);
+    static constexpr auto lease_margin = std::chrono::milliseconds(30);
+    static constexpr size_t max_in_flight = 16;
+    static constexpr size_t max_batch = 1024;     // entries per AppendEntries
+    static constexpr uint64_t compact_after = 4096;  // applied entries kept in the log before a snapshot
+
+    struct message {
+        size_t to;
+        std::string text;
+    };
+
+    struct to_apply {
+        uint64_t index;
+        raft_entry const* entry;
+        bool counts;  // false for a no-op, and for a request ID that was applied before
+    };
+
+    raft_node(size_t id, size_t members, raft_log* log, clock::time_point now, size_t dedupe_clients);
+
+    // Inputs
+    void receive(size_t from, std::string_view text, clock::time_point now);
+    void tick(clock::time_point now);
+    void lost_peer(size_t peer);  // its connection dropped; whatever was in flight to it is gone
+
+    // Appends to the log if we lead; returns the entry's index, or 0
+    auto propose(int64_t delta, std::string request_id) -> uint64_t;
+
+    // After a batch of inputs: sends new entries to the followers and makes the log durable. Then the
+    // messages can go out, and the snapshot (if any) and committed entries can be applied, in that order.
+    void flush(clock::time_point now);
+    auto take_messages() -> std::vector<message> { return std::exchange(outbox, {}); }
+    auto take_snapshot() -> std::optional<raft_snapshot> { return std::exchange(received_snapshot, std::nullopt); }
+    auto next_to_apply() -> std::optional<to_apply>;
+
+    // Snapshots the count as it stands after everything applied, and the request IDs applied with
+    // it, once the log is long enough
+    void compact(versioned_value applied_count);
+
+    auto id() const -> size_t { return self; }
+    auto is_leader() const -> bool { return state == role::leader; }
+    auto leader() const -> std::optional<size_t> { return leader_id; }
+    auto term() const -> uint64_t { return log->current_term(); }
+    auto applied() const -> uint64_t { return last_applied; }
+    auto term_of(uint64_t index) const -> std::optional<uint64_t> { return log->term_at(index); }
+
+    // Whether the count, as applied, can be read as the latest: we lead under a live lease, and
+    // everything committed (including the entry that started our term) has been applied
+    auto can_read(clock::time_point now) const -> bool;
+
+private:
+    enum class role { follower, candidate, leader };
+
+    struct progress {
+        uint64_t next = 1;   // the next entry to send
+        uint64_t match = 0;  // the last entry known to be in its log
+        uint64_t resent_at = 0;  // replies to anything sent before this are stale
+        std::deque<std::pair<uint64_t, clock::time_point>> in_flight;  // sequence numbers and when they went
+        clock::time_point acknowledged = {};  // when the newest message it acknowledged was sent
+    };
+
+    void become_follower(uint64_t new_term, clock::time_point now);
+    void start_election(clock::time_point now);
+    void become_leader(clock::time_point now);
+    void reset_election_timer(clock::time_point now);
+
+    void on_vote_request(size_t from, std::string_view args, clock::time_point now);
+    void on_vote(size_t from, std::string_view args, clock::time_point now);
+    void on_append(size_t from, std::string_view args, clock::time_point now);
+    void on_snapshot(size_t from, std::string_view args, clock::time_point now);
+    void on_append_reply(size_t from, std::string_view args, clock::time_point now);
+
+    void send(size_t to, std::string text) { outbox.push_back({ to, std::move(text) }); }
+    void send_append(size_t to, clock::time_point now, bool heartbeat);
+    void advance_commit();
+
+    // When a majority (us included) had last heard from us; leases and check-quorum run off this
+    auto quorum_contact(clock::time_point now) const -> clock::time_point;
+    auto quorum() const -> size_t { return peers.size() / 2 + 1; }
+
+    size_t self;
+    raft_log* log;
+    std::vector<progress> peers;  // by member id; ours is unused
+    std::minstd_rand random;
+
+    role state = role::follower;
+    std::optional<size_t> leader_id;
+    std::vector<bool> votes;
+    uint64_t term_start = 0;  // the index our term's first entry went in at, while we lead
+    uint64_t durable = 0;     // the last index on disk
+    uint64_t commit_index = 0;
+    uint64_t last_applied = 0;
+    uint64_t next_sequence = 1;
+    dedupe_window applied_ids;  // as of last_applied
+
+    clock::time_point election_deadline;
+    clock::time_point heard_from_leader;  // or when we started, whichever came last
+    clock::time_point leader_since = {};
+    clock::time_point next_heartbeat = {};
+
+    std::vector<message> outbox;
+    std::optional<raft_snapshot> received_snapshot;
+};
+
+#endif  // RAFT_HPP
@@ -0,0 +1,123 @@
+#ifndef RATE_WINDOW_HPP
+#define RATE_WINDOW_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// How much the count changed over the last second, minute and hour
+
+// Changes go into a ring of per-second buckets and a ring of per-minute buckets, each with a running
+// sum of its buckets, so asking for a window is a subtraction rather than a scan. Each ring has one
+// bucket more than the window it covers: the extra one is the second (or minute) still in progress,
+// which is left out of the answer, so a window is always made of whole seconds (or minutes) that are
+// over and done with. Moving a ring forward clears the buckets time has passed over; that's bounded
+// by the ring's size however long it sat idle, and one bucket per tick when it's busy.
+//
+// Only the event loop thread touches it. It sees the count rather than deltas, so every path that
+// changes the count (including the shm drain thread, whose updates are relayed through the loop) is
+// covered without each one having to report in.
+
+class rate_window {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class span { second, minute, hour };
+
+    rate_window() = default;
+    explicit rate_window(int64_t value) : last_value(value) {}
+
+    // The count is now `value`
+    void record(clock::time_point now, int64_t value)
+    {
+        auto delta = value - last_value;
+        last_value = value;
+
+        auto since = now.time_since_epoch();
+        seconds.add(std::chrono::duration_cast<std::chrono::seconds>(since).count(), delta);
+        minutes.add(std::chrono::duration_cast<std::chrono::minutes>(since).count(), delta);
+    }
+
+    // Net change over the last whole `window`
+    auto change(clock::time_point now, span window) -> int64_t
+    {
+        auto since = now.time_since_epoch();
+        auto second = std::chrono::duration_cast<std::chrono::seconds>(since).count();
+        switch (window) {
+        case span::second: return seconds.previous(second);
+        case span::minute: return seconds.completed(second);
+        case span::hour:   return minutes.completed(std::chrono::duration_cast<std::chrono::minutes>(since).count());
+        }
+        return 0;
+    }
+
+    // "1s", "1m" or "1h"
+    static auto parse_span(std::string_view text) -> std::optional<span>
+    {
+        if (text == "1s") return span::second;
+        if (text == "1m") return span::minute;
+        if (text == "1h") return span::hour;
+        return std::nullopt;
+    }
+
+private:
+    template <size_t Window>
+    struct ring {
+        std::array<int64_t, Window + 1> buckets = {};
+        int64_t sum = 0;     // of every bucket, the one in progress included
+        int64_t newest = 0;  // the tick `buckets[newest % size]` is for
+
+        static constexpr int64_t size = Window + 1;
+
+        void advance(int64_t tick)
+        {
+            if (tick <= newest) {
+                return;
+            }
+
+            if (tick - newest >= size) {
+                buckets.fill(0);
+                sum = 0;
+            }
+            else {
+                for (auto t = newest + 1; t <= tick; ++t) {
+                    auto& bucket = buckets[size_t(t % size)];
+                    sum -= bucket;
+                    bucket = 0;
+                }
+            }
+
+            newest = tick;
+        }
+
+        void add(int64_t tick, int64_t delta)
+        {
+            advance(tick);
+            buckets[size_t(newest % size)] += delta;
+            sum += delta;
+        }
+
+        // The last `Window` ticks before the current one
+        auto completed(int64_t tick) -> int64_t
+        {
+            advance(tick);
+            return sum - buckets[size_t(newest % size)];
+        }
+
+        // Just the tick before the current one
+        auto previous(int64_t tick) -> int64_t
+        {
+            advance(tick);
+            return buckets[size_t((newest + size - 1) % size)];
+        }
+    };
+
+    int64_t last_value = 0;
+    ring<60> seconds;
+    ring<60> minutes;
+};
+
+#endif  // RATE_WINDOW_HPP
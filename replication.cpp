@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "posix-resource-handle.hpp"
+#include "replication.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto connect_timeout = 5s;
+constexpr auto first_retry = 500ms;
+constexpr auto last_retry = 30s;
+
+// Once the socket is writable, whether the connect worked, and if so, the REPLICATE request is sent
+auto finish_connect(leader_address const& leader, int fd) -> bool
+{
+    if (auto error = connect_error(fd)) {
+        fprintf(stderr, "Failed to connect to leader %s:%u: %s\n", leader.host.c_str(), leader.port, strerror(error));
+        return false;
+    }
+
+    constexpr std::string_view request = "REPLICATE\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size())) {
+        perror("Failed to ask the leader for its log");
+        return false;
+    }
+
+    fprintf(stderr, "Following leader %s:%u\n", leader.host.c_str(), leader.port);
+    return true;
+}
+
+// Reads whatever the leader sent and applies the newest complete state in it (even when the leader
+// hung up right after sending it); false once the leader is gone. `pending` holds a line split across reads.
+auto apply_from_leader(server_context* server, int fd, std::string* pending) -> bool
+{
+    char buffer[4096];
+    std::optional<versioned_value> newest;
+    auto connected = true;
+    while (connected) {
+        auto received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received == 0) {
+            fprintf(stderr, "Leader hung up\n");
+            connected = false;
+            break;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to read from leader");
+                connected = false;
+            }
+            break;
+        }
+
+        pending->append(buffer, size_t(received));
+        size_t start = 0;
+        for (size_t end; (end = pending->find('\n', start)) != std::string::npos; start = end + 1) {
+            int64_t value;
+            uint64_t version;
+            if (sscanf(pending->c_str() + start, "%ld@%lu", &value, &version) == 2) {
+                newest = versioned_value { value, version };
+            }
+        }
+        pending->erase(0, start);
+    }
+
+    // Only the last state of a batch matters, and only one that moves the count
+    if (newest) {
+        auto current = server->count->versioned_snapshot();
+        if (newest->version != current.version || newest->value != current.value) {
+            if (newest->version < current.version) {
+                fprintf(stderr, "Leader went back from version %lu to %lu; following it\n", current.version, newest->version);
+            }
+            server->count->assign(event_loop_worker, newest->value, newest->version);
+            broadcast_count(server, *newest);
+        }
+    }
+
+    return connected;
+}
+
+}  // namespace
+
+auto follow_leader(server_context* server, leader_address leader, int* leader_fd) -> task<>
+{
+    auto retry = std::chrono::milliseconds(first_retry);
+    while (!server->draining) {
+        auto handle = start_connect(leader.host, leader.port);
+        if (handle) {
+            // Hoisted on purpose: GCC 12 mangles the coroutine frame when the handle's pointer
+            // temporary lives in the same full-expression as the co_await
+            auto fd = handle.get().fd;
+            *leader_fd = fd;
+
+            auto connected = co_await server->loop->writable(fd, connect_timeout);
+            if (connected && finish_connect(leader, fd)) {
+                retry = first_retry;
+
+                auto pending = std::string();
+                while (co_await server->loop->readable(fd)) {
+                    if (!apply_from_leader(server, fd, &pending)) {
+                        break;
+                    }
+                }
+            }
+            else if (!connected && !server->draining) {
+                fprintf(stderr, "Timed out connecting to leader %s:%u\n", leader.host.c_str(), leader.port);
+            }
+
+            *leader_fd = -1;
+            server->loop->forget(fd);
+        }
+
+        if (server->draining) {
+            break;
+        }
+
+        fprintf(stderr, "Reconnecting to leader in %ld ms\n", long(retry.count()));
+        co_await server->loop->sleep(retry);
+        retry = std::min(std::chrono::milliseconds(last_retry), retry * 2);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "server.hpp"
+#include "task.hpp"
+
+// Following another counting-server, so subscribers can be spread over several processes
+
+// A follower connects to its leader's TCP port like any client and sends REPLICATE. From then on the
+// leader treats it as a replica: it gets the count as it stands, then every state the count moves
+// through, as the same "value@version" lines line-protocol subscribers get. That stream is the
+// mutation log. Each entry supersedes the one before, so applying one twice (or only the last of a
+// batch) does no harm, and a follower that lost its connection is back in sync as soon as the first
+// line of the next one arrives.
+//
+// The follower mirrors those states into its own count (version included) and broadcasts them to
+// its own clients, who can't tell it from the leader, except that writes get READONLY. A follower
+// takes REPLICATE itself, so followers can hang off followers. When the leader goes away the
+// follower keeps serving the last count it had and reconnects with backoff. Only the count is
+// replicated; sketches and histograms stay where they were made.
+
+struct leader_address {
+    std::string host;
+    uint16_t port = 0;
+};
+
+// Runs until the server drains; while connected, *leader_fd is the socket (so a drain can forget it
+// and get us out of the read), and -1 otherwise
+auto follow_leader(server_context* server, leader_address leader, int* leader_fd) -> task<>;
+
+#endif  // REPLICATION_HPP
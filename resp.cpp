@@ -0,0 +1,129 @@
+#include <charconv>
+
+#include "resp.hpp"
+
+namespace resp {
+
+namespace {
+
+// Line minus its terminator; the line reader leaves the \r\n (or a lone \n) on the end
+auto strip_terminator(std::string_view line) -> std::string_view
+{
+    if (line.ends_with('\n')) {
+        line.remove_suffix(1);
+    }
+    if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+    }
+
+    return line;
+}
+
+auto parse_length(std::string_view digits, int64_t* out) -> bool
+{
+    auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), *out);
+    return err == std::errc() && end == digits.data() + digits.size();
+}
+
+}  // namespace
+
+auto request_parser::feed(std::string_view line) -> status
+{
+    line = strip_terminator(line);
+
+    if (!in_progress()) {
+        int64_t count;
+        if (!line.starts_with('*') || !parse_length(line.substr(1), &count)) {
+            return fail();
+        }
+        if (count < 1 || size_t(count) > max_arguments) {
+            return fail();
+        }
+
+        expected_args = size_t(count);
+        bulk_length = -1;
+        args.clear();
+        return status::incomplete;
+    }
+
+    if (bulk_length < 0) {
+        if (!line.starts_with('$') || !parse_length(line.substr(1), &bulk_length)) {
+            return fail();
+        }
+        if (bulk_length < 0 || size_t(bulk_length) > max_bulk_length) {
+            return fail();
+        }
+
+        return status::incomplete;
+    }
+
+    if (line.size() != size_t(bulk_length)) {
+        return fail();
+    }
+
+    args.emplace_back(line);
+    bulk_length = -1;
+
+    if (args.size() < expected_args) {
+        return status::incomplete;
+    }
+
+    expected_args = 0;
+    return status::complete;
+}
+
+auto request_parser::fail() -> status
+{
+    expected_args = 0;
+    bulk_length = -1;
+    args.clear();
+    return status::malformed;
+}
+
+void append_simple_string(std::string& out, std::string_view text)
+{
+    out += '+';
+    out += text;
+    out += "\r\n";
+}
+
+void append_error(std::string& out, std::string_view message)
+{
+    out += '-';
+    out += message;
+    out += "\r\n";
+}
+
+void append_integer(std::string& out, int64_t value)
+{
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+
+    out += ':';
+    out.append(digits, end);
+    out += "\r\n";
+}
+
+void append_bulk_string(std::string& out, std::string_view bytes)
+{
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), bytes.size()).ptr;
+
+    out += '$';
+    out.append(digits, end);
+    out += "\r\n";
+    out += bytes;
+    out += "\r\n";
+}
+
+void append_array_header(std::string& out, size_t elements)
+{
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), elements).ptr;
+
+    out += '*';
+    out.append(digits, end);
+    out += "\r\n";
+}
+
+}  // namespace resp
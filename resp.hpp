@@ -0,0 +1,53 @@
+#ifndef RESP_HPP
+#define RESP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Just enough of the Redis serialization protocol (RESP2) for Redis clients to talk to us
+
+// Redis clients send every command as an array of bulk strings:
+//
+//     *2\r\n$3\r\nGET\r\n$5\r\ncount\r\n
+//
+// which the line reader hands us one CRLF-terminated line at a time, so a request is reassembled
+// across calls to feed(). Arguments may not contain a newline; none of the commands we understand
+// take one, and the reader would have split it anyway.
+
+namespace resp {
+
+// Anything beyond these is a client that isn't talking to a counter
+constexpr size_t max_arguments = 64;
+constexpr size_t max_bulk_length = 4096;
+
+class request_parser {
+public:
+    enum class status { incomplete, complete, malformed };
+
+    // Takes the next line of a request; once it returns complete, arguments() holds the command
+    // until the next call. After malformed the parser is ready for a fresh request.
+    auto feed(std::string_view line) -> status;
+
+    auto arguments() const -> std::vector<std::string> const& { return args; }
+    auto in_progress() const -> bool { return expected_args > 0; }
+
+private:
+    auto fail() -> status;
+
+    size_t expected_args = 0;     // array elements announced by the * header, 0 between requests
+    int64_t bulk_length = -1;     // length announced by the last $ header, -1 if its data has arrived
+    std::vector<std::string> args;  // reused from one request to the next, capacity and all
+};
+
+void append_simple_string(std::string& out, std::string_view text);
+void append_error(std::string& out, std::string_view message);
+void append_integer(std::string& out, int64_t value);
+void append_bulk_string(std::string& out, std::string_view bytes);
+void append_array_header(std::string& out, size_t elements);
+
+}  // namespace resp
+
+#endif  // RESP_HPP
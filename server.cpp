@@ -1,113 +1,121 @@
-#include <atomic>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <signal.h>
+#include <strings.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "http.hpp"
 #include "posix-resource-handle.hpp"
-#include "epoll-wrapper.hpp"
+#include "raft-cluster.hpp"
+#include "server.hpp"
+#include "websocket.hpp"
 
-auto listen_on_dual_tcp_socket(uint16_t port) -> resource_handle;
-auto accept_connection(int fd) -> resource_handle;
-auto get_peer_name(int fd) -> std::string;
-auto read_lines_from_fd(int fd) -> std::vector<std::string>;
-void parse_and_handle(int fd, std::string command, std::vector<resource_handle>* connections, int64_t* count);
+namespace {
 
-// This is global so that we don't have to
-// capture it in our signal handler below
-std::atomic<bool> running = true;
-
-int main()
+// A socket of the given type bound to `port` on every local address, IPv4 and IPv6 alike
+auto bind_dual_stack_socket(int type, uint16_t port) -> resource_handle
 {
-    struct sigaction handler;
-    handler.sa_handler = [](int) { running = false; };
+    auto new_socket = resource_handle(socket(AF_INET6, type | SOCK_NONBLOCK, 0));
 
-    if (sigaction(SIGINT,  &handler, nullptr) == -1 ||
-        sigaction(SIGTERM, &handler, nullptr) == -1)
-    {
+    if (new_socket.get().fd < 0) {
+        new_socket.release();
         throw_system_error();
     }
 
-    auto listen_socket = listen_on_dual_tcp_socket(8089);
+    // Default varies by platform, so explicitly opt into IPv4 connections on this socket
+    uint32_t off = 0;
+    if (setsockopt(new_socket.get().fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0) {
+        throw_system_error();
+    }
 
-    std::vector<resource_handle> connections;
-    connections.reserve(1024);  // 4 KiB in exchange for zero reallocations on the first 1024 connections is a no-brainer
+    // A drained shutdown closes its connections first, which leaves them in TIME_WAIT on our side;
+    // the replacement process must still be able to bind right away
+    uint32_t on = 1;
+    if (type == SOCK_STREAM && setsockopt(new_socket.get().fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        throw_system_error();
+    }
 
-    auto poller = epoll();
-    poller.add(listen_socket, EPOLLIN);
+    auto listen_addr = sockaddr_in6 {
+        .sin6_family = AF_INET6,
+        .sin6_port   = htons(port),
+        .sin6_addr   = IN6ADDR_ANY_INIT
+    };
 
-    fprintf(stderr, "Starting up... count initialized to 0\n");
-    int64_t count = 0;
+    if (bind(new_socket.get().fd, reinterpret_cast<sockaddr*>(&listen_addr), sizeof(listen_addr)) < 0) {
+        throw_system_error();
+    }
 
-    while(running) {
-        auto new_event = poller.wait();
-        if (new_event.data.fd == 0) {
-            // we were woken up by a signal
-            continue;
-        }
+    return new_socket;
+}
 
-        // new incoming connection
-        if (new_event.data.fd == listen_socket.get().fd) {
-            auto new_connection = accept_connection(listen_socket.get().fd);
-            if (new_connection) {
-                poller.add(new_connection, EPOLLIN | EPOLLRDHUP);
-                connections.push_back(std::move(new_connection));
-            }
-        }
+}  // namespace
 
-        // event from one of our connections
-        else {
-            auto peer_name = get_peer_name(new_event.data.fd);
+auto listen_on_dual_tcp_socket(uint16_t port) -> resource_handle
+{
+    auto listen_socket = bind_dual_stack_socket(SOCK_STREAM, port);
 
-            // we have some data on one of our connections
-            if (new_event.events & EPOLLIN) {
-                for (auto const& line : read_lines_from_fd(new_event.data.fd)) {
-                    parse_and_handle(new_event.data.fd, line, &connections, &count);
-                }
-            }
+    if (listen(listen_socket.get().fd, 64) < 0) {
+        throw_system_error();
+    }
 
-            // one of our connections hung up
-            if (new_event.events & (EPOLLHUP | EPOLLRDHUP)) {
-                std::erase_if(connections, [&](resource_handle const& handle) {
-                    return handle.get().fd == new_event.data.fd;
-                });
+    return listen_socket;
+}
 
-                fprintf(stderr, "%s hung up\n", peer_name.c_str());
-            }
-        }
+auto listen_on_dual_udp_socket(uint16_t port) -> resource_handle
+{
+    auto udp_socket = bind_dual_stack_socket(SOCK_DGRAM, port);
+
+    // Nobody resends a dropped datagram, so give bursts somewhere to wait; the kernel caps this at
+    // net.core.rmem_max, which is fine, we just want whatever we're allowed
+    int buffer_size = 4 * 1024 * 1024;
+    if (setsockopt(udp_socket.get().fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) < 0) {
+        perror("Failed to enlarge UDP receive buffer");
     }
 
-    fprintf(stderr, "Shutting down...\n");
+    return udp_socket;
 }
 
-auto listen_on_dual_tcp_socket(uint16_t port) -> resource_handle
+// type is SOCK_STREAM or SOCK_SEQPACKET; both feed the same line parser, seqpacket just keeps the
+// kernel from coalescing or splitting a client's writes
+auto listen_on_unix_socket(std::string const& path, int type) -> resource_handle
 {
-    auto listen_socket = resource_handle(socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0));
+    auto listen_addr = sockaddr_un { .sun_family = AF_UNIX };
+    if (path.size() >= sizeof(listen_addr.sun_path)) {
+        throw std::system_error(std::make_error_code(std::errc::filename_too_long), path);
+    }
+    path.copy(listen_addr.sun_path, path.size());
+
+    auto listen_socket = resource_handle(socket(AF_UNIX, type | SOCK_NONBLOCK, 0));
 
     if (listen_socket.get().fd < 0) {
         listen_socket.release();
         throw_system_error();
     }
 
-    // Default varies by platform, so explicitly opt into IPv4 connections on this socket
-    uint32_t off = 0;
-    if (setsockopt(listen_socket.get().fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0) {
+    // A socket file left behind by a previous run would make bind() fail with EADDRINUSE
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
         throw_system_error();
     }
 
-    auto listen_addr = sockaddr_in6 {
-        .sin6_family = AF_INET6,
-        .sin6_port   = htons(port),
-        .sin6_addr   = IN6ADDR_ANY_INIT
-    };
-
     if (bind(listen_socket.get().fd, reinterpret_cast<sockaddr*>(&listen_addr), sizeof(listen_addr)) < 0) {
         throw_system_error();
     }
@@ -128,12 +136,33 @@ auto accept_connection(int listen_socket) -> resource_handle
         return nullptr;
     }
 
-    auto name = get_peer_name(new_connection.get().fd);
-    fprintf(stderr, "New connection from %s\n", name.c_str());
-
     return new_connection;
 }
 
+// Blocks the given signals for the calling thread (and every thread it starts afterwards) and returns
+// a descriptor they can be read from instead, so they arrive as ordinary events on the loop
+auto listen_for_signals(std::initializer_list<int> signals) -> resource_handle
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (auto signal : signals) {
+        sigaddset(&mask, signal);
+    }
+
+    if (int err = pthread_sigmask(SIG_BLOCK, &mask, nullptr); err != 0) {
+        errno = err;
+        throw_system_error();
+    }
+
+    auto signal_fd = resource_handle(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+    if (signal_fd.get().fd < 0) {
+        signal_fd.release();
+        throw_system_error();
+    }
+
+    return signal_fd;
+}
+
 auto get_peer_name(int conn_socket) -> std::string
 {
     auto peer_addr = sockaddr_in6{};
@@ -143,6 +172,17 @@ auto get_peer_name(int conn_socket) -> std::string
         return "peer";
     }
 
+    // Local clients have no address worth printing, but the kernel will tell us who they are
+    if (peer_addr.sin6_family == AF_UNIX) {
+        auto cred = ucred{};
+        auto cred_size = unsigned(sizeof(cred));
+        if (getsockopt(conn_socket, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size) < 0) {
+            return "local peer";
+        }
+
+        return "local pid " + std::to_string(cred.pid);
+    }
+
     if (peer_size != sizeof(peer_addr)) {
         fprintf(stderr, "Unexpected address size — peer is not IPv6 ???\n");
         return "peer";
@@ -157,68 +197,2003 @@ auto get_peer_name(int conn_socket) -> std::string
     return buffer;
 }
 
-auto read_lines_from_fd(int infd) -> std::vector<std::string>
+// Starts a non-blocking connect to the first address the name resolves to, for a follower's leader
+// or another member of a Raft cluster. Resolution blocks, which is fine for the addresses and
+// localhost names those are given.
+auto start_connect(std::string const& host, uint16_t port) -> resource_handle
 {
-    auto in = fdopen(infd, "r");
-    if (!in) {
-        perror("Failed to open stream for file descriptor");
+    auto hints = addrinfo{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = nullptr;
+    auto service = std::to_string(port);
+    if (auto err = getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses); err != 0) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", host.c_str(), gai_strerror(err));
         return {};
     }
 
-    std::vector<std::string> ret;
+    resource_handle handle;
+    for (auto address = addresses; address; address = address->ai_next) {
+        handle = resource_handle(socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol));
+        if (!handle) {
+            continue;
+        }
+
+        if (connect(handle.get().fd, address->ai_addr, address->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            break;
+        }
+        handle.reset();
+    }
+    freeaddrinfo(addresses);
 
-    char* buffer = nullptr;
-    size_t length = 0;
-    int bytes = 0;
-    while ((bytes = getline(&buffer, &length, in)) > 0) {
-        ret.push_back(std::string(buffer));
+    if (!handle) {
+        fprintf(stderr, "Failed to connect to %s:%u: %s\n", host.c_str(), port, strerror(errno));
+        return {};
     }
-    free(buffer);
 
-    return ret;
+    // A peer that vanishes without a FIN (its host died) is noticed within half a minute or so,
+    // rather than whenever the kernel's two-hour default gets around to it
+    int on = 1, idle = 10, interval = 5, probes = 3;
+    setsockopt(handle.get().fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(handle.get().fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(handle.get().fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(handle.get().fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+
+    return handle;
 }
 
-void parse_and_handle(int fd, std::string command, std::vector<resource_handle>* connections, int64_t* count)
+// Once a socket from start_connect is writable: 0 if it's connected, why it isn't otherwise
+auto connect_error(int fd) -> int
 {
-    auto send_count = [&](int fd) {
-        auto output = std::to_string(*count);
-        for (size_t sent = 0; sent < output.size(); ) {
-            if (auto ret = send(fd, &output[sent], output.size(), MSG_NOSIGNAL); ret < 0) {
-                if (errno == EINTR)
-                    continue;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        return errno;
+    }
+    return error;
+}
+
+// One turn at a connection: the complete lines already waiting in conn->inbound, then whatever
+// recv() brings in until the socket runs dry (EAGAIN) or either budget is used up. Lines past the
+// command budget stay in conn->inbound for the next turn, so a flood costs at most one turn's worth
+// of lines in memory. At the end of the stream, whatever is left counts as a line of its own.
+auto receive_lines(connection* conn, read_budget budget) -> received_lines
+{
+    constexpr size_t max_line = 1 << 20;  // HISTLOAD's dumps are the longest thing anybody sends
 
-                fprintf(stderr, "Failed to send output on fd %d: ", fd);
-                perror("");
+    received_lines out;
+    size_t consumed = 0;  // how much of conn->inbound has gone into lines
+    auto take_lines = [&] {
+        while (out.lines.size() < budget.commands) {
+            auto end = conn->inbound.find('\n', consumed);
+            if (end == std::string::npos) {
                 break;
             }
+            out.lines.emplace_back(conn->inbound, consumed, end + 1 - consumed);
+            consumed = end + 1;
+        }
+    };
 
-            else {
-                sent += ret;
-            }
+    take_lines();
+
+    char buffer[16384];
+    size_t taken = 0;
+    while (out.lines.size() < budget.commands) {
+        if (taken >= budget.bytes) {
+            out.more = true;
+            break;
+        }
+
+        auto received = recv(conn->fd(), buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received < 0 && errno == EINTR) {
+            continue;
         }
+        if (received <= 0) {
+            out.closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+        taken += size_t(received);
+
+        conn->inbound.append(buffer, size_t(received));
+        take_lines();
+
+        if (conn->inbound.size() - consumed > max_line && out.lines.size() < budget.commands) {
+            fprintf(stderr, "%s sent a line longer than %zu bytes; hanging up\n", conn->peer_name.c_str(), max_line);
+            conn->inbound.clear();
+            consumed = 0;
+            out.closed = true;
+            break;
+        }
+    }
+
+    // Out of commands with lines or bytes possibly still waiting; the next turn will find out
+    if (out.lines.size() >= budget.commands) {
+        out.more = true;
+    }
+
+    conn->inbound.erase(0, consumed);
+    if (out.closed && !conn->inbound.empty()) {
+        out.lines.push_back(std::exchange(conn->inbound, {}));
+    }
+
+    return out;
+}
+
+namespace {
+
+// INCR <n> or DECR <n>, optionally followed by "@<key>" to count towards a key rather than the
+// count, then optionally by a request ID "<client>:<sequence>". INCR takes a negative amount; DECR
+// doesn't, rather than reading DECR -5 as INCR 5.
+struct delta_command {
+    int64_t delta = 0;         // negative for DECR
+    bool decrement = false;
+    std::string_view key;      // empty for the count itself
+    std::string_view client;   // empty without a request ID
+    uint64_t sequence = 0;
+};
+
+auto parse_delta_command(char const* line, delta_command* out) -> bool
+{
+    int64_t amount;
+    int end_of_amount = 0;
+    if (sscanf(line, "INCR %ld%n", &amount, &end_of_amount) == 1) {
+        *out = { amount, false };
+    }
+    else if (sscanf(line, "DECR %ld%n", &amount, &end_of_amount) == 1 && amount >= 0) {
+        *out = { -amount, true };
+    }
+    else {
+        return false;
+    }
+
+    auto rest = std::string_view(line + end_of_amount);
+    auto next_word = [&rest] {
+        auto start = std::min(rest.find_first_not_of(" \r\n"), rest.size());
+        auto end = std::min(rest.find_first_of(" \r\n", start), rest.size());
+        auto word = rest.substr(start, end - start);
+        rest.remove_prefix(end);
+        return word;
     };
 
-    if (command == "OUTPUT\r\n") {
-        fprintf(stderr, "%s requests the count; it is %ld\n", get_peer_name(fd).c_str(), *count);
-        send_count(fd);
+    auto id = next_word();
+    if (id.starts_with('@')) {
+        out->key = id.substr(1);
+        id = next_word();
+        if (out->key.empty() || out->delta < 0) {
+            return false;  // a sketch can't take anything away
+        }
+    }
+
+    if (id.empty()) {
+        return true;
     }
 
-    int64_t delta;
-    if (sscanf(command.data(), "INCR %ld\r\n", &delta) == 1) {
-        *count += delta;
-        fprintf(stderr, "%s increments the count by %ld to %ld\n", get_peer_name(fd).c_str(), delta, *count);
+    // A request ID that doesn't parse (or anything after it) gets the command refused rather than
+    // applied without one
+    auto colon = id.rfind(':');
+    if (colon == 0 || colon == std::string_view::npos || colon > dedupe_window::max_client_name || !next_word().empty()) {
+        return false;
+    }
+
+    auto digits = id.substr(colon + 1);
+    auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), out->sequence);
+    if (err != std::errc() || end != digits.data() + digits.size() || digits.empty()) {
+        return false;
+    }
+
+    out->client = id.substr(0, colon);
+    return true;
+}
+
+// Whether a command should be applied; commands without an ID always are
+auto admit(dedupe_window* dedupe, delta_command const& command) -> bool
+{
+    return command.client.empty() || dedupe->check(command.client, command.sequence) == dedupe_window::verdict::fresh;
+}
+
+// What goes into a Raft entry, to be deduplicated when it's applied
+auto request_id(delta_command const& command) -> std::string
+{
+    return command.client.empty() ? std::string() : std::string(command.client) + ":" + std::to_string(command.sequence);
+}
+
+// Everything after "<verb> " up to the line's end, or nullopt when the line is another command
+auto line_argument(std::string const& command, std::string_view verb) -> std::optional<std::string_view>
+{
+    auto line = std::string_view(command);
+    if (!line.starts_with(verb) || line.size() < verb.size() + 3 || line[verb.size()] != ' ' || !line.ends_with("\r\n")) {
+        return std::nullopt;
+    }
+
+    return line.substr(verb.size() + 1, line.size() - verb.size() - 3);
+}
+
+// OBSERVE <name> <value>
+auto parse_observation(char const* line, std::string_view* name, uint64_t* value) -> bool
+{
+    int name_start = 0, name_end = 0, value_start = 0, value_end = 0;
+    sscanf(line, "OBSERVE %n%*s%n %n%*s%n", &name_start, &name_end, &value_start, &value_end);
+    if (value_end <= value_start) {
+        return false;
+    }
+
+    auto digits = std::string_view(line + value_start, size_t(value_end - value_start));
+    auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), *value);
+    if (err != std::errc() || end != digits.data() + digits.size()) {
+        return false;
+    }
+
+    *name = std::string_view(line + name_start, size_t(name_end - name_start));
+    return true;
+}
+
+auto find_histogram(server_context* server, std::string_view name) -> histogram*
+{
+    auto it = server->histograms.find(std::string(name));
+    return it == server->histograms.end() ? nullptr : it->second.get();
+}
+
+// The histogram called `name`, made if need be; null when it would be one histogram more than we keep
+auto find_or_add_histogram(server_context* server, std::string_view name) -> histogram*
+{
+    if (auto found = find_histogram(server, name)) {
+        return found;
+    }
+    if (server->histograms.size() >= server->max_histograms) {
+        return nullptr;
+    }
+    return server->histograms.emplace(name, std::make_unique<histogram>()).first->second.get();
+}
+
+}  // namespace
+
+// Statsd-style fire-and-forget increments: every datagram holds one or more newline-separated
+// INCR/DECR commands. recvmmsg pulls in a whole batch per syscall; we stop after a few batches even
+// if more are queued so the socket can't monopolise the loop (epoll will tell us again right away).
+// Datagrams are exactly what gets resent on a lossy network, so request IDs matter most here.
+// Keyed increments and observations go straight where they belong; only the count's delta is left
+// for the caller, which has to broadcast it.
+auto receive_udp_deltas(server_context* server, int fd) -> udp_receipt
+{
+    constexpr size_t batch_size = 64;
+    constexpr size_t max_datagram = 2048;
+    constexpr int max_batches = 16;
+
+    static char buffers[batch_size][max_datagram + 1];
+    static iovec iovecs[batch_size];
+    static mmsghdr messages[batch_size];
+
+    auto receipt = udp_receipt{};
+    for (int batch = 0; batch < max_batches; ++batch) {
+        for (size_t i = 0; i < batch_size; ++i) {
+            iovecs[i] = { buffers[i], max_datagram };
+            messages[i] = { .msg_hdr = { .msg_iov = &iovecs[i], .msg_iovlen = 1 } };
+        }
+
+        auto received = recvmmsg(fd, messages, batch_size, MSG_DONTWAIT, nullptr);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Failed to receive datagrams");
+            }
+            break;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            buffers[i][messages[i].msg_len] = '\0';
+
+            char* save = nullptr;
+            for (auto line = strtok_r(buffers[i], "\n", &save); line; line = strtok_r(nullptr, "\n", &save)) {
+                std::string_view name;
+                uint64_t value;
+                if (parse_observation(line, &name, &value)) {
+                    if (!server->shards.is_local(name)) {
+                        ++receipt.moved;
+                    }
+                    else if (auto target = find_or_add_histogram(server, name)) {
+                        target->record(value);
+                        ++receipt.observations;
+                    }
+                    continue;
+                }
+
+                auto command = delta_command{};
+                if (!parse_delta_command(line, &command)) {
+                    continue;
+                }
+
+                if (server->read_only) {
+                    ++receipt.refused;
+                }
+                else if (!command.key.empty() && !server->shards.is_local(command.key)) {
+                    ++receipt.moved;
+                }
+                else if (server->raft && command.key.empty()) {
+                    auto& tally = server->raft->propose(nullptr, command.delta, request_id(command)) ? receipt.proposed : receipt.refused;
+                    ++tally;
+                }
+                else if (!admit(&server->dedupe, command)) {
+                    ++receipt.duplicates;
+                }
+                else if (command.key.empty()) {
+                    receipt.delta += command.delta;
+                    ++receipt.count_commands;
+                }
+                else {
+                    server->hitters.add(command.key, uint64_t(command.delta));
+                }
+            }
+        }
+
+        receipt.datagrams += size_t(received);
+        if (size_t(received) < batch_size) {
+            break;
+        }
+    }
+
+    return receipt;
+}
+
+// The count survives restarts in a small text file, replaced atomically so a crash mid-write can
+// never leave a torn value behind; a missing file just means we start from zero. The version is
+// saved alongside, so clients holding one from before the restart don't see it go backwards (files
+// from before versions existed hold just the value).
+auto load_count(std::string const& path) -> versioned_value
+{
+    auto file = fopen(path.c_str(), "r");
+    if (!file) {
+        if (errno != ENOENT) {
+            perror(("Failed to open state file " + path).c_str());
+        }
+        return {};
+    }
+
+    auto count = versioned_value{};
+    if (fscanf(file, "%ld %lu", &count.value, &count.version) < 1) {
+        fprintf(stderr, "State file %s is unreadable; starting from 0\n", path.c_str());
+        count = {};
+    }
+    fclose(file);
+
+    return count;
+}
+
+void save_count(std::string const& path, versioned_value count)
+{
+    auto temp_path = path + ".tmp";
+    auto file = fopen(temp_path.c_str(), "w");
+    if (!file) {
+        perror(("Failed to create " + temp_path).c_str());
+        return;
+    }
+
+    bool ok = fprintf(file, "%ld %lu\n", count.value, count.version) > 0 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_path.c_str(), path.c_str()) < 0) {
+        perror(("Failed to write state file " + path).c_str());
+        unlink(temp_path.c_str());
+    }
+}
+
+namespace {
+
+// Writes as much of `bytes` as the socket will take right now; returns how much that was, or -1 if
+// the connection is broken (its reader will notice the hang-up and clean up)
+auto send_some(connection* conn, std::string_view bytes) -> ssize_t
+{
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+        auto ret = send(conn->fd(), &bytes[sent], bytes.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            fprintf(stderr, "Failed to send output to %s: ", conn->peer_name.c_str());
+            perror("");
+            return -1;
+        }
+
+        sent += size_t(ret);
+    }
+
+    return ssize_t(sent);
+}
+
+// A client that has stopped reading altogether never catches up, and everything queued for it stays
+// in our memory: past 16 times max_outbound it's hung up on. Shutting the socket down (rather than
+// closing it) leaves cleaning up to its reader, which sees the hang-up like any other.
+auto drop_if_far_behind(server_context* server, connection* conn) -> bool
+{
+    if (!server->max_outbound || conn->outbound.size() <= 16 * server->max_outbound) {
+        return false;
+    }
+
+    fprintf(stderr, "Hanging up on %s: it owes %zu bytes\n", conn->peer_name.c_str(), conn->outbound.size());
+    ++server->overload.dropped;
+    conn->dropped = true;
+    conn->outbound.clear();
+    shutdown(conn->fd(), SHUT_RDWR);
+    return true;
+}
+
+auto flush_outbound(server_context* server, connection* conn) -> task<>
+{
+    conn->flushing = true;
+
+    while (!conn->outbound.empty()) {
+        // Cancelled means the connection is being torn down; it may already be gone, so hands off
+        if (!co_await server->loop->writable(conn->fd())) {
+            co_return;
+        }
+
+        auto sent = send_some(conn, conn->outbound);
+        if (sent < 0) {
+            conn->outbound.clear();
+            break;
+        }
+
+        conn->outbound.erase(0, size_t(sent));
+    }
+
+    // Last: a connection whose reads were paused may wake up, finish and take conn with it
+    conn->flushing = false;
+    server->loop->notify_all(conn->drained);
+}
+
+// What a connection does instead of hanging up straight away when it still owes its client output
+// (when the server is draining, or after an HTTP response with Connection: close). Anything still
+// waiting to flush_outbound has to be cancelled first.
+auto flush_before_close(server_context* server, connection* conn, event_loop::clock::time_point deadline) -> task<>
+{
+    while (!conn->outbound.empty()) {
+        auto remaining = deadline - event_loop::clock::now();
+        if (remaining <= event_loop::clock::duration::zero()) {
+            fprintf(stderr, "Gave up on flushing %zu bytes to %s\n", conn->outbound.size(), conn->peer_name.c_str());
+            break;
+        }
+
+        if (!co_await server->loop->writable(conn->fd(), remaining)) {
+            continue;
+        }
+
+        auto sent = send_some(conn, conn->outbound);
+        if (sent < 0) {
+            break;
+        }
+
+        conn->outbound.erase(0, size_t(sent));
+    }
+}
+
+}  // namespace
+
+// Output goes straight to the socket when nothing is queued ahead of it; whatever doesn't fit waits
+// for a flush_outbound coroutine, so a slow reader never blocks the loop
+void queue_output(server_context* server, connection* conn, std::string_view bytes)
+{
+    if (conn->dropped) {
+        return;
+    }
+
+    if (conn->outbound.empty()) {
+        auto sent = send_some(conn, bytes);
+        if (sent < 0) {
+            return;
+        }
+
+        bytes.remove_prefix(size_t(sent));
+    }
+
+    if (bytes.empty()) {
+        return;
+    }
+
+    conn->outbound.append(bytes);
+    if (drop_if_far_behind(server, conn)) {
+        return;
+    }
+
+    if (!conn->flushing && !conn->batched) {
+        spawn(flush_outbound(server, conn));
+    }
+}
+
+// Everything queued for the batch goes out in one pass, a send() per connection. Whatever a socket
+// had no room for is left to flush_outbound, as it would be from queue_output.
+void flush_batched_output(server_context* server)
+{
+    if (server->batched.empty()) {
+        return;
+    }
+
+    auto batch = std::exchange(server->batched, {});
+    for (auto conn : batch) {
+        conn->batched = false;
+
+        auto sent = send_some(conn, conn->outbound);
+        if (sent < 0) {
+            conn->outbound.clear();
+            continue;
+        }
 
-        for (auto const& conn : *connections) {
-            send_count(conn.get().fd);
+        conn->outbound.erase(0, size_t(sent));
+        if (!conn->outbound.empty() && !conn->flushing) {
+            spawn(flush_outbound(server, conn));
         }
     }
 
-    if (sscanf(command.data(), "DECR %ld\r\n", &delta) == 1) {
-        *count -= delta;
-        fprintf(stderr, "%s decrements the count by %ld to %ld\n", get_peer_name(fd).c_str(), delta, *count);
+    // Kept for next time, so a steady stream of broadcasts doesn't allocate
+    batch.clear();
+    if (server->batched.empty()) {
+        server->batched = std::move(batch);
+    }
+}
+
+// Round-robin over the connections that still had input after their turn: once the loop has
+// dispatched an iteration's events, everybody queued gets one more turn, in the order they queued.
+// Whoever still has more goes to the back and waits for the next round, so fresh events (a small
+// client's one command) are never stuck behind more than one turn of anybody's flood.
+auto serve_ready_connections(server_context* server) -> task<>
+{
+    while (true) {
+        auto woken = co_await server->loop->wait(server->ready_queued);
+        (void)woken;
+
+        while (!server->ready.empty()) {
+            auto over = co_await server->loop->end_of_iteration();
+            (void)over;
 
-        for (auto const& conn : *connections) {
-            send_count(conn.get().fd);
+            for (auto round = server->ready.size(); round && !server->ready.empty(); --round) {
+                auto conn = server->ready.front();
+                server->ready.pop_front();
+                server->loop->notify_all(conn->turn);
+            }
         }
     }
 }
+
+auto send_batched_output(server_context* server) -> task<>
+{
+    while (true) {
+        auto woken = co_await server->loop->wait(server->output_batched);
+        auto over = co_await server->loop->end_of_iteration();
+        (void)woken;
+        (void)over;
+        flush_batched_output(server);
+    }
+}
+
+namespace {
+
+// "value@version", which is how the count goes out to anybody who isn't asking in a protocol of
+// their own; the version lets a client tell a stale value from a fresh one, and skip repeats
+auto format_count(char* out, size_t capacity, versioned_value count) -> std::string_view
+{
+    auto end = std::to_chars(out, out + capacity, count.value).ptr;
+    *end++ = '@';
+    end = std::to_chars(end, out + capacity, count.version).ptr;
+    return std::string_view(out, size_t(end - out));
+}
+
+}  // namespace
+
+void send_count(server_context* server, connection* conn, versioned_value count)
+{
+    char buffer[48];
+    auto text = format_count(buffer, sizeof(buffer) - 2, count);
+    buffer[text.size()] = '\r';
+    buffer[text.size() + 1] = '\n';
+    queue_output(server, conn, std::string_view(buffer, text.size() + 2));
+}
+
+// Where a Raft member that doesn't lead sends writes and reads: to the leader, if it knows who that is
+void send_not_leader(server_context* server, connection* conn)
+{
+    auto leader = server->raft->leader_hint();
+    auto reply = std::string();
+    if (conn->protocol == wire_protocol::resp) {
+        resp::append_error(reply, leader.empty() ? "NOTLEADER" : "NOTLEADER " + leader);
+    }
+    else {
+        reply = (leader.empty() ? "NOTLEADER" : "NOTLEADER " + leader) + "\r\n";
+    }
+    queue_output(server, conn, reply);
+}
+
+namespace {
+
+// Broadcasts wait for the end of the loop iteration, so a burst of updates costs each connection one
+// send rather than one apiece; a connection that's already waiting on its socket takes them as is
+void queue_broadcast(server_context* server, connection* conn, std::string_view bytes)
+{
+    if (conn->dropped) {
+        return;
+    }
+
+    conn->outbound.append(bytes);
+    if (drop_if_far_behind(server, conn) || conn->flushing || conn->batched) {
+        return;
+    }
+
+    conn->batched = true;
+    server->batched.push_back(conn);
+    if (server->batched.size() == 1) {
+        server->loop->notify_all(server->output_batched);
+    }
+}
+
+}  // namespace
+
+void broadcast_count(server_context* server, versioned_value count)
+{
+    // Every change to the count ends up here, which makes this the one place to keep rates current
+    server->rates.record(event_loop::clock::now(), count.value);
+
+    char line[48];
+    auto output = format_count(line, sizeof(line) - 2, count);
+    line[output.size()] = '\r';
+    line[output.size() + 1] = '\n';
+    auto line_output = std::string_view(line, output.size() + 2);
+
+    // RESP subscribers get a pub/sub message, encoded once per channel name rather than per client
+    std::string message;
+    std::string_view message_channel;
+
+    // Every WebSocket client gets the very same frame, so it's encoded once, up front
+    char frame[websocket::max_header_size + 48];
+    auto frame_size = websocket::encode_frame(frame, sizeof(frame), websocket::opcode::text, output);
+
+    for (auto conn : server->connections) {
+        if (conn->protocol == wire_protocol::line || conn->protocol == wire_protocol::replica) {
+            queue_broadcast(server, conn, line_output);
+            continue;
+        }
+
+        if (conn->protocol == wire_protocol::websocket) {
+            queue_broadcast(server, conn, std::string_view(frame, frame_size));
+            continue;
+        }
+
+        if (conn->protocol != wire_protocol::resp || conn->channel.empty()) {
+            continue;
+        }
+
+        if (message.empty() || message_channel != conn->channel) {
+            message.clear();
+            resp::append_array_header(message, 3);
+            resp::append_bulk_string(message, "message");
+            resp::append_bulk_string(message, conn->channel);
+            resp::append_bulk_string(message, output);
+            message_channel = conn->channel;
+        }
+
+        queue_broadcast(server, conn, message);
+    }
+
+    // Last, since a long poll that wakes up may finish its connection off
+    server->loop->notify_all(server->count_changed);
+}
+
+namespace {
+
+auto parse_integer(std::string const& text, int64_t* out) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out);
+    return err == std::errc() && end == text.data() + text.size();
+}
+
+// PFADD name item...: whether the sketch changed (creating it counts), or nullopt when it would be
+// one sketch more than we keep
+auto add_distinct(server_context* server, std::string const& name, std::span<std::string const> items) -> std::optional<bool>
+{
+    auto it = server->distinct.find(name);
+    auto changed = it == server->distinct.end();
+    if (changed) {
+        if (server->distinct.size() >= server->max_distinct) {
+            return std::nullopt;
+        }
+        it = server->distinct.emplace(name, std::make_unique<hyperloglog>()).first;
+    }
+
+    for (auto const& item : items) {
+        changed |= it->second->add(item);
+    }
+    return changed;
+}
+
+// PFCOUNT name...: the estimate for one sketch, or for the union of several. A name nobody added
+// to is an empty set.
+auto count_distinct(server_context* server, std::span<std::string const> names) -> uint64_t
+{
+    if (names.size() == 1) {
+        auto it = server->distinct.find(names[0]);
+        return it == server->distinct.end() ? 0 : it->second->estimate();
+    }
+
+    auto merged = std::make_unique<hyperloglog>();
+    for (auto const& name : names) {
+        if (auto it = server->distinct.find(name); it != server->distinct.end()) {
+            merged->merge(*it->second);
+        }
+    }
+    return merged->estimate();
+}
+
+// PFMERGE destination source...: false when the destination would be one sketch too many
+auto merge_distinct(server_context* server, std::string const& destination, std::span<std::string const> sources) -> bool
+{
+    if (!add_distinct(server, destination, {})) {
+        return false;
+    }
+
+    auto& into = *server->distinct[destination];
+    for (auto const& name : sources) {
+        if (auto it = server->distinct.find(name); it != server->distinct.end()) {
+            into.merge(*it->second);
+        }
+    }
+    return true;
+}
+
+// The line-protocol commands with names and lists in them are handled as words: the command's words
+// come back with the answer appended ("PFCOUNT visitors 1234"), or FULL when there's no room for
+// another sketch or histogram
+auto split_words(std::string const& command) -> std::vector<std::string>
+{
+    auto line = std::string_view(command);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+        line.remove_suffix(1);
+    }
+
+    std::vector<std::string> words;
+    for (size_t start = 0; start < line.size(); ) {
+        auto end = std::min(line.find(' ', start), line.size());
+        if (end > start) {
+            words.emplace_back(line.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return words;
+}
+
+void send_words_reply(server_context* server, connection* conn, std::span<std::string const> echoed, std::string_view answer)
+{
+    std::string reply;
+    for (auto const& word : echoed) {
+        reply += word;
+        reply += ' ';
+    }
+    reply += answer;
+    reply += "\r\n";
+    queue_output(server, conn, reply);
+}
+
+// Where to go instead when a name is held by another node: "MOVED <node> <host:port>"
+auto elsewhere(server_context* server, std::string_view name) -> std::optional<std::string>
+{
+    auto owner = server->shards.owner(name);
+    if (owner == server->shards.self_node()) {
+        return std::nullopt;
+    }
+    return "MOVED " + std::to_string(owner) + " " + server->shards.address(owner);
+}
+
+// The same for a command naming several; when no one node holds them all, none can answer it
+auto elsewhere(server_context* server, std::span<std::string const> names) -> std::optional<std::string>
+{
+    auto owner = server->shards.common_owner(names);
+    if (!owner) {
+        return "CROSSNODE";
+    }
+    if (*owner == server->shards.self_node()) {
+        return std::nullopt;
+    }
+    return "MOVED " + std::to_string(*owner) + " " + server->shards.address(*owner);
+}
+
+// Redis Cluster's wording, which cluster-aware clients already understand
+void send_elsewhere_error(server_context* server, connection* conn, std::string const& where)
+{
+    auto reply = std::string();
+    resp::append_error(reply, where == "CROSSNODE" ? "CROSSSLOT Keys in request don't hash to the same node" : where);
+    queue_output(server, conn, reply);
+}
+
+// PFADD, PFCOUNT and PFMERGE
+void handle_distinct_line(server_context* server, connection* conn, std::string const& command)
+{
+    auto words = split_words(command);
+    if (words.size() < 2) {
+        return;
+    }
+
+    auto all = std::span<std::string const>(words);
+    auto named = words[0] == "PFADD" ? all.subspan(1, 1) : all.subspan(1);
+    if (words[0] != "PFADD" && words[0] != "PFCOUNT" && words[0] != "PFMERGE") {
+        named = all.first(0);
+    }
+    if (auto moved = elsewhere(server, named)) {
+        send_words_reply(server, conn, all.first(2), *moved);
+        return;
+    }
+
+    auto echoed = all;
+    std::string answer;
+    if (words[0] == "PFADD") {
+        auto changed = add_distinct(server, words[1], all.subspan(2));
+        answer = changed ? (*changed ? "1" : "0") : "FULL";
+        echoed = all.first(2);  // the items aren't worth sending back
+    }
+    else if (words[0] == "PFCOUNT") {
+        answer = std::to_string(count_distinct(server, all.subspan(1)));
+    }
+    else if (words[0] == "PFMERGE") {
+        answer = merge_distinct(server, words[1], all.subspan(2)) ? "OK" : "FULL";
+    }
+    else {
+        return;
+    }
+
+    send_words_reply(server, conn, echoed, answer);
+}
+
+// PERCENTILE name p...: the value at each percentile, in order; EMPTY if nothing was observed
+auto histogram_percentiles(server_context* server, std::string const& name, std::span<std::string const> percents) -> std::optional<std::vector<uint64_t>>
+{
+    auto target = find_histogram(server, name);
+    if (!target || !target->count()) {
+        return std::vector<uint64_t>{};
+    }
+
+    std::vector<uint64_t> values;
+    for (auto const& text : percents) {
+        char* end = nullptr;
+        auto percent = strtod(text.c_str(), &end);
+        if (text.empty() || *end || !(percent >= 0.0 && percent <= 100.0)) {
+            return std::nullopt;
+        }
+        values.push_back(target->percentile(percent));
+    }
+    return values;
+}
+
+// HISTMERGE destination source...: false when the destination would be one histogram too many
+auto merge_histograms(server_context* server, std::string const& destination, std::span<std::string const> sources) -> bool
+{
+    auto into = find_or_add_histogram(server, destination);
+    if (!into) {
+        return false;
+    }
+
+    for (auto const& name : sources) {
+        auto from = find_histogram(server, name);
+        if (from && from != into) {
+            into->merge(*from);
+        }
+    }
+    return true;
+}
+
+// PERCENTILE, HISTMERGE, and HISTDUMP and HISTLOAD, which move a histogram between processes as
+// text: HISTDUMP's answer, fed to another server's HISTLOAD, merges it in there. OBSERVE is the
+// exception, answering only when there's no room for another histogram or the histogram is held by
+// another node, since it's the one sent in bulk.
+void handle_histogram_line(server_context* server, connection* conn, std::string const& command)
+{
+    std::string_view name;
+    uint64_t value;
+    if (parse_observation(command.c_str(), &name, &value)) {
+        if (auto moved = elsewhere(server, name)) {
+            queue_output(server, conn, "OBSERVE " + std::string(name) + " " + *moved + "\r\n");
+        }
+        else if (auto target = find_or_add_histogram(server, name)) {
+            target->record(value);
+        }
+        else {
+            queue_output(server, conn, "OBSERVE " + std::string(name) + " FULL\r\n");
+        }
+        return;
+    }
+
+    auto words = split_words(command);
+    if (words.size() < 2) {
+        return;
+    }
+
+    auto all = std::span<std::string const>(words);
+    auto named = words[0] == "HISTMERGE" ? all.subspan(1) : all.subspan(1, 1);
+    if (words[0] != "HISTMERGE" && words[0] != "PERCENTILE" && words[0] != "HISTDUMP" && words[0] != "HISTLOAD") {
+        named = all.first(0);
+    }
+    if (auto moved = elsewhere(server, named)) {
+        send_words_reply(server, conn, all.first(2), *moved);
+        return;
+    }
+
+    auto echoed = all;
+    std::string answer;
+    if (words[0] == "PERCENTILE" && words.size() >= 3) {
+        auto values = histogram_percentiles(server, words[1], all.subspan(2));
+        if (!values) {
+            answer = "BAD";
+        }
+        else if (values->empty()) {
+            answer = "EMPTY";
+        }
+        else {
+            // Each percentile is followed by its value: "PERCENTILE latency 50 1200 99 5400"
+            echoed = all.first(2);
+            for (size_t i = 0; i < values->size(); ++i) {
+                answer += (i ? " " : "") + words[i + 2] + " " + std::to_string((*values)[i]);
+            }
+        }
+    }
+    else if (words[0] == "HISTMERGE") {
+        answer = merge_histograms(server, words[1], all.subspan(2)) ? "OK" : "FULL";
+    }
+    else if (words[0] == "HISTDUMP" && words.size() == 2) {
+        auto target = find_histogram(server, words[1]);
+        answer = target ? target->encode() : histogram().encode();
+    }
+    else if (words[0] == "HISTLOAD" && words.size() == 3) {
+        auto target = find_or_add_histogram(server, words[1]);
+        answer = !target ? "FULL" : target->merge_encoded(words[2]) ? "OK" : "BAD";
+        echoed = all.first(2);
+    }
+    else {
+        return;
+    }
+
+    send_words_reply(server, conn, echoed, answer);
+}
+
+// The Redis commands we map onto the count. Keys are accepted and ignored: there is only one
+// counter, and whatever a client calls it, that's the one it gets. The PF commands are the
+// exception: every key is a sketch of its own.
+void handle_resp_command(server_context* server, connection* conn, std::vector<std::string> const& args)
+{
+    auto const& name = args[0];
+    auto is = [&](char const* command, size_t arity) {
+        return strcasecmp(name.c_str(), command) == 0 && args.size() == arity;
+    };
+
+    std::string reply;
+
+    // Sketches and histograms are answered by the node holding them
+    auto named_as = [&](char const* command) {
+        return strcasecmp(name.c_str(), command) == 0 && args.size() >= 2;
+    };
+    auto names = std::span<std::string const>();
+    if (named_as("PFADD") || named_as("OBSERVE") || named_as("PERCENTILE") || named_as("HISTDUMP") || named_as("HISTLOAD")) {
+        names = std::span(args).subspan(1, 1);
+    }
+    else if (named_as("PFCOUNT") || named_as("PFMERGE") || named_as("HISTMERGE")) {
+        names = std::span(args).subspan(1);
+    }
+    if (auto moved = elsewhere(server, names)) {
+        send_elsewhere_error(server, conn, *moved);
+        return;
+    }
+
+    auto writes = is("INCR", 2) || is("DECR", 2) || is("INCRBY", 3) || is("DECRBY", 3);
+    if (writes && server->read_only) {
+        resp::append_error(reply, "READONLY You can't write against a read only replica.");
+        queue_output(server, conn, reply);
+        return;
+    }
+
+    int64_t delta = 0;
+    if (is("INCR", 2) || is("DECR", 2)) {
+        delta = 1;
+    }
+    else if ((is("INCRBY", 3) || is("DECRBY", 3)) && !parse_integer(args[2], &delta)) {
+        resp::append_error(reply, "ERR value is not an integer or out of range");
+        queue_output(server, conn, reply);
+        return;
+    }
+
+    // The one value that can't be negated
+    if (is("DECRBY", 3) && delta == INT64_MIN) {
+        resp::append_error(reply, "ERR value is out of range");
+        queue_output(server, conn, reply);
+        return;
+    }
+
+    // The reply waits for the entry to be applied
+    if (writes && server->raft) {
+        auto decrement = is("DECR", 2) || is("DECRBY", 3);
+        if (!server->raft->propose(conn, decrement ? -delta : delta, {})) {
+            send_not_leader(server, conn);
+        }
+        return;
+    }
+
+    if (is("INCR", 2) || is("INCRBY", 3)) {
+        server->count->add(event_loop_worker, delta);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s increments the count by %ld to %ld\n", conn->peer_name.c_str(), delta, current.value);
+
+        resp::append_integer(reply, current.value);
+        queue_output(server, conn, reply);
+        broadcast_count(server, current);
+    }
+    else if (is("DECR", 2) || is("DECRBY", 3)) {
+        server->count->add(event_loop_worker, -delta);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s decrements the count by %ld to %ld\n", conn->peer_name.c_str(), delta, current.value);
+
+        resp::append_integer(reply, current.value);
+        queue_output(server, conn, reply);
+        broadcast_count(server, current);
+    }
+    else if (is("GET", 2) && server->raft) {
+        if (!server->raft->read(conn)) {
+            send_not_leader(server, conn);
+        }
+    }
+    else if (is("GET", 2)) {
+        auto value = server->count->snapshot();
+        fprintf(stderr, "%s requests the count; it is %ld\n", conn->peer_name.c_str(), value);
+
+        resp::append_bulk_string(reply, std::to_string(value));
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "SUBSCRIBE") == 0 && args.size() >= 2) {
+        // Every channel carries the same updates, so the first one named is where they go
+        for (size_t i = 1; i < args.size(); ++i) {
+            resp::append_array_header(reply, 3);
+            resp::append_bulk_string(reply, "subscribe");
+            resp::append_bulk_string(reply, args[i]);
+            resp::append_integer(reply, int64_t(i));
+        }
+
+        if (conn->channel.empty()) {
+            conn->channel = args[1];
+            fprintf(stderr, "%s subscribes to %s\n", conn->peer_name.c_str(), conn->channel.c_str());
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (is("RATE", 2)) {
+        auto window = rate_window::parse_span(args[1]);
+        if (!window) {
+            resp::append_error(reply, "ERR window must be 1s, 1m or 1h");
+        }
+        else {
+            resp::append_integer(reply, server->rates.change(event_loop::clock::now(), *window));
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "PFADD") == 0 && args.size() >= 2) {
+        auto changed = add_distinct(server, args[1], std::span(args).subspan(2));
+        if (!changed) {
+            resp::append_error(reply, "ERR too many HyperLogLog keys");
+        }
+        else {
+            resp::append_integer(reply, *changed);
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "PFCOUNT") == 0 && args.size() >= 2) {
+        resp::append_integer(reply, int64_t(count_distinct(server, std::span(args).subspan(1))));
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "PFMERGE") == 0 && args.size() >= 2) {
+        if (!merge_distinct(server, args[1], std::span(args).subspan(2))) {
+            resp::append_error(reply, "ERR too many HyperLogLog keys");
+        }
+        else {
+            resp::append_simple_string(reply, "OK");
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (is("TOPK", 2)) {
+        int64_t leaders;
+        if (!parse_integer(args[1], &leaders) || leaders < 0) {
+            resp::append_error(reply, "ERR value is not an integer or out of range");
+        }
+        else {
+            // Key, count, key, count, like TOPK.LIST WITHCOUNT
+            auto top = server->hitters.top(size_t(leaders));
+            resp::append_array_header(reply, top.size() * 2);
+            for (auto const& leader : top) {
+                resp::append_bulk_string(reply, leader.first);
+                resp::append_integer(reply, int64_t(leader.second));
+            }
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (is("OBSERVE", 3)) {
+        uint64_t value;
+        auto [end, err] = std::from_chars(args[2].data(), args[2].data() + args[2].size(), value);
+        auto target = err == std::errc() && end == args[2].data() + args[2].size() ? find_or_add_histogram(server, args[1]) : nullptr;
+        if (err != std::errc() || end != args[2].data() + args[2].size()) {
+            resp::append_error(reply, "ERR value is not an integer or out of range");
+        }
+        else if (!target) {
+            resp::append_error(reply, "ERR too many histograms");
+        }
+        else {
+            target->record(value);
+            resp::append_integer(reply, int64_t(target->count()));
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "PERCENTILE") == 0 && args.size() >= 3) {
+        // One value per percentile asked for, nil for each when nothing was observed
+        auto values = histogram_percentiles(server, args[1], std::span(args).subspan(2));
+        if (!values) {
+            resp::append_error(reply, "ERR percentiles go from 0 to 100");
+        }
+        else {
+            resp::append_array_header(reply, args.size() - 2);
+            for (size_t i = 2; i < args.size(); ++i) {
+                if (values->empty()) {
+                    reply += "$-1\r\n";
+                }
+                else {
+                    resp::append_integer(reply, int64_t((*values)[i - 2]));
+                }
+            }
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "HISTMERGE") == 0 && args.size() >= 2) {
+        if (!merge_histograms(server, args[1], std::span(args).subspan(2))) {
+            resp::append_error(reply, "ERR too many histograms");
+        }
+        else {
+            resp::append_simple_string(reply, "OK");
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (is("HISTDUMP", 2)) {
+        auto target = find_histogram(server, args[1]);
+        resp::append_bulk_string(reply, target ? target->encode() : histogram().encode());
+        queue_output(server, conn, reply);
+    }
+    else if (is("HISTLOAD", 3)) {
+        auto target = find_or_add_histogram(server, args[1]);
+        if (!target) {
+            resp::append_error(reply, "ERR too many histograms");
+        }
+        else if (!target->merge_encoded(args[2])) {
+            resp::append_error(reply, "ERR not a histogram dump");
+        }
+        else {
+            resp::append_simple_string(reply, "OK");
+        }
+        queue_output(server, conn, reply);
+    }
+    else if (is("PING", 1)) {
+        resp::append_simple_string(reply, "PONG");
+        queue_output(server, conn, reply);
+    }
+    else if (strcasecmp(name.c_str(), "COMMAND") == 0) {
+        // redis-cli asks for command docs when it starts; it copes fine with having none
+        resp::append_array_header(reply, 0);
+        queue_output(server, conn, reply);
+    }
+    else {
+        resp::append_error(reply, "ERR unknown command or wrong number of arguments for '" + name + "'");
+        queue_output(server, conn, reply);
+    }
+}
+
+void answer_conditional(server_context* server, connection* conn, versioned_value seen, bool applied)
+{
+    char buffer[64];
+    auto size = std::string_view(applied ? "OK " : "FAIL ").copy(buffer, 5);
+    size += format_count(buffer + size, sizeof(buffer) - size - 2, seen).size();
+    buffer[size++] = '\r';
+    buffer[size++] = '\n';
+    queue_output(server, conn, std::string_view(buffer, size));
+
+    if (applied) {
+        broadcast_count(server, server->count->versioned_snapshot());
+    }
+}
+
+// RESP requests span several lines; nothing happens until the last one is in
+void handle_resp_line(server_context* server, connection* conn, std::string const& line)
+{
+    conn->protocol = wire_protocol::resp;
+
+    switch (conn->request.feed(line)) {
+    case resp::request_parser::status::incomplete:
+        break;
+
+    case resp::request_parser::status::complete:
+        if (!admit_command(server, conn)) {
+            auto reply = std::string();
+            resp::append_error(reply, "BUSY too many commands; try again later");
+            queue_output(server, conn, reply);
+            break;
+        }
+        handle_resp_command(server, conn, conn->request.arguments());
+        break;
+
+    case resp::request_parser::status::malformed: {
+        auto reply = std::string();
+        resp::append_error(reply, "ERR Protocol error");
+        queue_output(server, conn, reply);
+        break;
+    }
+    }
+}
+
+}  // namespace
+
+// Fixed one-second windows: a clock read and a counter per command, where a token bucket would
+// want arithmetic on durations as well, and shedding needs no more precision than this
+auto admit_command(server_context* server, connection* conn) -> bool
+{
+    if (!server->max_commands_per_second) {
+        return true;
+    }
+
+    auto now = event_loop::clock::now();
+    if (now - conn->window_start >= std::chrono::seconds(1)) {
+        conn->window_start = now;
+        conn->window_commands = 0;
+    }
+
+    if (++conn->window_commands <= server->max_commands_per_second) {
+        return true;
+    }
+
+    // Once per window, not per command: under overload the log would be a load of its own
+    if (conn->window_commands == server->max_commands_per_second + 1) {
+        fprintf(stderr, "Shedding commands from %s: more than %zu a second\n", conn->peer_name.c_str(), server->max_commands_per_second);
+    }
+    ++server->overload.shed;
+    return false;
+}
+
+void parse_and_handle(server_context* server, connection* conn, std::string const& command)
+{
+    if (conn->protocol == wire_protocol::replica) {
+        return;
+    }
+
+    // A follower (possibly another one further down the line) wants every state the count goes
+    // through; the first is the one it's in now
+    if (command == "REPLICATE\r\n") {
+        conn->protocol = wire_protocol::replica;
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s follows us from %ld@%lu\n", conn->peer_name.c_str(), current.value, current.version);
+        send_count(server, conn, current);
+        return;
+    }
+
+    // A RESP request always opens with an array header, which no line protocol command does
+    if (conn->request.in_progress() || command.starts_with('*')) {
+        handle_resp_line(server, conn, command);
+        return;
+    }
+
+    if (!admit_command(server, conn)) {
+        queue_output(server, conn, "BUSY\r\n");
+        return;
+    }
+
+    if (command.starts_with("PF")) {
+        handle_distinct_line(server, conn, command);
+        return;
+    }
+
+    if (command.starts_with("OBSERVE ") || command.starts_with("PERCENTILE ") || command.starts_with("HIST")) {
+        handle_histogram_line(server, conn, command);
+        return;
+    }
+
+    if (command == "OUTPUT\r\n" && server->raft) {
+        if (!server->raft->read(conn)) {
+            send_not_leader(server, conn);
+        }
+    }
+    else if (command == "OUTPUT\r\n") {
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s requests the count; it is %ld@%lu\n", conn->peer_name.c_str(), current.value, current.version);
+        send_count(server, conn, current);
+    }
+
+    if (auto argument = line_argument(command, "RATE")) {
+        if (auto window = rate_window::parse_span(*argument)) {
+            char reply[48];
+            auto size = snprintf(reply, sizeof(reply), "RATE %.*s %ld\r\n", int(argument->size()), argument->data(),
+                server->rates.change(event_loop::clock::now(), *window));
+            queue_output(server, conn, std::string_view(reply, size_t(size)));
+        }
+        else {
+            queue_output(server, conn, "RATE BAD\r\n");
+        }
+    }
+
+    if (auto change = delta_command{}; parse_delta_command(command.c_str(), &change)) {
+        if (server->read_only) {
+            queue_output(server, conn, "READONLY\r\n");
+            return;
+        }
+
+        // Request IDs are checked as entries are applied, on every member alike
+        if (server->raft && change.key.empty()) {
+            if (!server->raft->propose(conn, change.delta, request_id(change))) {
+                send_not_leader(server, conn);
+            }
+            return;
+        }
+
+        if (!change.key.empty()) {
+            if (auto moved = elsewhere(server, change.key)) {
+                queue_output(server, conn, *moved + "\r\n");
+                return;
+            }
+        }
+
+        // A retry of something already applied changes nothing, but the client still deserves to
+        // hear where the count stands, or it would keep on retrying
+        if (!admit(&server->dedupe, change)) {
+            auto current = server->count->versioned_snapshot();
+            fprintf(stderr, "%s repeats request %.*s:%lu; not applying it again\n", conn->peer_name.c_str(),
+                int(change.client.size()), change.client.data(), change.sequence);
+            send_count(server, conn, current);
+            return;
+        }
+
+        if (!change.key.empty()) {
+            auto estimate = server->hitters.add(change.key, uint64_t(change.delta));
+            fprintf(stderr, "%s increments %.*s by %ld to about %lu\n", conn->peer_name.c_str(),
+                int(change.key.size()), change.key.data(), change.delta, estimate);
+            return;
+        }
+
+        server->count->add(event_loop_worker, change.delta);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s %s the count by %ld to %ld\n", conn->peer_name.c_str(),
+            change.decrement ? "decrements" : "increments", change.decrement ? -change.delta : change.delta, current.value);
+
+        broadcast_count(server, current);
+    }
+
+    if (auto argument = line_argument(command, "TOPK")) {
+        size_t leaders = 0;
+        auto [end, err] = std::from_chars(argument->data(), argument->data() + argument->size(), leaders);
+        if (err != std::errc() || end != argument->data() + argument->size()) {
+            queue_output(server, conn, "TOPK BAD\r\n");
+            return;
+        }
+
+        std::string reply = "TOPK";
+        for (auto const& leader : server->hitters.top(leaders)) {
+            reply += ' ';
+            reply += leader.first;
+            reply += ' ';
+            reply += std::to_string(leader.second);
+        }
+        reply += "\r\n";
+        queue_output(server, conn, reply);
+    }
+
+    // The conditional forms answer the client either way: OK or FAIL, then the count they were judged
+    // against, so a failed attempt already has what the retry needs
+    int64_t expected, desired;
+    uint64_t version;
+    int64_t delta;
+    auto conditional = sscanf(command.data(), "CAS %ld %ld\r\n", &expected, &desired) == 2 ||
+        sscanf(command.data(), "INCRIF %lu %ld\r\n", &version, &delta) == 2;
+    if (conditional && server->read_only) {
+        queue_output(server, conn, "READONLY\r\n");
+        return;
+    }
+    if (conditional && server->raft) {
+        queue_output(server, conn, "UNSUPPORTED\r\n");
+        return;
+    }
+
+    if (sscanf(command.data(), "CAS %ld %ld\r\n", &expected, &desired) == 2) {
+        // The swap is applied as the difference, which doesn't fit in 64 bits when the two are far
+        // enough apart; that's refused rather than wrapped
+        auto too_far = false;
+        auto [seen, applied] = server->count->add_if(event_loop_worker, [&](versioned_value current) -> std::optional<int64_t> {
+            int64_t difference;
+            if (current.value != expected || (too_far = __builtin_sub_overflow(desired, current.value, &difference))) {
+                return std::nullopt;
+            }
+            return difference;
+        });
+        if (too_far) {
+            queue_output(server, conn, "CAS BAD\r\n");
+            return;
+        }
+        fprintf(stderr, "%s swaps the count from %ld to %ld: %s\n", conn->peer_name.c_str(), expected, desired, applied ? "done" : "it was not");
+
+        answer_conditional(server, conn, seen, applied);
+    }
+
+    if (sscanf(command.data(), "INCRIF %lu %ld\r\n", &version, &delta) == 2) {
+        auto [seen, applied] = server->count->add_if(event_loop_worker, [&](versioned_value current) {
+            return current.version == version ? std::optional(delta) : std::nullopt;
+        });
+        fprintf(stderr, "%s increments the count by %ld at version %lu: %s\n", conn->peer_name.c_str(), delta, version, applied ? "done" : "it moved on");
+
+        answer_conditional(server, conn, seen, applied);
+    }
+}
+
+namespace {
+
+// Past max_connections, a client is accepted only to be told so and hung up on: left in the backlog
+// it would wait with no idea why, and keep the listen socket readable for nothing
+auto refuse_if_full(server_context* server, resource_handle const& new_connection, std::string_view reply) -> bool
+{
+    if (!server->max_connections || server->connections.size() < server->max_connections) {
+        return false;
+    }
+
+    // One try, without waiting: a fresh socket's buffer has room for a line
+    auto sent = send(new_connection.get().fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    (void)sent;
+
+    if (server->overload.refused++ % 1000 == 0) {
+        fprintf(stderr, "Refusing connections: %zu already (%zu refused so far)\n", server->connections.size(), server->overload.refused);
+    }
+    return true;
+}
+
+}  // namespace
+
+auto accept_connections(server_context* server, int listen_socket) -> task<>
+{
+    while (co_await server->loop->readable(listen_socket)) {
+        if (auto new_connection = accept_connection(listen_socket)) {
+            if (!refuse_if_full(server, new_connection, "BUSY\r\n")) {
+                spawn(serve_connection(server, std::move(new_connection)));
+            }
+        }
+    }
+}
+
+namespace {
+
+// How much one connection gets through before the others get a look in: a client pipelining a
+// megabyte of INCRs has it applied 256 at a time, between everybody else's
+constexpr auto turn_budget = read_budget { 64 * 1024, 256 };
+
+auto owes_too_much(server_context* server, connection* conn) -> bool
+{
+    return server->max_outbound && conn->outbound.size() > server->max_outbound;
+}
+
+// A client that doesn't read its replies doesn't get to send more commands: its socket is left
+// alone, so the kernel's buffers fill and TCP pushes back on it, until it has taken half of what it
+// owes. flush_outbound wakes us when it's done; the timeout covers output that leaves any other way
+// (at the end of a batch, say, or dropped on an error).
+auto wait_until_taken(server_context* server, connection* conn) -> task<>
+{
+    ++server->overload.paused;
+    fprintf(stderr, "Not reading from %s until it takes the %zu bytes it owes\n", conn->peer_name.c_str(), conn->outbound.size());
+
+    while (conn->outbound.size() > server->max_outbound / 2 && !server->draining) {
+        auto woken = co_await server->loop->wait(conn->drained, std::chrono::milliseconds(100));
+        (void)woken;
+    }
+}
+
+}  // namespace
+
+auto serve_connection(server_context* server, resource_handle handle) -> task<>
+{
+    auto conn = connection { std::move(handle) };
+    conn.peer_name = get_peer_name(conn.fd());
+    fprintf(stderr, "New connection from %s\n", conn.peer_name.c_str());
+
+    server->connections.push_back(&conn);
+
+    if (server->edge_triggered) {
+        server->loop->watch_edges(conn.fd());
+    }
+
+    // A connection with input left after its turn doesn't wait on the socket, which may have nothing
+    // more to say (lines already read are waiting in conn.inbound, and edge-triggered, a socket we
+    // stopped short of EAGAIN won't be reported again). It queues up for another turn instead.
+    auto more = false;
+    for (;;) {
+        if (owes_too_much(server, &conn)) {
+            co_await wait_until_taken(server, &conn);
+            if (server->draining) {
+                break;  // as below, nobody cancels a connection that isn't waiting on its socket
+            }
+            more = true;  // edge-triggered, whatever arrived meanwhile won't be reported again
+        }
+
+        if (more) {
+            server->ready.push_back(&conn);
+            if (server->ready.size() == 1) {
+                server->loop->notify_all(server->ready_queued);
+            }
+
+            auto turn = co_await server->loop->wait(conn.turn);
+            (void)turn;
+            if (server->draining) {
+                break;  // nobody is going to cancel us: we're not waiting on the socket
+            }
+        }
+        else {
+            auto ready = co_await server->loop->readable(conn.fd());
+            if (!ready) {
+                break;
+            }
+        }
+
+        auto received = receive_lines(&conn, turn_budget);
+        for (auto const& line : received.lines) {
+            parse_and_handle(server, &conn, line);
+        }
+
+        // they hung up
+        if (received.closed) {
+            break;
+        }
+
+        more = received.more;
+    }
+
+    if (server->draining) {
+        co_await flush_before_close(server, &conn, server->drain_deadline);
+    }
+
+    std::erase(server->connections, &conn);
+    if (conn.batched) {
+        std::erase(server->batched, &conn);
+    }
+    server->loop->forget(conn.fd());  // also stops a flush_outbound still waiting on us
+    if (server->raft) {
+        server->raft->forget(&conn);
+    }
+
+    fprintf(stderr, "%s hung up\n", conn.peer_name.c_str());
+
+    if (server->draining && server->connections.empty()) {
+        server->loop->stop();
+    }
+}
+
+namespace {
+
+auto apply_udp_deltas(server_context* server, int udp_socket) -> bool
+{
+    auto received = receive_udp_deltas(server, udp_socket);
+    if (!received.datagrams) {
+        return false;
+    }
+
+    if (received.observations) {
+        fprintf(stderr, "Recorded %zu observations from datagrams\n", received.observations);
+    }
+
+    if (received.refused) {
+        fprintf(stderr, "Refused %zu datagram writes; we don't lead\n", received.refused);
+    }
+
+    if (received.moved) {
+        fprintf(stderr, "Dropped %zu datagram commands for names other nodes hold\n", received.moved);
+    }
+
+    if (received.duplicates) {
+        fprintf(stderr, "Ignored %zu repeated datagram commands\n", received.duplicates);
+    }
+
+    if (received.proposed) {
+        fprintf(stderr, "Proposed %zu datagram commands to the cluster\n", received.proposed);
+    }
+
+    // Datagrams with nothing but observations, keyed increments or repeats leave the count (and its
+    // version) alone, and nobody needs telling
+    if (received.count_commands) {
+        server->count->add(event_loop_worker, received.delta);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%zu datagrams change the count by %ld to %ld\n", received.datagrams, received.delta, current.value);
+        broadcast_count(server, current);
+    }
+
+    return true;
+}
+
+}  // namespace
+
+auto serve_udp(server_context* server, int udp_socket) -> task<>
+{
+    while (co_await server->loop->readable(udp_socket)) {
+        // Kept as a named local on purpose: with nothing but the awaiter alive across the co_await,
+        // GCC 12 lays this frame out wrongly and the coroutine never starts
+        auto applied = apply_udp_deltas(server, udp_socket);
+        (void)applied;
+    }
+
+    // Whatever already made it into the socket buffer still counts
+    if (server->draining) {
+        while (apply_udp_deltas(server, udp_socket)) {}
+    }
+}
+
+namespace {
+
+// How long GET /count?after=N holds on to a request before answering with the unchanged count
+constexpr auto long_poll_timeout = std::chrono::seconds(30);
+
+// How long POST /incr on a Raft leader waits for its entry to be committed
+constexpr auto raft_write_timeout = std::chrono::seconds(5);
+
+// How long a connection we're hanging up on gets to take its last response
+constexpr auto close_timeout = std::chrono::seconds(5);
+
+// Whether the connection stays open after answering `request`, which the response has to announce
+auto keeps_alive(server_context* server, http::request const& request) -> bool
+{
+    return request.keep_alive && !request.chunked && !server->draining;
+}
+
+void send_http_response(server_context* server, connection* conn, http::request const& request, int status, std::string_view body)
+{
+    char response[512];
+    auto version = server->count->versioned_snapshot().version;
+    auto length = http::format_response(response, sizeof(response), status, body, version, keeps_alive(server, request));
+    queue_output(server, conn, std::string_view(response, std::min(length, sizeof(response) - 1)));
+}
+
+void send_http_count(server_context* server, connection* conn, http::request const& request, int64_t value)
+{
+    char body[24];
+    auto end = std::to_chars(body, body + sizeof(body) - 1, value).ptr;
+    *end++ = '\n';
+
+    send_http_response(server, conn, request, 200, std::string_view(body, size_t(end - body)));
+}
+
+template <typename Number>
+auto parse_parameter(std::string_view text, Number* out) -> bool
+{
+    auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), *out);
+    return !text.empty() && err == std::errc() && end == text.data() + text.size();
+}
+
+// Answers the handshake and sends the count as it stands, so a dashboard has something to show
+// before the first update
+void start_websocket(server_context* server, connection* conn, http::request const& request)
+{
+    if (request.websocket_version != 13 || request.websocket_key.empty()) {
+        send_http_response(server, conn, request, 400, "WebSocket version 13 with a key, please\n");
+        return;
+    }
+
+    char response[256];
+    auto length = websocket::format_handshake_response(response, sizeof(response), request.websocket_key);
+    queue_output(server, conn, std::string_view(response, std::min(length, sizeof(response) - 1)));
+
+    conn->protocol = wire_protocol::websocket;
+    fprintf(stderr, "%s upgrades to a WebSocket\n", conn->peer_name.c_str());
+
+    char text[48];
+    auto current = format_count(text, sizeof(text), server->count->versioned_snapshot());
+    char frame[websocket::max_header_size + 48];
+    auto frame_size = websocket::encode_frame(frame, sizeof(frame), websocket::opcode::text, current);
+    queue_output(server, conn, std::string_view(frame, frame_size));
+}
+
+// POST /incr on a Raft member: answered once the entry is applied, or when it's clear it won't be
+auto increment_through_raft(server_context* server, connection* conn, http::request const& request, int64_t delta) -> task<>
+{
+    auto outcome = raft_cluster::result::pending;
+    if (!server->raft->propose(conn, delta, {}, &outcome)) {
+        auto leader = server->raft->leader_hint();
+        if (leader.empty()) {
+            send_http_response(server, conn, request, 503, "No leader right now; try again shortly\n");
+        }
+        else {
+            send_http_response(server, conn, request, 421, "Not the leader; increment " + leader + "\n");
+        }
+        co_return;
+    }
+
+    auto deadline = event_loop::clock::now() + raft_write_timeout;
+    while (outcome == raft_cluster::result::pending && !server->draining && event_loop::clock::now() < deadline) {
+        auto woken = co_await server->loop->wait(server->count_changed, deadline - event_loop::clock::now());
+        (void)woken;
+    }
+
+    switch (outcome) {
+    case raft_cluster::result::applied:
+        fprintf(stderr, "%s increments the count by %ld through the cluster\n", conn->peer_name.c_str(), delta);
+        send_http_count(server, conn, request, server->count->snapshot());
+        break;
+    case raft_cluster::result::lost:
+        send_http_response(server, conn, request, 503, "Leadership changed before the increment was committed; it was not applied\n");
+        break;
+    case raft_cluster::result::unknown:
+        send_http_response(server, conn, request, 503, "Leadership changed; the increment may or may not have been applied\n");
+        break;
+    case raft_cluster::result::pending:
+        server->raft->forget(conn);
+        send_http_response(server, conn, request, 504, "Not committed in time; it may still be applied\n");
+        break;
+    }
+}
+
+auto answer_http_request(server_context* server, connection* conn, http::request const& request) -> task<>
+{
+    if (request.chunked) {
+        send_http_response(server, conn, request, 501, "Chunked request bodies are not supported\n");
+        co_return;
+    }
+
+    if (!admit_command(server, conn)) {
+        send_http_response(server, conn, request, 429, "BUSY\n");
+        co_return;
+    }
+
+    if (request.path == "/count") {
+        if (request.method != "GET") {
+            send_http_response(server, conn, request, 405, "Use GET\n");
+            co_return;
+        }
+
+        if (request.websocket_upgrade) {
+            start_websocket(server, conn, request);
+            co_return;
+        }
+
+        if (auto after = http::query_parameter(request.query, "after")) {
+            uint64_t seen;
+            if (!parse_parameter(*after, &seen)) {
+                send_http_response(server, conn, request, 400, "after= takes a version\n");
+                co_return;
+            }
+
+            // Nothing new since the version they have: hold the request until there is. A timeout or
+            // a drain just gets them the count they already know.
+            if (seen >= server->count->versioned_snapshot().version && !server->draining) {
+                auto woken = co_await server->loop->wait(server->count_changed, long_poll_timeout);
+                (void)woken;
+            }
+        }
+
+        auto value = server->count->snapshot();
+        fprintf(stderr, "%s requests the count; it is %ld\n", conn->peer_name.c_str(), value);
+        send_http_count(server, conn, request, value);
+    }
+    else if (request.path == "/rate") {
+        if (request.method != "GET") {
+            send_http_response(server, conn, request, 405, "Use GET\n");
+            co_return;
+        }
+
+        auto window = rate_window::parse_span(http::query_parameter(request.query, "window").value_or("1s"));
+        if (!window) {
+            send_http_response(server, conn, request, 400, "window= takes 1s, 1m or 1h\n");
+            co_return;
+        }
+
+        send_http_count(server, conn, request, server->rates.change(event_loop::clock::now(), *window));
+    }
+    else if (request.path == "/incr") {
+        if (request.method != "POST") {
+            send_http_response(server, conn, request, 405, "Use POST\n");
+            co_return;
+        }
+
+        if (server->read_only) {
+            send_http_response(server, conn, request, 403, "This is a read-only follower; increment the leader\n");
+            co_return;
+        }
+
+        int64_t delta = 1;
+        if (auto by = http::query_parameter(request.query, "by"); by && !parse_parameter(*by, &delta)) {
+            send_http_response(server, conn, request, 400, "by= takes an integer\n");
+            co_return;
+        }
+
+        if (server->raft) {
+            co_await increment_through_raft(server, conn, request, delta);
+            co_return;
+        }
+
+        server->count->add(event_loop_worker, delta);
+        auto current = server->count->versioned_snapshot();
+        fprintf(stderr, "%s increments the count by %ld to %ld\n", conn->peer_name.c_str(), delta, current.value);
+
+        broadcast_count(server, current);
+        send_http_count(server, conn, request, current.value);
+    }
+    else {
+        send_http_response(server, conn, request, 404, "Try GET /count, GET /rate?window=1m or POST /incr?by=n\n");
+    }
+}
+
+}  // namespace
+
+namespace {
+
+void send_close_frame(server_context* server, connection* conn, uint16_t code)
+{
+    char payload[2] = { char(code >> 8), char(code) };
+    char frame[websocket::max_header_size + sizeof(payload)];
+    auto size = websocket::encode_frame(frame, sizeof(frame), websocket::opcode::close, std::string_view(payload, sizeof(payload)));
+    queue_output(server, conn, std::string_view(frame, size));
+}
+
+// An upgraded connection: updates go out from broadcast_count, and all we do here is answer control
+// frames until one side closes. `buffer` is the HTTP receive buffer, with whatever followed the
+// upgrade request still in it.
+auto serve_websocket(server_context* server, connection* conn, char* buffer, size_t capacity, size_t buffered) -> task<>
+{
+    bool last_read = false;
+
+    for (;;) {
+        auto frame = websocket::frame{};
+        size_t length = 0;
+        auto status = websocket::parse_frame(buffer, buffered, capacity, &frame, &length);
+
+        if (status == websocket::parse_status::malformed || status == websocket::parse_status::too_big) {
+            send_close_frame(server, conn, status == websocket::parse_status::too_big ? websocket::too_big : websocket::protocol_error);
+            break;
+        }
+
+        if (status == websocket::parse_status::complete) {
+            if (frame.op == websocket::opcode::close) {
+                // Echo their status code back, which completes the closing handshake
+                auto code = frame.payload.size() >= 2 ? uint16_t(uint8_t(frame.payload[0]) << 8 | uint8_t(frame.payload[1])) : uint16_t(1000);
+                send_close_frame(server, conn, code);
+                break;
+            }
+
+            if (frame.op == websocket::opcode::ping) {
+                char pong[websocket::max_header_size + 125];
+                auto size = websocket::encode_frame(pong, sizeof(pong), websocket::opcode::pong, frame.payload);
+                queue_output(server, conn, std::string_view(pong, size));
+            }
+
+            std::memmove(buffer, buffer + length, buffered - length);
+            buffered -= length;
+            continue;
+        }
+
+        if (last_read) {
+            send_close_frame(server, conn, websocket::going_away);
+            break;
+        }
+
+        // Same as for plain HTTP: a drain cancels the wait, and we say goodbye after one last read
+        auto ready = co_await server->loop->readable(conn->fd());
+        if (!ready) {
+            if (!server->draining) {
+                break;
+            }
+            last_read = true;
+        }
+
+        auto received = recv(conn->fd(), buffer + buffered, capacity - buffered, MSG_DONTWAIT);
+        if (received > 0) {
+            buffered += size_t(received);
+        }
+        else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            break;
+        }
+    }
+}
+
+}  // namespace
+
+auto accept_http_connections(server_context* server, int listen_socket) -> task<>
+{
+    constexpr auto busy = std::string_view(
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 5\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "BUSY\n");
+
+    while (co_await server->loop->readable(listen_socket)) {
+        if (auto new_connection = accept_connection(listen_socket)) {
+            if (!refuse_if_full(server, new_connection, busy)) {
+                spawn(serve_http_connection(server, std::move(new_connection)));
+            }
+        }
+    }
+}
+
+auto serve_http_connection(server_context* server, resource_handle handle) -> task<>
+{
+    auto conn = connection { std::move(handle) };
+    conn.protocol = wire_protocol::http;
+    conn.peer_name = get_peer_name(conn.fd());
+    fprintf(stderr, "New HTTP connection from %s\n", conn.peer_name.c_str());
+
+    server->connections.push_back(&conn);
+
+    // Requests are parsed in place, so they're received straight into a buffer that lives as long as
+    // the connection does; a request leaves it once it has been answered
+    char buffer[http::max_request_size];
+    size_t buffered = 0;
+    bool keep_alive = true;
+    bool last_read = false;
+
+    while (keep_alive) {
+        auto request = http::request{};
+        size_t length = 0;
+        auto status = http::parse_request(std::string_view(buffer, buffered), &request, &length);
+
+        if (status == http::parse_status::malformed) {
+            request.keep_alive = false;
+            send_http_response(server, &conn, request, 400, "");
+            break;
+        }
+
+        if (status == http::parse_status::complete) {
+            co_await answer_http_request(server, &conn, request);
+            keep_alive = keeps_alive(server, request);
+
+            std::memmove(buffer, buffer + length, buffered - length);
+            buffered -= length;
+
+            if (conn.protocol == wire_protocol::websocket) {
+                co_await serve_websocket(server, &conn, buffer, sizeof(buffer), buffered);
+                break;
+            }
+            continue;
+        }
+
+        if (buffered == sizeof(buffer)) {
+            request.keep_alive = false;
+            send_http_response(server, &conn, request, 431, "");
+            break;
+        }
+
+        if (last_read) {
+            break;
+        }
+
+        // Draining cancels the wait, but a request the client already sent still gets its answer
+        auto ready = co_await server->loop->readable(conn.fd());
+        if (!ready) {
+            if (!server->draining) {
+                break;
+            }
+            last_read = true;
+        }
+
+        auto received = recv(conn.fd(), buffer + buffered, sizeof(buffer) - buffered, MSG_DONTWAIT);
+        if (received > 0) {
+            buffered += size_t(received);
+        }
+        else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            break;
+        }
+    }
+
+    // Whatever we still owe the client goes out before we hang up, within reason
+    if (!conn.outbound.empty()) {
+        server->loop->forget(conn.fd());  // a flush_outbound may be waiting to write
+        auto deadline = server->draining ? server->drain_deadline : event_loop::clock::now() + close_timeout;
+        co_await flush_before_close(server, &conn, deadline);
+    }
+
+    std::erase(server->connections, &conn);
+    if (conn.batched) {
+        std::erase(server->batched, &conn);
+    }
+    server->loop->forget(conn.fd());
+
+    fprintf(stderr, "%s hung up\n", conn.peer_name.c_str());
+
+    if (server->draining && server->connections.empty()) {
+        server->loop->stop();
+    }
+}
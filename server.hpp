@@ -0,0 +1,190 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dedupe-window.hpp"
+#include "event-loop.hpp"
+#include "heavy-hitters.hpp"
+#include "histogram.hpp"
+#include "hyperloglog.hpp"
+#include "posix-resource-handle.hpp"
+#include "rate-window.hpp"
+#include "resp.hpp"
+#include "shard-map.hpp"
+#include "sharded-counter.hpp"
+#include "task.hpp"
+
+// Every thread that writes to the count gets its own slot in it
+enum worker_slot : size_t {
+    event_loop_worker,  // the thread running the epoll loop in main()
+    shm_drain_worker,   // the thread draining shared-memory producers
+    worker_slot_count
+};
+
+// What a connection speaks, which decides how (and whether) it hears about updates
+enum class wire_protocol {
+    line,       // "value@version" lines, every update
+    resp,       // set by the first RESP array the client sends; pub/sub messages, once it has subscribed
+    http,       // the HTTP port; nothing unless asked (long polls wait on server_context::count_changed)
+    websocket,  // upgraded from http; a text frame per update
+    replica,    // a follower that sent REPLICATE; "value@version" lines like `line`, and nothing it says counts
+};
+
+// One client; lives in the frame of the coroutine serving it
+struct connection {
+    resource_handle handle;
+    std::string peer_name;   // looked up once; reverse DNS is far too slow to do per command
+    std::string inbound;     // received and not yet handled: whole lines past the last turn's budget, then the start of one
+    std::string outbound;    // output the socket buffer had no room for yet
+    bool flushing = false;   // a flush_outbound coroutine is waiting for the socket to drain
+    bool batched = false;    // broadcasts are queued in outbound for the end of the loop iteration
+    bool dropped = false;    // hung up on for owing too much output; anything more for it goes nowhere
+    event_loop::wait_list turn;  // woken when it's our turn again, after input was left over from the last one
+    event_loop::wait_list drained;  // woken when flush_outbound has sent everything, for reads paused on it
+
+    // Commands in the current one-second window, against server_context::max_commands_per_second
+    event_loop::clock::time_point window_start;
+    size_t window_commands = 0;
+
+    wire_protocol protocol = wire_protocol::line;
+    std::string channel;     // RESP clients only: empty until SUBSCRIBE (they choke on unsolicited data)
+    resp::request_parser request;
+
+    auto fd() const noexcept -> int { return handle.get().fd; }
+};
+
+// What admission control turned away, for the log on shutdown
+struct overload_counts {
+    size_t refused = 0;  // connections past max_connections
+    size_t shed = 0;     // commands past max_commands_per_second
+    size_t paused = 0;   // times a connection wasn't read from because of what it owed
+    size_t dropped = 0;  // connections hung up on for owing far too much
+};
+
+class raft_cluster;
+
+// Everything the coroutines on the event loop share
+struct server_context {
+    event_loop* loop;
+    sharded_counter* count;
+    std::vector<connection*> connections;  // everyone gets every update
+
+    // Every broadcast wakes whoever waits on this
+    event_loop::wait_list count_changed;
+
+    // Connections with broadcasts queued, all sent at once when the loop iteration is over: one send
+    // per connection however many updates it got
+    std::vector<connection*> batched;
+    event_loop::wait_list output_batched;  // woken when the first one joins
+
+    // Request IDs of the INCR/DECR commands already applied, from every transport
+    dedupe_window dedupe;
+
+    // Change over the last second, minute and hour, for RATE
+    rate_window rates;
+
+    // Per-key counts from INCR <n> @<key>, and the keys leading them, for TOPK
+    heavy_hitters hitters;
+
+    // OBSERVE/PERCENTILE histograms by name; 58 KiB each, capped like the sketches
+    std::unordered_map<std::string, std::unique_ptr<histogram>> histograms;
+    size_t max_histograms = 1024;
+
+    // PFADD/PFCOUNT sketches by name, apart from the count; 16 KiB each, hence the cap on how many
+    std::unordered_map<std::string, std::unique_ptr<hyperloglog>> distinct;
+    size_t max_distinct = 1024;
+
+    // Which of the nodes sharing out the names above holds each one; names held elsewhere get MOVED
+    shard_map shards;
+
+    // Client connections registered edge-triggered, read until EAGAIN or the end of their turn,
+    // whichever comes first
+    bool edge_triggered = false;
+
+    // Connections with input left over after their turn, waiting for another, in order
+    std::deque<connection*> ready;
+    event_loop::wait_list ready_queued;  // woken when the first one joins
+
+    // Admission control, so overload is turned away up front instead of piling up in our buffers;
+    // zero means no limit. Past max_connections, new clients are told BUSY and hung up on. A client
+    // owing more than max_outbound bytes isn't read from until it has taken half of them, and is hung
+    // up on if it falls 16 times that far behind. Past max_commands_per_second, a connection's
+    // commands are answered BUSY instead of carried out.
+    size_t max_connections = 0;
+    size_t max_outbound = 0;
+    size_t max_commands_per_second = 0;
+    overload_counts overload;
+
+    // Following a leader: the count only changes when the leader's does, and clients' writes are refused
+    bool read_only = false;
+
+    // A member of a Raft cluster: writes go through its log, and reads through its leader's lease
+    raft_cluster* raft = nullptr;
+
+    // Set once we're shutting down: connections that get cancelled flush what they owe their client
+    // (until the deadline) instead of just hanging up, and the loop stops when the last one is gone
+    bool draining = false;
+    event_loop::clock::time_point drain_deadline;
+};
+
+// How much one turn at a connection may take in
+struct read_budget {
+    size_t bytes;     // off the socket
+    size_t commands;  // lines handed back, counting those left from the turn before
+};
+
+// What one turn at a connection picked up: whole lines only, each with its newline
+struct received_lines {
+    std::vector<std::string> lines;
+    bool more = false;    // stopped at a budget, with lines or the socket possibly not drained yet
+    bool closed = false;  // the peer hung up, or the socket failed
+};
+
+// What a pass over the UDP socket picked up; datagrams are never answered
+struct udp_receipt {
+    size_t datagrams = 0;
+    int64_t delta = 0;
+    size_t count_commands = 0;  // INCR/DECR that went into `delta`
+    size_t duplicates = 0;  // commands with a request ID that had already been applied
+    size_t observations = 0;
+    size_t refused = 0;     // INCR/DECR sent to a read-only follower, or to a Raft member that doesn't lead
+    size_t proposed = 0;    // INCR/DECR that went into the Raft log instead of `delta`
+    size_t moved = 0;       // keyed INCR and OBSERVE for names another node holds; there's nobody to redirect
+};
+
+auto listen_on_dual_tcp_socket(uint16_t port) -> resource_handle;
+auto listen_on_dual_udp_socket(uint16_t port) -> resource_handle;
+auto listen_on_unix_socket(std::string const& path, int type) -> resource_handle;
+auto accept_connection(int fd) -> resource_handle;
+auto listen_for_signals(std::initializer_list<int> signals) -> resource_handle;
+auto get_peer_name(int fd) -> std::string;
+auto start_connect(std::string const& host, uint16_t port) -> resource_handle;
+auto connect_error(int fd) -> int;
+auto receive_lines(connection* conn, read_budget budget) -> received_lines;
+auto receive_udp_deltas(server_context* server, int fd) -> udp_receipt;
+auto load_count(std::string const& path) -> versioned_value;
+void save_count(std::string const& path, versioned_value count);
+auto admit_command(server_context* server, connection* conn) -> bool;
+void queue_output(server_context* server, connection* conn, std::string_view bytes);
+void flush_batched_output(server_context* server);
+auto send_batched_output(server_context* server) -> task<>;
+auto serve_ready_connections(server_context* server) -> task<>;
+void send_count(server_context* server, connection* conn, versioned_value count);
+void send_not_leader(server_context* server, connection* conn);
+void broadcast_count(server_context* server, versioned_value count);
+void parse_and_handle(server_context* server, connection* conn, std::string const& command);
+
+auto accept_connections(server_context* server, int listen_socket) -> task<>;
+auto serve_connection(server_context* server, resource_handle handle) -> task<>;
+auto serve_udp(server_context* server, int udp_socket) -> task<>;
+auto accept_http_connections(server_context* server, int listen_socket) -> task<>;
+auto serve_http_connection(server_context* server, resource_handle handle) -> task<>;
+
+#endif  // SERVER_HPP
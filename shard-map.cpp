@@ -0,0 +1,37 @@
+#include "hash.hpp"
+#include "shard-map.hpp"
+
+auto jump_hash(uint64_t key, int32_t buckets) -> int32_t
+{
+    int64_t bucket = -1;
+    int64_t next = 0;
+    while (next < buckets) {
+        bucket = next;
+        key = key * 2862933555777941757ULL + 1;
+        next = int64_t(double(bucket + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+    }
+    return int32_t(bucket);
+}
+
+auto shard_map::owner(std::string_view name) const -> size_t
+{
+    return sharded() ? size_t(jump_hash(murmur64(name), int32_t(nodes.size()))) : self;
+}
+
+auto shard_map::common_owner(std::span<std::string const> names) const -> std::optional<size_t>
+{
+    auto first = names.empty() ? self : owner(names.front());
+    for (auto const& name : names) {
+        if (owner(name) != first) {
+            return std::nullopt;
+        }
+    }
+    return first;
+}
+
+auto shard_map::address(size_t node) const -> std::string
+{
+    auto const& at = nodes[node];
+    auto bracketed = at.host.find(':') != std::string::npos;
+    return (bracketed ? "[" + at.host + "]" : at.host) + ":" + std::to_string(at.port);
+}
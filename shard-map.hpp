@@ -0,0 +1,54 @@
+#ifndef SHARD_MAP_HPP
+#define SHARD_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "options.hpp"
+
+// Which node holds each named sketch, histogram and keyed count, when several servers share them out
+
+// Names are placed by jump consistent hashing (Lamping and Veach, 2014) of their MurmurHash: no table
+// to keep in step, an even spread, and growing the cluster from N to N+1 nodes moves only about a
+// 1/(N+1) share of the names, all of them onto the new node. That only holds for nodes added at the
+// end of the list: every node has to be given the same list in the same order, and taking one out
+// of the middle reshuffles everything after it.
+//
+// The node that gets a name it doesn't hold answers with where to go instead (MOVED, as Redis
+// Cluster does) rather than forwarding it, so a client that keeps its own copy of the list goes
+// straight to the right node and pays nothing extra. The count itself isn't sharded: every node
+// keeps its own.
+
+class shard_map {
+public:
+    shard_map() = default;  // one node, which is us and holds everything
+    shard_map(std::vector<peer_address> nodes, size_t self) : nodes(std::move(nodes)), self(self) {}
+
+    auto sharded() const -> bool { return nodes.size() > 1; }
+    auto size() const -> size_t { return nodes.empty() ? 1 : nodes.size(); }
+    auto self_node() const -> size_t { return self; }
+
+    auto owner(std::string_view name) const -> size_t;
+    auto is_local(std::string_view name) const -> bool { return !sharded() || owner(name) == self; }
+
+    // The one node holding every name given, or nullopt when they're spread over several
+    auto common_owner(std::span<std::string const> names) const -> std::optional<size_t>;
+
+    // "host:port", as clients would dial it
+    auto address(size_t node) const -> std::string;
+
+private:
+    std::vector<peer_address> nodes;
+    size_t self = 0;
+};
+
+// Jump consistent hash: which of `buckets` buckets a key goes to
+auto jump_hash(uint64_t key, int32_t buckets) -> int32_t;
+
+#endif  // SHARD_MAP_HPP
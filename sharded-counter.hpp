@@ -0,0 +1,178 @@
+#ifndef SHARDED_COUNTER_HPP
+#define SHARDED_COUNTER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// A counter split into one slot per worker thread
+
+// A single int64_t is fine as long as one thread owns it, but as soon as several threads are adding
+// to it the cache line holding it starts bouncing between cores and every increment pays for a trip
+// across the interconnect. Instead, each worker gets its own cache line and only ever writes to that;
+// readers pay for the aggregation by summing every slot, which is cheap because reads are rare next
+// to increments.
+//
+// Each slot is owned by exactly one thread: add() is a plain load and store, not a read-modify-write,
+// so two threads must never share a worker index.
+//
+// Every slot also carries an epoch that the owner bumps around each write, seqlock style (odd while a
+// write is in flight, even otherwise). total() ignores it and may combine slots from slightly
+// different moments, which is fine for log lines and rates; snapshot() uses it to collect every slot
+// twice and only returns once nothing moved in between, which makes the sum a value the counter
+// really held at some instant during the call.
+//
+// The epochs double as a version: half their sum goes up by one with every add(), on any worker, so
+// versioned_snapshot() can say which state of the counter it saw without any shared write to keep
+// track. add_if() is the conditional flavour of add(): it holds its own slot's epoch odd while it
+// looks at everybody else's, which keeps snapshots out for the duration and makes check-and-add one
+// step, as long as only one worker ever calls it.
+
+constexpr size_t cache_line_size = 64;  // std::hardware_destructive_interference_size is not ABI-stable
+
+struct versioned_value {
+    int64_t value;
+    uint64_t version;
+};
+
+class sharded_counter {
+public:
+    explicit sharded_counter(size_t workers)
+      : slots(std::make_unique<slot[]>(workers ? workers : 1)),
+        slot_count(workers ? workers : 1)
+    {}
+
+    auto workers() const noexcept -> size_t { return slot_count; }
+
+    void add(size_t worker, int64_t delta) noexcept
+    {
+        auto& s = slots[worker];
+        auto epoch = s.epoch.load(std::memory_order_relaxed);
+
+        s.epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.value.store(s.value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        s.epoch.store(epoch + 2, std::memory_order_release);
+    }
+
+    // Cheap, but possibly torn across slots while other workers are writing
+    auto total() const noexcept -> int64_t
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < slot_count; ++i) {
+            sum += slots[i].value.load(std::memory_order_relaxed);
+        }
+
+        return sum;
+    }
+
+    // Linearizable: retries until a full pass over the slots saw no writes start or finish
+    auto snapshot() const noexcept -> int64_t { return versioned_snapshot().value; }
+
+    auto versioned_snapshot() const noexcept -> versioned_value
+    {
+        for (;;) {
+            if (auto seen = collect(slot_count)) {
+                return *seen;
+            }
+        }
+    }
+
+    // `decide` gets the counter's value and version and returns the delta to apply, or nullopt to
+    // leave it alone; either way the result is what it decided on, and whether anything was added.
+    // Only ever call this from one worker.
+    template <typename Decide>
+    auto add_if(size_t worker, Decide&& decide) -> std::pair<versioned_value, bool>
+    {
+        auto& s = slots[worker];
+        auto epoch = s.epoch.load(std::memory_order_relaxed);
+        auto own = s.value.load(std::memory_order_relaxed);
+
+        s.epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // odd before we look at anybody else
+
+        std::optional<versioned_value> others;
+        while (!(others = collect(worker))) {}
+
+        auto seen = versioned_value { others->value + own, others->version + epoch / 2 };
+        auto delta = std::optional<int64_t>(decide(seen));
+        if (!delta) {
+            // Nothing changed, so neither does the version; readers that saw the odd epoch retried
+            s.epoch.store(epoch, std::memory_order_release);
+            return { seen, false };
+        }
+
+        s.value.store(own + *delta, std::memory_order_relaxed);
+        s.epoch.store(epoch + 2, std::memory_order_release);
+        return { seen, true };
+    }
+
+    // Makes the counter read `value` at `version`, whatever it read before: how a follower mirrors its
+    // leader. Only for when `worker` is the one thread touching the counter at all, since the version
+    // may go backwards (the leader restarted) and readers on other threads rely on epochs growing.
+    void assign(size_t worker, int64_t value, uint64_t version) noexcept
+    {
+        auto others = collect(worker);  // can't be torn: nobody else writes
+        auto& s = slots[worker];
+        s.value.store(value - others->value, std::memory_order_relaxed);
+        s.epoch.store((version - std::min(version, others->version)) * 2, std::memory_order_release);
+    }
+
+    // For loading saved state before any worker starts; `version` carries on where it left off
+    void restore(int64_t value, uint64_t version) noexcept
+    {
+        slots[0].value.store(value, std::memory_order_relaxed);
+        slots[0].epoch.store(version * 2, std::memory_order_relaxed);
+    }
+
+private:
+    // One double-collect over every slot but `skip` (slot_count skips none); nullopt if a write got in
+    // the way
+    auto collect(size_t skip) const noexcept -> std::optional<versioned_value>
+    {
+        bool stable = true;
+        uint64_t epoch_sum = 0;
+        for (size_t i = 0; i < slot_count; ++i) {
+            if (i == skip) continue;
+
+            auto epoch = slots[i].epoch.load(std::memory_order_acquire);
+            stable &= (epoch % 2 == 0);
+            epoch_sum += epoch;
+        }
+
+        int64_t sum = 0;
+        for (size_t i = 0; i < slot_count; ++i) {
+            if (i == skip) continue;
+            sum += slots[i].value.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        uint64_t check = 0;
+        for (size_t i = 0; i < slot_count; ++i) {
+            if (i == skip) continue;
+            check += slots[i].epoch.load(std::memory_order_relaxed);
+        }
+
+        // epochs only ever grow, so the sums match exactly when no single epoch changed (add_if may
+        // step its own back down from odd, but never with the value changed, so that's harmless)
+        if (!stable || epoch_sum != check) {
+            return std::nullopt;
+        }
+
+        return versioned_value { sum, epoch_sum / 2 };
+    }
+
+    struct alignas(cache_line_size) slot {
+        std::atomic<int64_t>  value = 0;
+        std::atomic<uint64_t> epoch = 0;
+    };
+
+    std::unique_ptr<slot[]> slots;
+    size_t slot_count;
+};
+
+#endif  // SHARDED_COUNTER_HPP
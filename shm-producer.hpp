@@ -0,0 +1,171 @@
+#ifndef SHM_PRODUCER_HPP
+#define SHM_PRODUCER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "posix-resource-handle.hpp"
+#include "shm-ring.hpp"
+
+// Client side of the shared-memory transport, for producers that live on the same host
+
+// Header-only so producers can drop it into their own build. attach() connects to the server's
+// --shm-socket, receives the region and the wakeup eventfd, and claims a ring; the ring stays ours
+// for as long as the attach socket stays open, so destroying the producer gives it back.
+//
+// add() costs a store, a fence and a load, plus one eventfd write when the server has gone to sleep.
+
+class shm_producer {
+public:
+    static auto attach(std::string const& path) -> shm_producer
+    {
+        auto connection = resource_handle(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+        if (connection.get().fd < 0) {
+            connection.release();
+            throw_system_error();
+        }
+
+        auto addr = sockaddr_un { .sun_family = AF_UNIX };
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::system_error(std::make_error_code(std::errc::filename_too_long), path);
+        }
+        path.copy(addr.sun_path, path.size());
+
+        if (connect(connection.get().fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            throw_system_error();
+        }
+
+        auto reply = shm::attach_reply{};
+        auto iov = iovec { &reply, sizeof(reply) };
+        alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+        auto msg = msghdr {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+
+        if (recvmsg(connection.get().fd, &msg, MSG_CMSG_CLOEXEC) != ssize_t(sizeof(reply))) {
+            throw std::system_error(std::make_error_code(std::errc::protocol_error), "shm attach");
+        }
+
+        if (reply.ring_index == shm::no_ring) {
+            throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "no free shm ring");
+        }
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+            throw std::system_error(std::make_error_code(std::errc::protocol_error), "shm attach");
+        }
+
+        int fds[2];
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        auto memory = resource_handle(fds[0]);
+        auto wakeup = resource_handle(fds[1]);
+
+        auto size = shm::region_size(reply.ring_count);
+        auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory.get().fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw_system_error();
+        }
+
+        auto producer = shm_producer(std::move(connection), std::move(wakeup), mapping, size, reply.ring_index);
+        if (producer.header->magic != shm::region_magic) {
+            throw std::system_error(std::make_error_code(std::errc::protocol_error), "shm region magic");
+        }
+
+        return producer;
+    }
+
+    shm_producer(shm_producer&& other) noexcept
+      : connection(std::move(other.connection)),
+        wakeup(std::move(other.wakeup)),
+        mapping(std::exchange(other.mapping, nullptr)),
+        mapping_size(other.mapping_size),
+        header(other.header),
+        ring(other.ring),
+        tail(other.tail)
+    {}
+
+    shm_producer& operator=(shm_producer&& other) noexcept
+    {
+        std::swap(connection, other.connection);
+        std::swap(wakeup, other.wakeup);
+        std::swap(mapping, other.mapping);
+        std::swap(mapping_size, other.mapping_size);
+        std::swap(header, other.header);
+        std::swap(ring, other.ring);
+        std::swap(tail, other.tail);
+        return *this;
+    }
+
+    ~shm_producer()
+    {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+        }
+    }
+
+    // Returns false if the ring is full
+    auto try_add(int64_t delta) noexcept -> bool
+    {
+        if (tail - ring->head.load(std::memory_order_acquire) >= shm::ring_capacity) {
+            return false;
+        }
+
+        ring->records[tail % shm::ring_capacity] = delta;
+        ring->tail.store(++tail, std::memory_order_release);
+
+        // Pairs with the fence the server issues between announcing it's asleep and re-checking the
+        // rings; one of us is guaranteed to see the other's store. Clearing the flag means only the
+        // first producer to notice pays for the eventfd write, not every record until the server runs.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header->server_sleeping.load(std::memory_order_relaxed) &&
+            header->server_sleeping.exchange(0, std::memory_order_relaxed))
+        {
+            uint64_t one = 1;
+            [[maybe_unused]] auto ret = write(wakeup.get().fd, &one, sizeof(one));
+        }
+
+        return true;
+    }
+
+    // Waits for the server to make room if the ring is full
+    void add(int64_t delta) noexcept
+    {
+        while (!try_add(delta)) {
+            sched_yield();
+        }
+    }
+
+private:
+    shm_producer(resource_handle connection, resource_handle wakeup, void* mapping, size_t mapping_size, uint32_t index)
+      : connection(std::move(connection)),
+        wakeup(std::move(wakeup)),
+        mapping(mapping),
+        mapping_size(mapping_size),
+        header(static_cast<shm::region_header*>(mapping)),
+        ring(shm::ring_at(mapping, index)),
+        tail(ring->tail.load(std::memory_order_relaxed))
+    {}
+
+    resource_handle connection;  // holding this open is what keeps our ring reserved
+    resource_handle wakeup;
+    void* mapping;
+    size_t mapping_size;
+    shm::region_header* header;
+    shm::ring* ring;
+    uint64_t tail;  // private copy; we're the only writer
+};
+
+#endif  // SHM_PRODUCER_HPP
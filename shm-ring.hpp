@@ -0,0 +1,72 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "sharded-counter.hpp"
+
+// Layout of the shared-memory region used by co-located producers
+
+// The region is a memfd the server creates once and hands to every producer (together with an
+// eventfd) over a Unix seqpacket socket. It starts with a small header and is followed by a fixed
+// number of single-producer/single-consumer rings; each attached producer is given one ring of its
+// own, so the only thing the producer and the server ever share is that ring's head and tail.
+//
+// A record is simply the signed delta to apply to the count. The server drains every ring in
+// batches, sums what it found, and applies the sum with a single counter update.
+//
+// Everything in here is read and written by two processes at once, so it must stay trivially
+// copyable and only use lock-free atomics.
+
+namespace shm {
+
+constexpr uint32_t region_magic  = 0x434e5452;  // "CNTR"
+constexpr uint32_t ring_capacity = 4096;        // records per ring, must be a power of two
+
+static_assert((ring_capacity & (ring_capacity - 1)) == 0, "ring capacity must be a power of two");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must not need a lock");
+
+enum ring_state : uint32_t {
+    ring_free,      // nobody is using this ring
+    ring_attached,  // a producer holds this ring
+    ring_detached,  // the producer went away; the server frees the ring once it's drained
+};
+
+struct alignas(cache_line_size) region_header {
+    uint32_t magic;
+    uint32_t ring_count;
+
+    // Set by the server just before it blocks on the eventfd; producers that see it must wake it up
+    alignas(cache_line_size) std::atomic<uint32_t> server_sleeping;
+};
+
+struct alignas(cache_line_size) ring {
+    alignas(cache_line_size) std::atomic<uint64_t> head;   // written only by the server
+    alignas(cache_line_size) std::atomic<uint64_t> tail;   // written only by the producer
+    alignas(cache_line_size) std::atomic<uint32_t> state;  // see ring_state
+    alignas(cache_line_size) int64_t records[ring_capacity];
+};
+
+// What the server sends back on the attach socket, next to the memfd and eventfd
+struct attach_reply {
+    uint32_t ring_index;  // no_ring if every ring is taken
+    uint32_t ring_count;
+};
+
+constexpr uint32_t no_ring = UINT32_MAX;
+
+constexpr auto region_size(uint32_t ring_count) -> size_t
+{
+    return sizeof(region_header) + size_t(ring_count) * sizeof(ring);
+}
+
+inline auto ring_at(void* region, uint32_t index) -> ring*
+{
+    return reinterpret_cast<ring*>(static_cast<char*>(region) + sizeof(region_header)) + index;
+}
+
+}  // namespace shm
+
+#endif  // SHM_RING_HPP
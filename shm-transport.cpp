@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "shm-transport.hpp"
+
+namespace {
+
+// Upper bound on records taken from one ring per pass, so one busy producer can't starve the rest
+constexpr uint64_t batch_limit = 1024;
+
+auto make_eventfd(int flags) -> resource_handle
+{
+    auto fd = resource_handle(eventfd(0, EFD_CLOEXEC | flags));
+    if (fd.get().fd < 0) {
+        fd.release();
+        throw_system_error();
+    }
+
+    return fd;
+}
+
+}  // namespace
+
+shm_transport::shm_transport(sharded_counter* count, size_t worker, uint32_t ring_count)
+  : count(count),
+    worker(worker),
+    ring_count(ring_count),
+    memory(memfd_create("counting-server-shm", MFD_CLOEXEC)),
+    wakeup(make_eventfd(0)),
+    updated(make_eventfd(EFD_NONBLOCK))
+{
+    if (memory.get().fd < 0) {
+        memory.release();
+        throw_system_error();
+    }
+
+    auto size = shm::region_size(ring_count);
+    if (ftruncate(memory.get().fd, off_t(size)) < 0) {
+        throw_system_error();
+    }
+
+    region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory.get().fd, 0);
+    if (region == MAP_FAILED) {
+        region = nullptr;
+        throw_system_error();
+    }
+
+    // ftruncate zero-filled everything, which is already a valid empty state for the atomics
+    auto header = static_cast<shm::region_header*>(region);
+    header->magic = shm::region_magic;
+    header->ring_count = ring_count;
+
+    drainer = std::thread([this] { drain_loop(); });
+}
+
+shm_transport::~shm_transport()
+{
+    stop();
+    munmap(region, shm::region_size(ring_count));
+}
+
+void shm_transport::stop()
+{
+    if (!drainer.joinable()) {
+        return;
+    }
+
+    stopping = true;
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = write(wakeup.get().fd, &one, sizeof(one));
+    drainer.join();
+
+    // The thread is gone, so its slot is ours to finish filling
+    while (drain_once()) {}
+}
+
+auto shm_transport::accept_producer(int listen_socket) -> resource_handle
+{
+    auto connection = resource_handle(accept4(listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+    if (connection.get().fd < 0) {
+        perror("Failed to accept shm producer");
+        connection.release();
+        return nullptr;
+    }
+
+    auto reply = shm::attach_reply { shm::no_ring, ring_count };
+    for (uint32_t i = 0; i < ring_count; ++i) {
+        auto expected = uint32_t(shm::ring_free);
+        if (shm::ring_at(region, i)->state.compare_exchange_strong(expected, shm::ring_attached)) {
+            reply.ring_index = i;
+            break;
+        }
+    }
+
+    auto iov = iovec { &reply, sizeof(reply) };
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    auto msg = msghdr { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (reply.ring_index != shm::no_ring) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+
+        int fds[2] = { memory.get().fd, wakeup.get().fd };
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    if (sendmsg(connection.get().fd, &msg, MSG_NOSIGNAL) < 0) {
+        perror("Failed to hand shm region to producer");
+        if (reply.ring_index != shm::no_ring) {
+            shm::ring_at(region, reply.ring_index)->state.store(shm::ring_free);
+        }
+        return nullptr;
+    }
+
+    if (reply.ring_index == shm::no_ring) {
+        fprintf(stderr, "Turned away shm producer: all %u rings are in use\n", ring_count);
+        return nullptr;
+    }
+
+    fprintf(stderr, "shm producer attached to ring %u\n", reply.ring_index);
+    producers.emplace(connection.get().fd, reply.ring_index);
+    return connection;
+}
+
+void shm_transport::detach_producer(int fd)
+{
+    auto it = producers.find(fd);
+    if (it == producers.end()) {
+        return;
+    }
+
+    // The drain thread finishes off whatever is still queued and then frees the ring
+    shm::ring_at(region, it->second)->state.store(shm::ring_detached, std::memory_order_release);
+    fprintf(stderr, "shm producer detached from ring %u\n", it->second);
+    producers.erase(it);
+
+    uint64_t one = 1;
+    [[maybe_unused]] auto ret = write(wakeup.get().fd, &one, sizeof(one));
+}
+
+void shm_transport::clear_updates()
+{
+    uint64_t value;
+    [[maybe_unused]] auto ret = read(updated.get().fd, &value, sizeof(value));
+}
+
+auto shm_transport::drain_once() -> uint64_t
+{
+    uint64_t drained = 0;
+    int64_t sum = 0;
+
+    for (uint32_t i = 0; i < ring_count; ++i) {
+        auto ring = shm::ring_at(region, i);
+        auto state = ring->state.load(std::memory_order_acquire);
+        if (state == shm::ring_free) {
+            continue;
+        }
+
+        auto head = ring->head.load(std::memory_order_relaxed);
+        auto tail = ring->tail.load(std::memory_order_acquire);
+        auto end = std::min(tail, head + batch_limit);
+
+        for (auto pos = head; pos != end; ++pos) {
+            sum += ring->records[pos % shm::ring_capacity];
+        }
+
+        drained += end - head;
+        ring->head.store(end, std::memory_order_release);
+
+        if (state == shm::ring_detached && end == tail) {
+            ring->head.store(0, std::memory_order_relaxed);
+            ring->tail.store(0, std::memory_order_relaxed);
+            ring->state.store(shm::ring_free, std::memory_order_release);
+        }
+    }
+
+    if (drained) {
+        count->add(worker, sum);
+
+        uint64_t one = 1;
+        [[maybe_unused]] auto ret = write(updated.get().fd, &one, sizeof(one));
+    }
+
+    return drained;
+}
+
+void shm_transport::drain_loop()
+{
+    auto header = static_cast<shm::region_header*>(region);
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (drain_once()) {
+            continue;
+        }
+
+        // Announce that we're about to sleep, then look once more: a producer that published before
+        // seeing the flag is caught by this pass, and one that publishes after will see it and wake us
+        header->server_sleeping.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!drain_once() && !stopping.load(std::memory_order_relaxed)) {
+            uint64_t value;
+            if (read(wakeup.get().fd, &value, sizeof(value)) < 0 && errno != EINTR) {
+                perror("Failed to wait for shm producers");
+            }
+        }
+
+        header->server_sleeping.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef SHM_TRANSPORT_HPP
+#define SHM_TRANSPORT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+
+#include "posix-resource-handle.hpp"
+#include "sharded-counter.hpp"
+#include "shm-ring.hpp"
+
+// Server side of the shared-memory transport (see shm-ring.hpp for the layout)
+
+// Producers attach through a Unix seqpacket socket, which the event loop accepts like any other
+// listener; accept_producer() hands the new producer the region and a ring, and the returned handle
+// should be watched for hang-ups so the ring can be released with detach_producer().
+//
+// A dedicated thread drains the rings into its own slot of the counter. When it applies a batch it
+// bumps the `updates` eventfd, so the event loop can broadcast the new value from its own thread;
+// several batches landing between two loop iterations coalesce into a single broadcast.
+
+class shm_transport {
+public:
+    shm_transport(sharded_counter* count, size_t worker, uint32_t ring_count);
+    ~shm_transport();
+
+    shm_transport(shm_transport const&) = delete;
+    shm_transport& operator=(shm_transport const&) = delete;
+
+    // Stops the drain thread after one last pass, so nothing a producer already queued is lost;
+    // the destructor does the same if nobody called it first
+    void stop();
+
+    auto accept_producer(int listen_socket) -> resource_handle;
+    void detach_producer(int fd);
+    auto is_producer(int fd) const -> bool { return producers.contains(fd); }
+
+    // Readable whenever the drain thread changed the count since the last clear_updates()
+    auto updates() const -> resource_handle const& { return updated; }
+    void clear_updates();
+
+private:
+    void drain_loop();
+    auto drain_once() -> uint64_t;
+
+    sharded_counter* count;
+    size_t worker;
+    uint32_t ring_count;
+
+    resource_handle memory;
+    resource_handle wakeup;
+    resource_handle updated;
+    void* region = nullptr;
+
+    std::unordered_map<int, uint32_t> producers;  // attach socket -> ring; event loop thread only
+    std::atomic<bool> stopping = false;
+    std::thread drainer;
+};
+
+#endif  // SHM_TRANSPORT_HPP
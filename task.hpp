@@ -0,0 +1,138 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "frame-pool.hpp"
+
+// Coroutine types for code running on the event loop
+
+// task<T> is lazy: nothing runs until somebody co_awaits it, at which point the awaiting coroutine
+// is suspended until the task finishes and gets the result (or the exception) back. spawn() starts a
+// task<> that nobody is waiting for; it runs until its first suspension and cleans up after itself
+// when it finishes. Frames for both come from the frame pool.
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+// Finishing a task hands control straight to whoever was awaiting it
+struct resume_continuation {
+    auto await_ready() noexcept -> bool { return false; }
+    void await_resume() noexcept {}
+
+    template <typename Promise>
+    auto await_suspend(std::coroutine_handle<Promise> self) noexcept -> std::coroutine_handle<>
+    {
+        return self.promise().continuation;
+    }
+};
+
+struct task_promise_base : pooled_frame {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+
+    auto final_suspend() noexcept -> resume_continuation { return {}; }
+
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct task_promise : task_promise_base {
+    std::optional<T> value;
+
+    auto get_return_object() -> task<T>;
+    void return_value(T v) { value = std::move(v); }
+
+    auto result() -> T
+    {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+    auto get_return_object() -> task<void>;
+    void return_void() noexcept {}
+
+    void result()
+    {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+}  // namespace detail
+
+template <typename T>
+class [[nodiscard]] task {
+public:
+    using promise_type = detail::task_promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    task& operator=(task&& other) noexcept { std::swap(handle, other.handle); return *this; }
+    ~task() { if (handle) handle.destroy(); }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            auto await_ready() noexcept -> bool { return false; }
+
+            auto await_suspend(std::coroutine_handle<> awaiting) noexcept -> std::coroutine_handle<>
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            auto await_resume() -> T { return handle.promise().result(); }
+        };
+
+        return awaiter { handle };
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+auto task_promise<T>::get_return_object() -> task<T>
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline auto task_promise<void>::get_return_object() -> task<void>
+{
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// Eagerly started, owns itself, and frees its frame when done; exceptions escape to whoever
+// resumed it last, which is the event loop, which lets them take the process down
+struct detached {
+    struct promise_type : pooled_frame {
+        auto get_return_object() noexcept -> detached { return {}; }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { throw; }
+    };
+};
+
+}  // namespace detail
+
+inline void spawn(task<> t)
+{
+    [](task<> t) -> detail::detached { co_await std::move(t); }(std::move(t));
+}
+
+#endif  // TASK_HPP
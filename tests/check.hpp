@@ -0,0 +1,70 @@
+#ifndef TESTS_CHECK_HPP
+#define TESTS_CHECK_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <source_location>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough of a test harness for tests that drive the server's pieces directly: each test file is
+// its own executable, registered with CTest, that runs its tests in order and exits non-zero if any
+// check failed. No framework: nothing here needs more than the standard library and POSIX.
+
+namespace test {
+
+inline int failures = 0;
+
+inline void check(bool ok, char const* what, std::source_location where = std::source_location::current())
+{
+    if (!ok) {
+        fprintf(stderr, "%s:%u: check failed: %s\n", where.file_name(), where.line(), what);
+        ++failures;
+    }
+}
+
+// A fresh directory for whatever a test wants to keep on disk, removed (with everything in it) at the end
+class scratch_directory {
+public:
+    scratch_directory()
+    {
+        char pattern[] = "/tmp/counting-server-test.XXXXXX";
+        if (!mkdtemp(pattern)) {
+            perror("Failed to create a scratch directory");
+            exit(EXIT_FAILURE);
+        }
+        path = pattern;
+    }
+
+    ~scratch_directory()
+    {
+        auto command = "rm -rf '" + path + "'";
+        if (system(command.c_str()) != 0) {
+            fprintf(stderr, "Failed to remove %s\n", path.c_str());
+        }
+    }
+
+    scratch_directory(scratch_directory const&) = delete;
+    auto operator=(scratch_directory const&) -> scratch_directory& = delete;
+
+    auto operator/(std::string const& name) const -> std::string { return path + "/" + name; }
+
+    std::string path;
+};
+
+// Runs each test in order and reports on each; the return value is main()'s
+inline auto run(std::vector<std::pair<char const*, void(*)()>> const& tests) -> int
+{
+    for (auto [name, body] : tests) {
+        auto before = failures;
+        body();
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", name);
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+}  // namespace test
+
+#endif  // TESTS_CHECK_HPP
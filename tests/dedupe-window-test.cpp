@@ -0,0 +1,170 @@
+// dedupe_window's verdicts as a client's sequence numbers arrive in order, out of order, repeated,
+// and too far behind; the window sliding by less than a word, by words, and past its end; the cap on
+// clients; and the text form Raft snapshots carry.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "dedupe-window.hpp"
+
+namespace {
+
+using verdict = dedupe_window::verdict;
+
+void fresh_then_duplicate()
+{
+    auto window = dedupe_window(16);
+    test::check(window.check("a", 1) == verdict::fresh, "the first ID is fresh");
+    test::check(window.check("a", 1) == verdict::duplicate, "and a duplicate the second time");
+    test::check(window.check("a", 2) == verdict::fresh, "the next is fresh");
+    test::check(window.check("b", 1) == verdict::fresh, "clients don't share numbers");
+    test::check(window.clients() == 2, "two clients");
+}
+
+// A client's first ID can be anything, 0 included, and 0 is remembered like any other
+void starts_anywhere()
+{
+    auto window = dedupe_window(16);
+    test::check(window.check("a", 0) == verdict::fresh, "0 first");
+    test::check(window.check("a", 0) == verdict::duplicate, "0 again");
+
+    test::check(window.check("b", 1000000) == verdict::fresh, "a million first");
+    test::check(window.check("b", 999999) == verdict::fresh, "just below it hasn't been seen");
+    test::check(window.check("b", 999999) == verdict::duplicate, "until it has");
+}
+
+// Retries arriving after newer IDs are still recognised, anywhere in the window
+void out_of_order()
+{
+    auto window = dedupe_window(16);
+    for (uint64_t sequence : { 10, 5, 70, 64, 7 }) {
+        test::check(window.check("a", sequence) == verdict::fresh, "each is new");
+    }
+    for (uint64_t sequence : { 10, 5, 70, 64, 7 }) {
+        test::check(window.check("a", sequence) == verdict::duplicate, "and seen the second time, after the window slid");
+    }
+    test::check(window.check("a", 6) == verdict::fresh, "while the gaps between them are still open");
+}
+
+// Exactly `window` IDs are remembered: the highest and the window - 1 below it
+void window_edges()
+{
+    constexpr auto size = dedupe_window::window;
+    auto window = dedupe_window(16);
+    window.check("a", size);
+    test::check(window.check("a", 1) == verdict::fresh, "the oldest number the window holds is open");
+    test::check(window.check("a", 1) == verdict::duplicate, "and remembered");
+    test::check(window.check("a", 0) == verdict::too_old, "one below it is too old");
+
+    window.check("a", 2 * size);
+    test::check(window.check("a", size) == verdict::too_old, "sliding by a whole window forgets everything");
+    test::check(window.check("a", size + 1) == verdict::fresh, "with its bottom open again");
+}
+
+// Slides that move bits across word boundaries, and by whole words, keep every seen number seen
+void slides_keep_what_was_seen()
+{
+    for (uint64_t step : { 1, 3, 63, 64, 65, 128, 200, 1000 }) {
+        auto window = dedupe_window(16);
+        window.check("a", 100);
+        window.check("a", 99);
+        window.check("a", 37);
+        window.check("a", 100 + step);
+        auto in_window = [&](uint64_t sequence) { return 100 + step - sequence < dedupe_window::window; };
+
+        for (uint64_t sequence : { 100, 99, 37 }) {
+            auto expected = in_window(sequence) ? verdict::duplicate : verdict::too_old;
+            test::check(window.check("a", sequence) == expected, "what was seen is still seen, or too old");
+        }
+        if (in_window(98)) {
+            test::check(window.check("a", 98) == verdict::fresh, "what wasn't seen is still open");
+        }
+    }
+}
+
+// Past the cap the client heard from least recently is forgotten; hearing from one keeps it
+void forgets_least_recent_client()
+{
+    auto window = dedupe_window(2);
+    window.check("a", 1);
+    window.check("b", 1);
+    window.check("a", 2);  // b is now the least recent
+    window.check("c", 1);
+    test::check(window.clients() == 2, "never more than the cap");
+    test::check(window.check("a", 1) == verdict::duplicate, "a was kept");
+    test::check(window.check("b", 1) == verdict::fresh, "b was forgotten, so its retry looks new");
+
+    test::check(dedupe_window(0).check("x", 1) == verdict::fresh, "a cap of 0 still holds one client");
+}
+
+// save() and restore() carry every verdict over, and the order clients are forgotten in
+void round_trips_as_text()
+{
+    auto window = dedupe_window(3);
+    window.check("a", 5);
+    window.check("a", 900);
+    window.check("b", 2);
+    window.check("c", 4000);
+    window.check("c", 3990);
+
+    auto saved = std::string();
+    window.save(saved);
+
+    auto restored = dedupe_window(3);
+    test::check(restored.restore(saved), "what save() writes restores");
+    test::check(restored.clients() == 3, "every client");
+    test::check(restored.check("a", 5) == verdict::duplicate && restored.check("a", 900) == verdict::duplicate, "a's IDs");
+    test::check(restored.check("a", 6) == verdict::fresh, "and only those");
+    test::check(restored.check("c", 3990) == verdict::duplicate && restored.check("c", 4000) == verdict::duplicate, "c's");
+    test::check(restored.check("c", 2000) == verdict::too_old, "and c's window");
+
+    restored.check("d", 1);
+    test::check(restored.check("b", 2) == verdict::fresh, "b was the least recent, so it's the one forgotten");
+
+    auto smaller = dedupe_window(1);
+    test::check(smaller.restore(saved) && smaller.clients() == 1, "restoring into a smaller cap keeps the most recent");
+    test::check(smaller.check("c", 4000) == verdict::duplicate, "which is c");
+
+    auto empty = std::string();
+    dedupe_window(4).save(empty);
+    test::check(empty.empty() && dedupe_window(4).restore(""), "an empty window is empty text");
+}
+
+void refuses_broken_text()
+{
+    auto word = std::string(16, '0');
+    word.back() = '1';
+    for (auto const& text : std::vector<std::string> {
+             "a",
+             "a 5",
+             "a x " + word,
+             "a 5 1",
+             "a 5 " + word + "0",
+             "a 5 " + std::string(16, 'g'),
+             "a 5 " + std::string(17 * 16, '0'),
+             std::string(dedupe_window::max_client_name + 1, 'n') + " 5 " + word,
+         }) {
+        auto window = dedupe_window(4);
+        window.check("kept", 1);
+        test::check(!window.restore(text), text.c_str());
+        test::check(window.check("kept", 1) == verdict::duplicate, "and what was there stays");
+    }
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "fresh_then_duplicate",        fresh_then_duplicate },
+        { "starts_anywhere",             starts_anywhere },
+        { "out_of_order",                out_of_order },
+        { "window_edges",                window_edges },
+        { "slides_keep_what_was_seen",   slides_keep_what_was_seen },
+        { "forgets_least_recent_client", forgets_least_recent_client },
+        { "round_trips_as_text",         round_trips_as_text },
+        { "refuses_broken_text",         refuses_broken_text },
+    });
+}
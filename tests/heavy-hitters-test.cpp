@@ -0,0 +1,166 @@
+// heavy_hitters: estimates that never fall below the truth, the leaders kept in order as keys come
+// and go past the capacity, keys cut at max_key_length, and counts that stick at the top rather
+// than wrap.
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "check.hpp"
+#include "heavy-hitters.hpp"
+
+namespace {
+
+// Leaders highest first, each key once
+auto well_ordered(heavy_hitters const& sketch, size_t n) -> bool
+{
+    auto leaders = sketch.top(n);
+    auto keys = std::set<std::string>();
+    for (size_t i = 0; i < leaders.size(); ++i) {
+        if ((i > 0 && leaders[i - 1].second < leaders[i].second) || !keys.insert(leaders[i].first).second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void counts_a_few_keys_exactly()
+{
+    auto sketch = heavy_hitters(8);
+    sketch.add("a", 5);
+    sketch.add("b", 2);
+    test::check(sketch.add("a", 1) == 6, "add returns the new estimate");
+    test::check(sketch.estimate("a") == 6 && sketch.estimate("b") == 2, "few keys barely collide");
+    test::check(sketch.estimate("never") == 0, "a key never added is 0");
+
+    auto leaders = sketch.top(8);
+    test::check(leaders.size() == 2, "only the keys there are");
+    test::check(leaders[0] == std::pair(std::string("a"), uint64_t(6)) && leaders[1] == std::pair(std::string("b"), uint64_t(2)),
+        "highest first");
+    test::check(sketch.top(1).size() == 1 && sketch.top(0).empty(), "and no more than asked for");
+}
+
+// Many keys, random amounts: no estimate is below its key's true count, and the leaders stay in order
+void never_underestimates()
+{
+    auto sketch = heavy_hitters(16);
+    auto truth = std::unordered_map<std::string, uint64_t>();
+    auto random = std::mt19937(7);
+    for (int i = 0; i < 200000; ++i) {
+        auto key = "key-" + std::to_string(random() % 50000);
+        auto delta = random() % 10 + 1;
+        truth[key] += delta;
+        sketch.add(key, delta);
+    }
+
+    auto under = 0;
+    for (auto const& [key, count] : truth) {
+        under += sketch.estimate(key) < count;
+    }
+    test::check(under == 0, "estimates are never low");
+    test::check(well_ordered(sketch, 16), "the leaders are in order, each once");
+}
+
+// Keys much heavier than the rest are the leaders, whenever they turn up
+void finds_the_heavy_keys()
+{
+    auto sketch = heavy_hitters(4);
+    auto random = std::mt19937(11);
+    for (int i = 0; i < 100000; ++i) {
+        sketch.add("light-" + std::to_string(random() % 10000), 1);
+        if (i > 50000 && i % 10 == 0) {
+            sketch.add("heavy-" + std::to_string(i % 40 / 10), 10);
+        }
+    }
+
+    auto leaders = sketch.top(4);
+    test::check(leaders.size() == 4, "as many leaders as there's room for");
+    for (auto const& [key, count] : leaders) {
+        test::check(key.starts_with("heavy-"), "every leader is a heavy key, though they came late");
+    }
+    test::check(well_ordered(sketch, 4), "in order");
+}
+
+// A full set of leaders lets a key in only when it beats the smallest, which it replaces
+void replaces_the_smallest_leader()
+{
+    auto sketch = heavy_hitters(2);
+    sketch.add("a", 10);
+    sketch.add("b", 20);
+    sketch.add("c", 5);
+    auto leaders = sketch.top(2);
+    test::check(leaders[0].first == "b" && leaders[1].first == "a", "a lighter key stays out");
+
+    sketch.add("c", 10);
+    leaders = sketch.top(2);
+    test::check(leaders[0].first == "b" && leaders[1].first == "c", "until it beats the smallest, a");
+
+    sketch.add("c", 100);
+    leaders = sketch.top(2);
+    test::check(leaders[0].first == "c" && leaders[1].first == "b", "and a leader moves in place");
+    test::check(sketch.top(5).size() == 2, "never more than the capacity");
+
+    auto tiny = heavy_hitters(0);
+    tiny.add("x", 1);
+    tiny.add("y", 2);
+    test::check(tiny.top(5).size() == 1 && tiny.top(5)[0].first == "y", "a capacity of 0 still holds one leader");
+}
+
+// Keys longer than max_key_length count as their first max_key_length bytes
+void cuts_long_keys()
+{
+    auto sketch = heavy_hitters(4);
+    auto prefix = std::string(heavy_hitters::max_key_length, 'k');
+    sketch.add(prefix + "-one", 1);
+    sketch.add(prefix + "-two", 1);
+    test::check(sketch.estimate(prefix) == 2 && sketch.estimate(prefix + "-three") == 2, "the same key past the limit");
+
+    auto leaders = sketch.top(4);
+    test::check(leaders.size() == 1 && leaders[0].first == prefix, "one leader, its key cut short");
+}
+
+// Counts stop at the largest there is instead of wrapping around to small ones
+void saturates()
+{
+    constexpr auto most = std::numeric_limits<uint64_t>::max();
+    auto sketch = heavy_hitters(2);
+    sketch.add("big", uint64_t(INT64_MAX));
+    sketch.add("big", uint64_t(INT64_MAX));
+    test::check(sketch.add("big", uint64_t(INT64_MAX)) == most, "the third INT64_MAX sticks at the top");
+    test::check(sketch.add("big", 1) == most, "and stays there");
+    test::check(sketch.estimate("big") == most, "as its estimate");
+
+    sketch.add("small", 1);
+    sketch.add("other", 2);
+    auto leaders = sketch.top(2);
+    test::check(leaders.size() == 2 && leaders[0].first == "big" && leaders[1].first == "other", "and it still leads");
+}
+
+// Moving a sketch keeps its key index pointing at its own entries
+void moves()
+{
+    auto original = heavy_hitters(4);
+    original.add("a", 3);
+    auto moved = std::move(original);
+    moved.add("a", 4);
+    test::check(moved.estimate("a") == 7 && moved.top(4).size() == 1 && moved.top(4)[0].second == 7, "the same leader, updated");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "counts_a_few_keys_exactly",    counts_a_few_keys_exactly },
+        { "never_underestimates",         never_underestimates },
+        { "finds_the_heavy_keys",         finds_the_heavy_keys },
+        { "replaces_the_smallest_leader", replaces_the_smallest_leader },
+        { "cuts_long_keys",               cuts_long_keys },
+        { "saturates",                    saturates },
+        { "moves",                        moves },
+    });
+}
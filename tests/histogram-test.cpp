@@ -0,0 +1,223 @@
+// histogram: percentiles within a bucket's width of the truth and never below it, across the whole
+// uint64_t range; merges that equal recording everything in one; and merge_encoded on what another
+// process might send, from its own encode() to text that's malformed, out of its stated range, or
+// counts too big to add.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "histogram.hpp"
+
+namespace {
+
+// Same count, extremes and percentiles
+auto same(histogram const& a, histogram const& b) -> bool
+{
+    if (a.count() != b.count() || a.min() != b.min() || a.max() != b.max()) {
+        return false;
+    }
+    for (double percent : { 0.0, 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0 }) {
+        if (a.percentile(percent) != b.percentile(percent)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void empty_is_zero()
+{
+    auto empty = histogram();
+    test::check(empty.count() == 0 && empty.min() == 0 && empty.max() == 0, "no count, min or max");
+    test::check(empty.percentile(50) == 0 && empty.percentile(100) == 0, "and every percentile is 0");
+    test::check(empty.encode() == "0,0", "encoded as just its extremes");
+}
+
+// Below 2^significant_bits every value has a bucket of its own
+void small_values_are_exact()
+{
+    auto values = histogram();
+    for (uint64_t value = 1; value <= 100; ++value) {
+        values.record(value);
+    }
+    test::check(values.count() == 100 && values.min() == 1 && values.max() == 100, "count, min and max");
+    test::check(values.percentile(50) == 50 && values.percentile(99) == 99 && values.percentile(100) == 100, "percentiles exactly");
+    test::check(values.percentile(0) == 1 && values.percentile(-5) == 1, "the lowest at 0 and below");
+    test::check(values.percentile(250) == 100, "the highest past 100");
+
+    auto weighted = histogram();
+    weighted.record(7, 99);
+    weighted.record(200);
+    test::check(weighted.count() == 100 && weighted.percentile(99) == 7 && weighted.percentile(99.5) == 200, "counts weigh a value");
+}
+
+// Random values of every magnitude: each percentile is at or above the true one, by less than 1/128th
+void percentiles_within_a_bucket()
+{
+    auto random = std::mt19937_64(3);
+    auto values = std::vector<uint64_t>();
+    auto observed = histogram();
+    for (int i = 0; i < 100000; ++i) {
+        auto value = random() >> (random() % 64);
+        values.push_back(value);
+        observed.record(value);
+    }
+    std::sort(values.begin(), values.end());
+
+    for (double percent : { 1.0, 10.0, 50.0, 90.0, 99.0, 99.9 }) {
+        auto truth = values[size_t(std::ceil(percent / 100 * double(values.size()))) - 1];
+        auto answer = observed.percentile(percent);
+        test::check(answer >= truth && answer - truth <= truth / 128, ("within a bucket at " + std::to_string(percent)).c_str());
+    }
+    test::check(observed.percentile(100) == values.back() && observed.min() == values.front(), "the extremes exactly");
+}
+
+void the_whole_range()
+{
+    auto extremes = histogram();
+    extremes.record(0);
+    extremes.record(UINT64_MAX);
+    test::check(extremes.min() == 0 && extremes.max() == UINT64_MAX, "0 and UINT64_MAX both fit");
+    test::check(extremes.percentile(50) == 0 && extremes.percentile(100) == UINT64_MAX, "in the first and last buckets");
+
+    // Either side of where buckets start covering more than one value
+    auto edges = histogram();
+    for (uint64_t value : { 255, 256, 257, 258 }) {
+        edges.record(value);
+    }
+    test::check(edges.percentile(25) == 255 && edges.percentile(50) == 257 && edges.percentile(100) == 258,
+        "256 and 257 share a bucket, answered by its highest value");
+}
+
+void merges_like_recording_together()
+{
+    auto random = std::mt19937_64(5);
+    auto a = histogram();
+    auto b = histogram();
+    auto both = histogram();
+    for (int i = 0; i < 10000; ++i) {
+        auto value = random() % 1000000;
+        (i % 3 ? a : b).record(value);
+        both.record(value);
+    }
+
+    auto merged = a;
+    merged.merge(b);
+    test::check(same(merged, both), "merging is recording everything in one");
+
+    merged.merge(histogram());
+    test::check(same(merged, both), "and merging an empty one changes nothing");
+}
+
+void round_trips_as_text()
+{
+    auto random = std::mt19937_64(9);
+    auto original = histogram();
+    for (int i = 0; i < 10000; ++i) {
+        original.record(random() >> (random() % 64));
+    }
+    original.record(UINT64_MAX);
+
+    auto copy = histogram();
+    test::check(copy.merge_encoded(original.encode()), "what encode() writes merges");
+    test::check(same(copy, original), "into what was encoded");
+
+    test::check(copy.merge_encoded(histogram().encode()) && same(copy, original), "an empty one merges as nothing");
+    test::check(copy.merge_encoded(original.encode()) && copy.count() == 2 * original.count(), "and a second merge adds");
+}
+
+// A merge that fails leaves the histogram as it was
+void refuses(std::string const& encoded)
+{
+    auto target = histogram();
+    target.record(42, 3);
+    test::check(!target.merge_encoded(encoded), encoded.c_str());
+    test::check(target.count() == 3 && target.min() == 42 && target.max() == 42 && target.percentile(100) == 42,
+        "and nothing was merged");
+}
+
+void refuses_malformed_text()
+{
+    for (auto const& text : std::vector<std::string> {
+             "",
+             "5",
+             "5,",
+             "x,5",
+             "5,x",
+             "-1,5",
+             "1,99999999999999999999999",
+             "1,5,",
+             "1,5,3",
+             "1,5,3:",
+             "1,5,:3",
+             "1,5,3:x",
+             "1,5,3:-1",
+             "1,5,3:1,",
+             "1,5,3:1,,4:1",
+             "1,5,3:1:1",
+             " 1,5,3:1",
+         }) {
+        refuses(text);
+    }
+}
+
+// Buckets have to lie between the ones the stated min and max fall in, and within bucket_count
+void refuses_buckets_out_of_range()
+{
+    auto lowest = histogram();
+    test::check(lowest.merge_encoded("10,20,10:1") && lowest.merge_encoded("10,20,20:1"), "the buckets of min and max themselves");
+    test::check(lowest.count() == 2 && lowest.min() == 10 && lowest.max() == 20, "merged");
+    refuses("10,20,9:1");
+    refuses("10,20,21:1");
+    refuses("10,20,15:1,21:1");
+
+    auto last = std::to_string(histogram::bucket_count - 1);
+    auto highest = histogram();
+    test::check(highest.merge_encoded("0," + std::to_string(UINT64_MAX) + "," + last + ":1"), "the very last bucket");
+    test::check(highest.percentile(100) == UINT64_MAX, "holds UINT64_MAX");
+    refuses("0," + std::to_string(UINT64_MAX) + "," + std::to_string(histogram::bucket_count) + ":1");
+    refuses("0," + std::to_string(UINT64_MAX) + ",99999999999999999999999:1");
+}
+
+// A min above its max is nonsense whether or not buckets follow
+void refuses_low_above_high()
+{
+    refuses("20,10,15:1");
+    refuses("20,10");
+    refuses("11,10,10:1");
+    test::check(histogram().merge_encoded("10,10,10:1"), "min and max can be equal");
+}
+
+// Counts that would carry the total past UINT64_MAX are refused rather than wrapped
+void refuses_counts_that_overflow()
+{
+    auto most = std::to_string(UINT64_MAX);
+    refuses("1,5,3:" + most);
+    refuses("1,5,3:1,4:" + most);
+
+    auto full = histogram();
+    test::check(full.merge_encoded("1,5,3:" + most) && full.count() == UINT64_MAX, "UINT64_MAX alone fits an empty histogram");
+    test::check(!full.merge_encoded("1,5,3:1") && full.count() == UINT64_MAX, "and then nothing more does");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "empty_is_zero",                  empty_is_zero },
+        { "small_values_are_exact",         small_values_are_exact },
+        { "percentiles_within_a_bucket",    percentiles_within_a_bucket },
+        { "the_whole_range",                the_whole_range },
+        { "merges_like_recording_together", merges_like_recording_together },
+        { "round_trips_as_text",            round_trips_as_text },
+        { "refuses_malformed_text",         refuses_malformed_text },
+        { "refuses_buckets_out_of_range",   refuses_buckets_out_of_range },
+        { "refuses_low_above_high",         refuses_low_above_high },
+        { "refuses_counts_that_overflow",   refuses_counts_that_overflow },
+    });
+}
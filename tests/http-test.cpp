@@ -0,0 +1,165 @@
+// http::parse_request on what a client can send: requests that arrive a piece at a time, request
+// lines and headers that don't parse, and the size limits. Plus query parameters and the responses we
+// format.
+
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "http.hpp"
+
+namespace {
+
+using status = http::parse_status;
+
+auto status_of(std::string_view text) -> status
+{
+    auto request = http::request{};
+    size_t length = 0;
+    return http::parse_request(text, &request, &length);
+}
+
+void parses_a_request()
+{
+    auto text = std::string_view("GET /count?wait=5&version=3 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    auto request = http::request{};
+    size_t length = 0;
+    test::check(http::parse_request(text, &request, &length) == status::complete, "a GET parses");
+    test::check(request.method == "GET" && request.path == "/count" && request.query == "wait=5&version=3", "method, path and query");
+    test::check(request.minor_version == 1 && request.keep_alive, "HTTP/1.1 keeps the connection alive");
+    test::check(length == text.size(), "and it's all of it");
+}
+
+// Only what the head and its Content-Length cover is taken; a pipelined request after it is left alone
+void takes_the_body_and_no_more()
+{
+    auto text = std::string_view("POST /incr?by=2 HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET / HTTP/1.1\r\n\r\n");
+    auto request = http::request{};
+    size_t length = 0;
+    test::check(http::parse_request(text, &request, &length) == status::complete, "a POST with a body parses");
+    test::check(request.content_length == 5 && length == text.find("GET"), "up to the end of its body");
+}
+
+void waits_for_the_rest()
+{
+    auto text = std::string_view("POST /incr HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody");
+    for (size_t received = 0; received < text.size(); ++received) {
+        test::check(status_of(text.substr(0, received)) == status::incomplete, "incomplete until the body is all in");
+    }
+    test::check(status_of(text) == status::complete, "then complete");
+}
+
+void refuses_bad_request_lines()
+{
+    for (auto text : {
+             "GET\r\n\r\n",
+             "GET /\r\n\r\n",
+             "GET  / HTTP/1.1\r\n\r\n",
+             "GET count HTTP/1.1\r\n\r\n",
+             "GET / HTTP/2.0\r\n\r\n",
+             "GET / HTTP/1.x\r\n\r\n",
+             "GET / HTTP/1.1 extra\r\n\r\n",
+             " / HTTP/1.1\r\n\r\n",
+             "\r\n\r\n",
+         }) {
+        test::check(status_of(text) == status::malformed, text);
+    }
+}
+
+void refuses_bad_headers()
+{
+    for (auto text : {
+             "GET / HTTP/1.1\r\nno colon\r\n\r\n",
+             "GET / HTTP/1.1\r\n: empty name\r\n\r\n",
+             "GET / HTTP/1.1\r\nContent-Length: \r\n\r\n",
+             "GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+             "GET / HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n",
+             "GET / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+         }) {
+        test::check(status_of(text) == status::malformed, text);
+    }
+}
+
+// The whole request, head and body, has to fit in max_request_size. A body that can't is refused as
+// soon as the head is in; a head that doesn't end within it never completes, and the server answers
+// 431 once its buffer is full.
+void size_limits()
+{
+    auto with_length = [](size_t length) { return "POST /incr HTTP/1.1\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n"; };
+    auto head_size = with_length(1000).size();
+    test::check(status_of(with_length(http::max_request_size - head_size)) == status::incomplete, "a body that just fits is worth waiting for");
+    test::check(status_of(with_length(http::max_request_size - head_size + 1)) == status::malformed, "one byte more never fits");
+    test::check(status_of(with_length(http::max_request_size + 1)) == status::malformed, "nor does a body bigger than the limit by itself");
+
+    auto start = std::string("GET / HTTP/1.1\r\nX-Padding: ");
+    auto padded = start + std::string(http::max_request_size - start.size() - 4, 'p') + "\r\n\r\n";
+    test::check(padded.size() == http::max_request_size && status_of(padded) == status::complete, "a head of exactly max_request_size parses");
+    test::check(status_of(std::string_view(padded).substr(0, http::max_request_size - 1)) == status::incomplete,
+        "and without its last byte is still incomplete");
+}
+
+void connection_options()
+{
+    auto request = http::request{};
+    size_t length = 0;
+
+    http::parse_request("GET / HTTP/1.0\r\n\r\n", &request, &length);
+    test::check(request.minor_version == 0 && !request.keep_alive, "HTTP/1.0 closes by default");
+    http::parse_request("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", &request, &length);
+    test::check(request.keep_alive, "unless asked not to");
+    http::parse_request("GET / HTTP/1.1\r\nconnection: close\r\n\r\n", &request, &length);
+    test::check(!request.keep_alive, "HTTP/1.1 closes when asked, in any case");
+    http::parse_request("GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", &request, &length);
+    test::check(request.chunked, "chunked bodies are noticed");
+
+    auto upgrade = "GET /count HTTP/1.1\r\nUpgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    http::parse_request(upgrade, &request, &length);
+    test::check(request.websocket_upgrade && request.websocket_key == "dGhlIHNhbXBsZSBub25jZQ==" && request.websocket_version == 13,
+        "a WebSocket upgrade, key and version");
+
+    http::parse_request("GET /count HTTP/1.1\r\nUpgrade: websocket\r\n\r\n", &request, &length);
+    test::check(!request.websocket_upgrade, "isn't one without Connection: upgrade");
+}
+
+void query_parameters()
+{
+    test::check(http::query_parameter("by=5&wait=10", "by") == "5", "the first");
+    test::check(http::query_parameter("by=5&wait=10", "wait") == "10", "the last");
+    test::check(!http::query_parameter("by=5&wait=10", "b"), "names match whole");
+    test::check(!http::query_parameter("", "by"), "nothing in an empty query");
+    test::check(http::query_parameter("flag&by=1", "flag") == "", "a name without a value has an empty one");
+    test::check(http::query_parameter("by=1&by=2", "by") == "1", "the first of two wins");
+}
+
+void formats_responses()
+{
+    char out[256];
+    auto size = http::format_response(out, sizeof(out), 200, "42@7\n", 7, true);
+    test::check(std::string_view(out, size) ==
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 5\r\nCount-Version: 7\r\nConnection: keep-alive\r\n\r\n42@7\n",
+        "a 200 with its body");
+
+    size = http::format_response(out, sizeof(out), 429, "", 0, false);
+    test::check(std::string_view(out, size).starts_with("HTTP/1.1 429 Too Many Requests\r\n"), "429's reason");
+    test::check(std::string_view(out, size).find("Connection: close\r\n") != std::string_view::npos, "and closing");
+
+    test::check(http::format_response(out, 32, 200, "42@7\n", 7, true) >= 32, "too small a buffer says so");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "parses_a_request",           parses_a_request },
+        { "takes_the_body_and_no_more", takes_the_body_and_no_more },
+        { "waits_for_the_rest",         waits_for_the_rest },
+        { "refuses_bad_request_lines",  refuses_bad_request_lines },
+        { "refuses_bad_headers",        refuses_bad_headers },
+        { "size_limits",                size_limits },
+        { "connection_options",         connection_options },
+        { "query_parameters",           query_parameters },
+        { "formats_responses",          formats_responses },
+    });
+}
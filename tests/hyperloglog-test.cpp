@@ -0,0 +1,129 @@
+// hyperloglog's estimate from empty through small sets to a million items, within the error 2^14
+// registers promise; repeats that don't move it; and merges that give the union.
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "check.hpp"
+#include "hyperloglog.hpp"
+
+namespace {
+
+// Items numbered [first, first + count)
+void add_range(hyperloglog* sketch, uint64_t first, uint64_t count)
+{
+    for (auto i = first; i < first + count; ++i) {
+        sketch->add("item-" + std::to_string(i));
+    }
+}
+
+// Within `sigmas` standard errors (0.81% at this precision) of the truth
+auto close_to(uint64_t estimate, uint64_t truth, double sigmas = 4) -> bool
+{
+    return std::fabs(double(estimate) - double(truth)) <= sigmas * 0.0081 * double(truth) + 1;
+}
+
+void empty_is_zero()
+{
+    auto sketch = hyperloglog();
+    test::check(sketch.estimate() == 0, "nothing added, nothing counted");
+}
+
+void small_sets_are_nearly_exact()
+{
+    auto sketch = hyperloglog();
+    test::check(sketch.add("a"), "a new item moves a register");
+    test::check(sketch.estimate() == 1, "one item");
+    test::check(!sketch.add("a"), "the same item again doesn't");
+    test::check(sketch.estimate() == 1, "and still one");
+
+    add_range(&sketch, 0, 99);
+    test::check(sketch.estimate() == 100, "a hundred, exactly, while registers rarely collide");
+}
+
+void large_sets_are_within_the_error()
+{
+    auto sketch = hyperloglog();
+    uint64_t added = 0;
+    for (uint64_t size : { 1000, 10000, 100000, 1000000 }) {
+        add_range(&sketch, added, size - added);
+        added = size;
+        test::check(close_to(sketch.estimate(), size), ("within the error at " + std::to_string(size)).c_str());
+    }
+}
+
+// Adding what's there already changes nothing, however often
+void repeats_change_nothing()
+{
+    auto sketch = hyperloglog();
+    add_range(&sketch, 0, 5000);
+    auto before = sketch.estimate();
+
+    auto moved = false;
+    for (int round = 0; round < 3; ++round) {
+        for (uint64_t i = 0; i < 5000; ++i) {
+            moved = sketch.add("item-" + std::to_string(i)) || moved;
+        }
+    }
+    test::check(!moved, "no register moved");
+    test::check(sketch.estimate() == before, "so the estimate didn't either");
+}
+
+void merges_give_the_union()
+{
+    auto a = hyperloglog();
+    auto b = hyperloglog();
+    add_range(&a, 0, 60000);
+    add_range(&b, 40000, 60000);
+
+    auto both = hyperloglog();
+    add_range(&both, 0, 100000);
+
+    auto merged = a;
+    merged.merge(b);
+    test::check(merged.estimate() == both.estimate(), "merging is the same as adding everything to one sketch");
+    test::check(close_to(merged.estimate(), 100000), "overlaps count once");
+
+    auto again = merged;
+    again.merge(b);
+    again.merge(a);
+    test::check(again.estimate() == merged.estimate(), "merging the same sketch twice changes nothing");
+
+    auto from_empty = hyperloglog();
+    from_empty.merge(a);
+    test::check(from_empty.estimate() == a.estimate(), "an empty sketch merged with one is that one");
+    a.merge(hyperloglog());
+    test::check(a.estimate() == from_empty.estimate(), "and merging an empty one into it changes nothing");
+}
+
+// The estimate is cached; a merge or an add that moves a register has to forget it
+void estimate_follows_changes()
+{
+    auto sketch = hyperloglog();
+    add_range(&sketch, 0, 1000);
+    auto first = sketch.estimate();
+
+    auto other = hyperloglog();
+    add_range(&other, 1000, 1000);
+    sketch.merge(other);
+    test::check(sketch.estimate() > first, "after a merge");
+
+    auto merged = sketch.estimate();
+    add_range(&sketch, 2000, 1000);
+    test::check(sketch.estimate() > merged, "after adds");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "empty_is_zero",                   empty_is_zero },
+        { "small_sets_are_nearly_exact",     small_sets_are_nearly_exact },
+        { "large_sets_are_within_the_error", large_sets_are_within_the_error },
+        { "repeats_change_nothing",          repeats_change_nothing },
+        { "merges_give_the_union",           merges_give_the_union },
+        { "estimate_follows_changes",        estimate_follows_changes },
+    });
+}
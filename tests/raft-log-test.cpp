@@ -0,0 +1,172 @@
+// raft_log across restarts: what a crash can leave in the directory, and what comes back from it.
+// Files are written by hand where a test needs a state only a crash produces.
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "check.hpp"
+#include "raft-log.hpp"
+#include "raft.hpp"
+
+namespace {
+
+void write_file(std::string const& path, std::string const& contents)
+{
+    auto file = std::ofstream(path, std::ios::trunc);
+    file << contents;
+}
+
+auto read_file(std::string const& path) -> std::string
+{
+    auto file = std::ifstream(path);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+void survives_restart()
+{
+    auto scratch = test::scratch_directory();
+    {
+        auto log = raft_log(scratch.path);
+        log.set_term(3, 1);
+        log.append({ 2, 5 });
+        log.append({ 3, -2, false, "client:7" });
+        log.append({ 3, 0, true });
+        log.sync();
+    }
+
+    auto log = raft_log(scratch.path);
+    test::check(log.current_term() == 3 && log.voted_for() == 1, "the term and vote come back");
+    test::check(log.last_index() == 3 && log.last_term() == 3, "so do the entries");
+    test::check(log.at(1).term == 2 && log.at(1).delta == 5, "first entry");
+    test::check(log.at(2).delta == -2 && log.at(2).request_id == "client:7", "request IDs too");
+    test::check(log.at(3).noop, "no-ops stay no-ops");
+}
+
+// A crash in the middle of appending leaves half a line nobody was ever told about: it goes, and
+// what's appended afterwards lands on a clean line of its own
+void drops_torn_last_line()
+{
+    auto scratch = test::scratch_directory();
+    write_file(scratch / "log", "after 0\n1,5\n1,7,client:1\n1,3,cli");
+
+    {
+        auto log = raft_log(scratch.path);
+        test::check(log.last_index() == 2, "the torn line is dropped");
+        test::check(log.at(2).delta == 7 && log.at(2).request_id == "client:1", "the whole lines before it aren't");
+
+        log.append({ 2, 11 });
+        log.sync();
+    }
+
+    test::check(read_file(scratch / "log") == "after 0\n1,5\n1,7,client:1\n2,11\n", "appends follow the last whole line");
+    auto log = raft_log(scratch.path);
+    test::check(log.last_index() == 3 && log.at(3).delta == 11, "and come back after another restart");
+}
+
+// A line that isn't an entry at all stops the load there, like a torn one
+void stops_at_garbage()
+{
+    auto scratch = test::scratch_directory();
+    write_file(scratch / "log", "after 0\n1,5\n\x01\x02garbage\n1,6\n");
+
+    auto log = raft_log(scratch.path);
+    test::check(log.last_index() == 1, "nothing from the unreadable line on");
+}
+
+// Cutting off a conflicting suffix rewrites the file, and the cut stays cut after a restart
+void truncation_survives_restart()
+{
+    auto scratch = test::scratch_directory();
+    {
+        auto log = raft_log(scratch.path);
+        for (int i = 0; i < 5; ++i) {
+            log.append({ 1, 1 });
+        }
+        log.sync();
+
+        log.truncate_from(3);
+        log.append({ 2, 10 });
+        log.sync();
+    }
+
+    auto log = raft_log(scratch.path);
+    test::check(log.last_index() == 3, "two entries were cut and one appended");
+    test::check(log.term_at(3) == 2u && log.at(3).delta == 10, "the new one is where the cut began");
+}
+
+// A crash between writing a snapshot and rewriting the log leaves entries the snapshot already covers
+// at the front of the log; they're skipped, and only what follows the snapshot is replayed over it
+void replays_log_over_snapshot()
+{
+    auto scratch = test::scratch_directory();
+    write_file(scratch / "meta", "2 -1\n");
+    write_file(scratch / "snapshot", "3 1 40 3\n");
+    write_file(scratch / "log", "after 1\n1,10\n1,20\n2,5\n2,-2\n");
+
+    auto log = raft_log(scratch.path);
+    test::check(log.snapshot().index == 3 && log.snapshot().count.value == 40, "the snapshot loads");
+    test::check(log.last_index() == 5, "the log runs on past it");
+    test::check(log.term_at(3) == 1u && !log.term_at(2), "entries it covers are gone");
+    test::check(log.at(4).delta == 5 && log.at(5).delta == -2, "entries after it are kept");
+
+    // A single member leads as soon as its election timer runs out, commits its own no-op, and with
+    // it everything before: the two entries past the snapshot, then the no-op
+    auto now = raft_node::clock::time_point() + std::chrono::hours(1);
+    auto node = raft_node(0, 1, &log, now, 4096);
+    test::check(node.applied() == 3, "the snapshot counts as applied");
+
+    now += raft_node::election_max;
+    node.tick(now);
+    node.flush(now);
+    test::check(node.is_leader(), "the lone member leads");
+
+    auto count = log.snapshot().count.value;
+    uint64_t expected_index = 4;
+    while (auto next = node.next_to_apply()) {
+        test::check(next->index == expected_index++, "entries are applied in order, from just past the snapshot");
+        if (next->counts) {
+            count += next->entry->delta;
+        }
+    }
+    test::check(expected_index == 7, "up to and including the no-op");
+    test::check(count == 43, "40 + 5 - 2");
+}
+
+// A snapshot from a leader that agrees with our log keeps what follows it; one that doesn't throws
+// the whole log away
+void installs_snapshots()
+{
+    auto scratch = test::scratch_directory();
+    auto log = raft_log(scratch.path);
+    for (int i = 0; i < 4; ++i) {
+        log.append({ 1, 1 });
+    }
+
+    log.install({ 2, 1, { 2, 2 } });
+    test::check(log.snapshot().index == 2 && log.last_index() == 4, "entries past an agreeing snapshot stay");
+
+    log.install({ 6, 3, { 9, 6 }, "client 7 00000000000000c1" });
+    test::check(log.snapshot().index == 6 && log.last_index() == 6, "a snapshot past the end replaces everything");
+    log.sync();
+
+    auto reloaded = raft_log(scratch.path);
+    test::check(reloaded.snapshot().index == 6 && reloaded.snapshot().count.value == 9, "and is what loads next time");
+    test::check(reloaded.snapshot().applied_ids == "client 7 00000000000000c1", "request IDs included");
+    test::check(reloaded.last_index() == 6, "with nothing after it");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "survives_restart",            survives_restart },
+        { "drops_torn_last_line",        drops_torn_last_line },
+        { "stops_at_garbage",            stops_at_garbage },
+        { "truncation_survives_restart", truncation_survives_restart },
+        { "replays_log_over_snapshot",   replays_log_over_snapshot },
+        { "installs_snapshots",          installs_snapshots },
+    });
+}
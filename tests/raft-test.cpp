@@ -0,0 +1,455 @@
+// raft_node driven by hand: a simulated network of members, each with a real raft_log in a scratch
+// directory, and a clock that only moves when the test says so. Everything is deterministic: the
+// nodes' election timers are seeded from the start time and their ids, and partitions come from a
+// seeded generator.
+//
+// Messages between two members are delivered in order and never duplicated, as TCP would; cutting a
+// link loses whatever was on it, and both ends hear about it through lost_peer(), as raft_cluster's
+// would when the connection drops.
+
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "raft-log.hpp"
+#include "raft.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+using clock = raft_node::clock;
+
+auto const start = clock::time_point() + 1h;
+
+class simulated_cluster {
+public:
+    struct member {
+        std::string directory;
+        std::unique_ptr<raft_log> log;
+        std::unique_ptr<raft_node> node;
+        int64_t count = 0;  // the state machine: every committed delta, applied in order
+    };
+
+    explicit simulated_cluster(size_t size) : members(size), links(size, std::vector<bool>(size, true))
+    {
+        for (size_t id = 0; id < size; ++id) {
+            members[id].directory = scratch / ("member-" + std::to_string(id));
+            restart(id);
+        }
+    }
+
+    // As if the process had crashed and come back: whatever it hadn't synced is gone, and the count
+    // comes back from the snapshot, with the entries after it applied again as they're committed
+    void restart(size_t id)
+    {
+        auto& m = members[id];
+        m.node.reset();
+        m.log.reset();
+        m.log = std::make_unique<raft_log>(m.directory);
+        m.node = std::make_unique<raft_node>(id, members.size(), m.log.get(), now, 4096);
+        m.count = m.log->snapshot().count.value;
+
+        for (size_t peer = 0; peer < members.size(); ++peer) {
+            if (peer != id && members[peer].node) {
+                members[peer].node->lost_peer(id);
+            }
+        }
+        std::erase_if(wire, [&](auto const& message) { return message.from == id || message.to == id; });
+    }
+
+    void cut(size_t a, size_t b)
+    {
+        if (!links[a][b]) {
+            return;
+        }
+        links[a][b] = links[b][a] = false;
+        members[a].node->lost_peer(b);
+        members[b].node->lost_peer(a);
+        std::erase_if(wire, [&](auto const& message) {
+            return (message.from == a && message.to == b) || (message.from == b && message.to == a);
+        });
+    }
+
+    void heal(size_t a, size_t b) { links[a][b] = links[b][a] = true; }
+
+    void isolate(size_t id)
+    {
+        for (size_t peer = 0; peer < members.size(); ++peer) {
+            if (peer != id) {
+                cut(id, peer);
+            }
+        }
+    }
+
+    void heal_all()
+    {
+        for (size_t a = 0; a < members.size(); ++a) {
+            for (size_t b = 0; b < members.size(); ++b) {
+                links[a][b] = true;
+            }
+        }
+    }
+
+    // One clock tick for everybody, then messages back and forth until nobody has anything to say
+    void step(clock::duration by = 10ms)
+    {
+        now += by;
+        for (auto& m : members) {
+            m.node->tick(now);
+        }
+        settle();
+    }
+
+    void settle()
+    {
+        for (int round = 0; round < 1000; ++round) {
+            for (size_t id = 0; id < members.size(); ++id) {
+                flush(id);
+            }
+            if (wire.empty()) {
+                return;
+            }
+
+            auto delivering = std::exchange(wire, {});
+            for (auto const& message : delivering) {
+                members[message.to].node->receive(message.from, message.text, now);
+            }
+        }
+        test::check(false, "the cluster settles");
+    }
+
+    // Steps until somebody leads, for up to `limit`; whoever it is
+    auto elect(clock::duration limit = 5s) -> std::optional<size_t>
+    {
+        for (auto until = now + limit; now < until; step()) {
+            if (auto id = leader()) {
+                return id;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // The member that leads in the newest term, if any does
+    auto leader() const -> std::optional<size_t>
+    {
+        std::optional<size_t> found;
+        for (size_t id = 0; id < members.size(); ++id) {
+            if (members[id].node->is_leader() && (!found || members[id].node->term() > members[*found].node->term())) {
+                found = id;
+            }
+        }
+        return found;
+    }
+
+    auto propose(size_t id, int64_t delta, std::string request_id = {}) -> uint64_t
+    {
+        return members[id].node->propose(delta, std::move(request_id));
+    }
+
+    std::vector<member> members;
+    clock::time_point now = start;
+
+    // What every member that applied an index applied there, and whether it counted, which must be
+    // the same everywhere
+    std::map<uint64_t, std::tuple<uint64_t, int64_t, bool>> applied;
+    bool applied_agree = true;
+
+    // Who led each term; never more than one
+    std::map<uint64_t, size_t> leaders;
+    bool one_leader_per_term = true;
+
+private:
+    struct envelope {
+        size_t from;
+        size_t to;
+        std::string text;
+    };
+
+    // What raft_cluster::flush() does: sync and send, then apply what's committed
+    void flush(size_t id)
+    {
+        auto& m = members[id];
+        m.node->flush(now);
+        for (auto& message : m.node->take_messages()) {
+            if (links[id][message.to]) {
+                wire.push_back({ id, message.to, std::move(message.text) });
+            }
+        }
+
+        if (auto snapshot = m.node->take_snapshot()) {
+            m.count = snapshot->count.value;
+        }
+        while (auto next = m.node->next_to_apply()) {
+            auto [index, entry, counts] = *next;
+            if (counts) {
+                m.count += entry->delta;
+            }
+
+            auto seen = std::tuple(entry->term, entry->noop ? 0 : entry->delta, counts);
+            auto [earlier, first] = applied.emplace(index, seen);
+            applied_agree = applied_agree && (first || earlier->second == seen);
+        }
+        m.node->compact({ m.count, m.node->applied() });
+
+        if (m.node->is_leader()) {
+            auto [earlier, first] = leaders.emplace(m.node->term(), id);
+            one_leader_per_term = one_leader_per_term && (first || earlier->second == id);
+        }
+    }
+
+    test::scratch_directory scratch;
+    std::vector<std::vector<bool>> links;
+    std::deque<envelope> wire;
+};
+
+// "v <term> <granted>", the answer to a vote request
+auto parse_vote(std::string_view text, uint64_t* term, int* granted) -> bool
+{
+    if (!text.starts_with("v ")) {
+        return false;
+    }
+    text.remove_prefix(2);
+    auto space = text.find(' ');
+    if (space == std::string_view::npos) {
+        return false;
+    }
+
+    auto term_text = text.substr(0, space);
+    auto granted_text = text.substr(space + 1);
+    return std::from_chars(term_text.data(), term_text.data() + term_text.size(), *term).ec == std::errc() &&
+        std::from_chars(granted_text.data(), granted_text.data() + granted_text.size(), *granted).ec == std::errc();
+}
+
+// Asks `voter` for its vote in the next term on behalf of `candidate`, whose log is as good as its
+// own; whether it was granted
+auto ask_for_vote(simulated_cluster& cluster, size_t voter, size_t candidate, clock::time_point at) -> bool
+{
+    auto& node = *cluster.members[voter].node;
+    auto const& log = *cluster.members[voter].log;
+    auto request = "V " + std::to_string(node.term() + 1) + " " + std::to_string(log.last_index()) + " " + std::to_string(log.last_term());
+    node.receive(candidate, request, at);
+
+    auto replies = node.take_messages();
+    uint64_t term = 0;
+    int granted = 0;
+    test::check(replies.size() == 1 && replies[0].to == candidate && parse_vote(replies[0].text, &term, &granted), "the voter answers");
+    return granted == 1;
+}
+
+void elects_one_leader()
+{
+    auto cluster = simulated_cluster(3);
+    auto leader = cluster.elect();
+    test::check(leader.has_value(), "somebody leads within 5 s");
+
+    // Heartbeats keep it leading, and everybody else following it
+    for (int i = 0; i < 100; ++i) {
+        cluster.step();
+    }
+    test::check(cluster.leader() == leader, "the leader stays the leader");
+    for (auto const& m : cluster.members) {
+        test::check(m.node->leader() == leader, "everybody follows it");
+        test::check(m.node->term() == cluster.members[*leader].node->term(), "in the same term");
+    }
+    test::check(cluster.one_leader_per_term, "one leader per term");
+}
+
+// A follower that acknowledged the leader (and so counts towards its read lease) restarts and is
+// asked for its vote by another member: it must refuse for election_min after starting, or the new
+// leader could take writes while the old one still serves reads under its lease
+void restarted_member_refuses_votes()
+{
+    auto cluster = simulated_cluster(3);
+    auto leader = *cluster.elect();
+    cluster.propose(leader, 1);
+    cluster.step();
+    test::check(cluster.members[leader].node->can_read(cluster.now), "the leader holds a read lease");
+
+    auto voter = (leader + 1) % 3;
+    auto candidate = (leader + 2) % 3;
+    cluster.restart(voter);
+    auto restarted_at = cluster.now;
+
+    test::check(!ask_for_vote(cluster, voter, candidate, restarted_at + 10ms), "no vote right after starting");
+    test::check(!ask_for_vote(cluster, voter, candidate, restarted_at + raft_node::election_min - 1ms), "nor just before election_min");
+    test::check(ask_for_vote(cluster, voter, candidate, restarted_at + raft_node::election_min), "a vote once election_min has passed");
+}
+
+// A leader cut off from the others goes on taking writes that can never commit; once it's back, the
+// leader elected meanwhile overwrites them in its log, and they're never applied anywhere
+void repairs_log_after_leader_change()
+{
+    auto cluster = simulated_cluster(3);
+    auto old_leader = *cluster.elect();
+    cluster.propose(old_leader, 1);
+    cluster.step();
+
+    cluster.isolate(old_leader);
+    for (int i = 0; i < 3; ++i) {
+        cluster.propose(old_leader, 100);
+    }
+    cluster.step();
+
+    std::optional<size_t> new_leader;
+    for (int i = 0; i < 500 && !new_leader; ++i) {
+        cluster.step();
+        auto found = cluster.leader();
+        if (found && *found != old_leader) {
+            new_leader = found;
+        }
+    }
+    test::check(new_leader.has_value(), "the others elect a new leader");
+    if (!new_leader) {
+        return;
+    }
+
+    cluster.propose(*new_leader, 10);
+    cluster.propose(*new_leader, 20);
+    cluster.step();
+
+    cluster.heal_all();
+    for (int i = 0; i < 200; ++i) {
+        cluster.step();
+    }
+
+    auto const& repaired = cluster.members[old_leader];
+    auto const& reference = cluster.members[*new_leader];
+    test::check(!repaired.node->is_leader(), "the old leader stepped down");
+    test::check(repaired.log->last_index() == reference.log->last_index(), "its log is as long as the new leader's");
+    for (auto index = repaired.log->snapshot().index + 1; index <= repaired.log->last_index(); ++index) {
+        test::check(repaired.log->term_at(index) == reference.log->term_at(index), "and agrees with it entry by entry");
+    }
+    for (auto const& m : cluster.members) {
+        test::check(m.count == 31, "everybody applied 1 + 10 + 20 and none of the lost writes");
+    }
+    test::check(cluster.applied_agree, "every index was applied the same everywhere");
+}
+
+// A retry is counted once however the member applying it got its state. Here one member misses the
+// first attempt and catches up from the leader's snapshot, then the whole cluster restarts from the
+// snapshots it compacted to, and the client retries through whoever leads next: nobody counts it
+// again, while a request it never sent before still counts everywhere.
+void retries_count_once_across_snapshots()
+{
+    auto cluster = simulated_cluster(3);
+    auto leader = *cluster.elect();
+    auto lagging = (leader + 1) % 3;
+    cluster.isolate(lagging);
+
+    cluster.propose(leader, 5, "client:1");
+    for (uint64_t i = 0; i < raft_node::compact_after; ++i) {
+        cluster.propose(leader, 1);
+    }
+    for (int i = 0; i < 20; ++i) {
+        cluster.step();
+    }
+    test::check(cluster.members[leader].log->snapshot().index > 0, "the leader compacted its log");
+
+    cluster.heal_all();
+    for (int i = 0; i < 100; ++i) {
+        cluster.step();
+    }
+    auto expected = 5 + int64_t(raft_node::compact_after);
+    test::check(cluster.members[lagging].log->snapshot().index > 0, "the lagging member caught up from a snapshot");
+    test::check(cluster.members[lagging].count == expected, "and has the count the others have");
+
+    for (size_t id = 0; id < 3; ++id) {
+        cluster.restart(id);
+    }
+    for (auto const& m : cluster.members) {
+        test::check(m.log->snapshot().index > 0, "everybody restarts from a snapshot");
+    }
+
+    auto next_leader = cluster.elect();
+    test::check(next_leader.has_value(), "the restarted cluster elects a leader");
+    if (!next_leader) {
+        return;
+    }
+    cluster.propose(*next_leader, 5, "client:1");
+    cluster.propose(*next_leader, 7, "client:2");
+    for (int i = 0; i < 20; ++i) {
+        cluster.step();
+    }
+
+    for (auto const& m : cluster.members) {
+        test::check(m.count == expected + 7, "the retry isn't counted again, the new request is");
+    }
+    test::check(cluster.applied_agree, "every index was applied the same everywhere");
+}
+
+// Random partitions and restarts over thousands of writes, enough for the logs to be compacted and
+// lagging members caught up from snapshots. Whatever happens, no term has two leaders and no index
+// is applied differently by two members; once the network heals, everybody ends up with the same count.
+void stays_safe_under_partitions()
+{
+    constexpr size_t size = 5;
+    auto cluster = simulated_cluster(size);
+    auto random = std::mt19937(42);
+    auto pick = std::uniform_int_distribution<size_t>(0, size - 1);
+
+    int64_t proposed = 0;
+    for (int i = 0; i < 3000; ++i) {
+        if (i % 40 == 0) {
+            auto a = pick(random), b = pick(random);
+            if (a != b) {
+                random() % 2 ? cluster.cut(a, b) : cluster.heal(a, b);
+            }
+        }
+        if (i % 400 == 200) {
+            cluster.restart(pick(random));
+        }
+        if (i % 300 == 0) {
+            cluster.heal_all();
+        }
+
+        if (auto leader = cluster.leader()) {
+            for (int write = 0; write < 4; ++write) {
+                proposed += cluster.propose(*leader, 1) ? 1 : 0;
+            }
+        }
+        cluster.step();
+    }
+
+    cluster.heal_all();
+    for (int i = 0; i < 500; ++i) {
+        cluster.step();
+    }
+
+    test::check(cluster.one_leader_per_term, "never two leaders in one term");
+    test::check(cluster.applied_agree, "every index was applied the same everywhere");
+    test::check(cluster.leaders.size() > 1, "leadership changed hands along the way");
+
+    auto snapshotted = false;
+    for (auto const& m : cluster.members) {
+        test::check(m.count == cluster.members[0].count, "everybody agrees on the count");
+        test::check(m.node->applied() == cluster.members[0].node->applied(), "having applied as far");
+        snapshotted = snapshotted || m.log->snapshot().index > 0;
+    }
+    test::check(snapshotted, "logs were compacted along the way");
+    test::check(cluster.members[0].count > 0 && cluster.members[0].count <= proposed, "what's committed was proposed");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "elects_one_leader",                   elects_one_leader },
+        { "restarted_member_refuses_votes",      restarted_member_refuses_votes },
+        { "repairs_log_after_leader_change",     repairs_log_after_leader_change },
+        { "retries_count_once_across_snapshots", retries_count_once_across_snapshots },
+        { "stays_safe_under_partitions",         stays_safe_under_partitions },
+    });
+}
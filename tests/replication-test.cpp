@@ -0,0 +1,139 @@
+// A follower and its leader in one process, on one event loop, over loopback TCP: the leader is the
+// ordinary client-serving code, set up the way main() sets it up, and the follower is follow_leader().
+// Each test is a script coroutine that pokes the leader's count and waits, up to a deadline, for the
+// follower's to match.
+
+#include <chrono>
+#include <cstdint>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "check.hpp"
+#include "event-loop.hpp"
+#include "replication.hpp"
+#include "server.hpp"
+#include "sharded-counter.hpp"
+#include "task.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct pair_of_servers {
+    event_loop loop;
+    sharded_counter leader_count { worker_slot_count };
+    sharded_counter follower_count { worker_slot_count };
+    server_context leader { &loop, &leader_count };
+    server_context follower { &loop, &follower_count };
+    resource_handle listen_socket = listen_on_dual_tcp_socket(0);
+    int leader_fd = -1;  // the follower's end, while it's connected
+
+    auto port() const -> uint16_t
+    {
+        auto address = sockaddr_in6{};
+        auto size = socklen_t(sizeof(address));
+        getsockname(listen_socket.get().fd, reinterpret_cast<sockaddr*>(&address), &size);
+        return ntohs(address.sin6_port);
+    }
+
+    // Changes the leader's count the way a client's INCR would
+    void increment(int64_t delta)
+    {
+        leader_count.add(event_loop_worker, delta);
+        broadcast_count(&leader, leader_count.versioned_snapshot());
+    }
+
+    // Whether the follower's count caught up with `expected` before the deadline
+    auto follows(versioned_value expected, std::chrono::milliseconds deadline = 3s) -> task<bool>
+    {
+        for (auto waited = 0ms; waited < deadline; waited += 10ms) {
+            auto current = follower_count.versioned_snapshot();
+            if (current.value == expected.value && current.version == expected.version) {
+                co_return true;
+            }
+            co_await loop.sleep(10ms);
+        }
+        co_return false;
+    }
+
+    // Runs the script with the leader serving and the follower following, until it's done
+    void run(task<> (*script)(pair_of_servers&))
+    {
+        follower.read_only = true;
+        spawn(send_batched_output(&leader));
+        spawn(serve_ready_connections(&leader));
+        spawn(accept_connections(&leader, listen_socket.get().fd));
+        spawn(follow_leader(&follower, { "127.0.0.1", port() }, &leader_fd));
+        spawn(finish(script));
+        loop.run();
+    }
+
+private:
+    auto finish(task<> (*script)(pair_of_servers&)) -> task<>
+    {
+        co_await script(*this);
+
+        // Out of follow_leader's read or its backoff, the way a drain gets it out
+        follower.draining = true;
+        if (leader_fd >= 0) {
+            loop.forget(leader_fd);
+        }
+        loop.stop();
+    }
+};
+
+// A follower starts from the count as it stands, then mirrors every state it goes through
+auto catches_up_then_follows(pair_of_servers& servers) -> task<>
+{
+    servers.leader_count.restore(40, 12);
+
+    auto caught_up = co_await servers.follows({ 40, 12 });
+    test::check(caught_up, "the follower starts from the leader's count, version included");
+
+    servers.increment(2);
+    servers.increment(-5);
+    auto followed = co_await servers.follows({ 37, 14 });
+    test::check(followed, "and follows it as it moves");
+}
+
+// When the leader hangs up, the follower keeps its count, reconnects with backoff, and takes the
+// leader's count as it is by then, even one from an older version (a leader restarted from an older
+// state file): the leader is the truth
+auto reconnects_and_catches_up(pair_of_servers& servers) -> task<>
+{
+    servers.increment(3);
+    auto first = co_await servers.follows({ 3, 1 });
+    test::check(first, "the follower is following");
+
+    for (auto conn : servers.leader.connections) {
+        shutdown(conn->fd(), SHUT_RDWR);
+    }
+    servers.leader_count.assign(event_loop_worker, 100, 0);
+
+    auto kept = co_await servers.follows({ 3, 1 }, 100ms);
+    test::check(kept, "it keeps what it had while the leader is away");
+
+    auto back = co_await servers.follows({ 100, 0 });
+    test::check(back, "and takes the leader's count, older version and all, once it's back");
+}
+
+void follower_catches_up()
+{
+    pair_of_servers().run(catches_up_then_follows);
+}
+
+void follower_reconnects()
+{
+    pair_of_servers().run(reconnects_and_catches_up);
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "follower_catches_up", follower_catches_up },
+        { "follower_reconnects", follower_reconnects },
+    });
+}
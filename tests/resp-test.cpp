@@ -0,0 +1,151 @@
+// resp::request_parser fed what a client can send, a line at a time the way the line reader hands it
+// over: whole requests, requests cut short, headers that aren't numbers or are out of bounds, and
+// bulk strings that don't match their announced length. Plus the replies we encode.
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "resp.hpp"
+
+namespace {
+
+using status = resp::request_parser::status;
+
+// Feeds every line but the last, checking each is incomplete, and returns what the last one gives
+auto feed_all(resp::request_parser& parser, std::initializer_list<std::string_view> lines) -> status
+{
+    auto last = status::incomplete;
+    size_t fed = 0;
+    for (auto line : lines) {
+        last = parser.feed(line);
+        if (++fed < lines.size()) {
+            test::check(last == status::incomplete, "incomplete before the last line");
+        }
+    }
+    return last;
+}
+
+void parses_a_request()
+{
+    auto parser = resp::request_parser();
+    test::check(!parser.in_progress(), "nothing in progress to begin with");
+    test::check(feed_all(parser, { "*2\r\n", "$3\r\n", "GET\r\n", "$5\r\n", "count\r\n" }) == status::complete, "GET count");
+    test::check(parser.arguments().size() == 2 && parser.arguments()[0] == "GET" && parser.arguments()[1] == "count", "its arguments");
+    test::check(!parser.in_progress(), "and it's finished");
+
+    test::check(feed_all(parser, { "*1\r\n", "$4\r\n", "PING\r\n" }) == status::complete, "then the next request");
+    test::check(parser.arguments().size() == 1 && parser.arguments()[0] == "PING", "without the last one's arguments");
+}
+
+void accepts_bare_newlines_and_empty_strings()
+{
+    auto parser = resp::request_parser();
+    test::check(feed_all(parser, { "*2\n", "$4\n", "ECHO\n", "$0\n", "\n" }) == status::complete, "LF alone ends a line too");
+    test::check(parser.arguments().size() == 2 && parser.arguments()[1].empty(), "and an empty bulk string is an argument");
+}
+
+// A request cut off part way is just incomplete, however far it got
+void waits_for_the_rest()
+{
+    auto parser = resp::request_parser();
+    test::check(parser.feed("*3\r\n") == status::incomplete && parser.in_progress(), "after the array header");
+    test::check(parser.feed("$6\r\n") == status::incomplete, "after a bulk header");
+    test::check(parser.feed("INCRBY\r\n") == status::incomplete && parser.in_progress(), "after one of three arguments");
+}
+
+void refuses_bad_array_headers()
+{
+    for (auto line : { "GET count\r\n", "*\r\n", "*x\r\n", "*2x\r\n", "* 2\r\n", "*0\r\n", "*-1\r\n", "*+1\r\n",
+             "*99999999999999999999\r\n", "\r\n" }) {
+        auto parser = resp::request_parser();
+        test::check(parser.feed(line) == status::malformed, line);
+        test::check(!parser.in_progress(), "and nothing's left in progress");
+    }
+}
+
+void refuses_bad_bulk_headers()
+{
+    for (auto line : { "+OK\r\n", "GET\r\n", "$\r\n", "$x\r\n", "$-1\r\n", "$3 \r\n", "$99999999999999999999\r\n" }) {
+        auto parser = resp::request_parser();
+        parser.feed("*1\r\n");
+        test::check(parser.feed(line) == status::malformed, line);
+    }
+}
+
+// The announced length is the length: a line shorter or longer is refused
+void refuses_mismatched_lengths()
+{
+    auto parser = resp::request_parser();
+    test::check(feed_all(parser, { "*1\r\n", "$3\r\n", "ab\r\n" }) == status::malformed, "too short");
+    test::check(feed_all(parser, { "*1\r\n", "$3\r\n", "abcd\r\n" }) == status::malformed, "too long");
+}
+
+void limits()
+{
+    auto parser = resp::request_parser();
+    auto most = "*" + std::to_string(resp::max_arguments) + "\r\n";
+    test::check(parser.feed(most) == status::incomplete, "max_arguments is allowed");
+    for (size_t i = 0; i + 1 < resp::max_arguments; ++i) {
+        parser.feed("$1\r\n");
+        parser.feed("x\r\n");
+    }
+    parser.feed("$1\r\n");
+    test::check(parser.feed("x\r\n") == status::complete && parser.arguments().size() == resp::max_arguments, "all of them");
+
+    auto too_many = "*" + std::to_string(resp::max_arguments + 1) + "\r\n";
+    test::check(parser.feed(too_many) == status::malformed, "one more isn't");
+
+    auto longest = std::string(resp::max_bulk_length, 'y');
+    auto header = "$" + std::to_string(resp::max_bulk_length) + "\r\n";
+    test::check(feed_all(parser, { "*1\r\n", header, longest + "\r\n" }) == status::complete, "max_bulk_length is allowed");
+    test::check(parser.arguments()[0] == longest, "whole");
+
+    auto too_long = "$" + std::to_string(resp::max_bulk_length + 1) + "\r\n";
+    parser.feed("*1\r\n");
+    test::check(parser.feed(too_long) == status::malformed, "one byte more isn't");
+}
+
+// After refusing a request the parser starts afresh with the next line
+void recovers_after_malformed()
+{
+    auto parser = resp::request_parser();
+    parser.feed("*2\r\n");
+    parser.feed("$3\r\n");
+    test::check(parser.feed("nope\r\n") == status::malformed, "a bad argument");
+    test::check(!parser.in_progress(), "drops the request");
+    test::check(feed_all(parser, { "*1\r\n", "$3\r\n", "GET\r\n" }) == status::complete, "and the next one parses");
+    test::check(parser.arguments().size() == 1, "on its own");
+}
+
+void encodes_replies()
+{
+    auto out = std::string();
+    resp::append_simple_string(out, "OK");
+    resp::append_error(out, "ERR nope");
+    resp::append_integer(out, INT64_MIN);
+    resp::append_integer(out, 0);
+    resp::append_bulk_string(out, "42");
+    resp::append_bulk_string(out, "");
+    resp::append_array_header(out, 3);
+    test::check(out == "+OK\r\n-ERR nope\r\n:-9223372036854775808\r\n:0\r\n$2\r\n42\r\n$0\r\n\r\n*3\r\n", "every kind of reply");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "parses_a_request",                        parses_a_request },
+        { "accepts_bare_newlines_and_empty_strings", accepts_bare_newlines_and_empty_strings },
+        { "waits_for_the_rest",                      waits_for_the_rest },
+        { "refuses_bad_array_headers",               refuses_bad_array_headers },
+        { "refuses_bad_bulk_headers",                refuses_bad_bulk_headers },
+        { "refuses_mismatched_lengths",              refuses_mismatched_lengths },
+        { "limits",                                  limits },
+        { "recovers_after_malformed",                recovers_after_malformed },
+        { "encodes_replies",                         encodes_replies },
+    });
+}
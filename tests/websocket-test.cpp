@@ -0,0 +1,187 @@
+// websocket::parse_frame on what a client can send: frames that arrive a piece at a time, frames
+// that break the rules, and frames too big for the buffer. Plus the frames and handshake we send back.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "check.hpp"
+#include "websocket.hpp"
+
+namespace {
+
+constexpr size_t capacity = 4096;  // what serve_websocket's buffer holds
+
+// A client frame: `first` is FIN, the reserved bits and the opcode; the payload is masked with a
+// fixed key, and the length takes as many bytes as it needs
+auto client_frame(uint8_t first, std::string_view payload) -> std::string
+{
+    constexpr uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+    auto frame = std::string(1, char(first));
+    if (payload.size() < 126) {
+        frame += char(0x80 | payload.size());
+    }
+    else if (payload.size() <= 0xffff) {
+        frame += char(0x80 | 126);
+        frame += char(payload.size() >> 8);
+        frame += char(payload.size());
+    }
+    else {
+        frame += char(0x80 | 127);
+        for (int i = 0; i < 8; ++i) {
+            frame += char(uint64_t(payload.size()) >> (56 - 8 * i));
+        }
+    }
+
+    frame.append(reinterpret_cast<char const*>(mask), 4);
+    for (size_t i = 0; i < payload.size(); ++i) {
+        frame += char(uint8_t(payload[i]) ^ mask[i % 4]);
+    }
+    return frame;
+}
+
+// What parse_frame makes of the first `received` bytes of `bytes`, in a buffer with room for `room`
+auto status_of(std::string bytes, size_t received = std::string::npos, size_t room = capacity) -> websocket::parse_status
+{
+    auto frame = websocket::frame{};
+    size_t length = 0;
+    return websocket::parse_frame(bytes.data(), std::min(received, bytes.size()), room, &frame, &length);
+}
+
+void unmasks_a_whole_frame()
+{
+    auto bytes = client_frame(0x89, "are you there?");
+    auto frame = websocket::frame{};
+    size_t length = 0;
+    auto status = websocket::parse_frame(bytes.data(), bytes.size(), capacity, &frame, &length);
+    test::check(status == websocket::parse_status::complete, "a whole ping parses");
+    test::check(frame.fin && frame.op == websocket::opcode::ping, "FIN and the opcode");
+    test::check(frame.payload == "are you there?", "the payload comes out unmasked");
+    test::check(length == bytes.size(), "and the frame is all of it");
+}
+
+// A frame's payload may arrive over several reads; until the last byte it's incomplete, never
+// malformed, whatever its size
+void waits_for_a_split_frame()
+{
+    auto bytes = client_frame(0x89, "a ping split across reads");
+    for (size_t received = 0; received < bytes.size(); ++received) {
+        test::check(status_of(bytes, received) == websocket::parse_status::incomplete, "incomplete until it's all there");
+    }
+    test::check(status_of(bytes) == websocket::parse_status::complete, "then complete");
+
+    auto big = client_frame(0x82, std::string(1000, 'x'));
+    test::check(status_of(big, 10) == websocket::parse_status::incomplete, "a 16-bit length, 10 bytes in");
+    test::check(status_of(big, 500) == websocket::parse_status::incomplete, "halfway");
+    test::check(status_of(big) == websocket::parse_status::complete, "done");
+}
+
+// A frame followed by the start of the next: only the first is taken
+void takes_one_frame_at_a_time()
+{
+    auto first = client_frame(0x8a, "pong");
+    auto both = first + client_frame(0x81, "hello");
+    auto frame = websocket::frame{};
+    size_t length = 0;
+    auto status = websocket::parse_frame(both.data(), first.size() + 3, capacity, &frame, &length);
+    test::check(status == websocket::parse_status::complete, "the first parses");
+    test::check(length == first.size() && frame.payload == "pong", "on its own");
+}
+
+void extended_lengths()
+{
+    auto payload_size = [](std::string bytes, size_t room) {
+        auto frame = websocket::frame{};
+        size_t length = 0;
+        auto status = websocket::parse_frame(bytes.data(), bytes.size(), room, &frame, &length);
+        return status == websocket::parse_status::complete && length == bytes.size() ? frame.payload.size() : 0;
+    };
+
+    test::check(payload_size(client_frame(0x82, std::string(125, 'a')), capacity) == 125, "125 bytes fit in the first length byte");
+
+    auto sixteen = client_frame(0x82, std::string(126, 'b'));
+    test::check(sixteen.size() == 2 + 2 + 4 + 126, "126 takes a 16-bit length");
+    test::check(payload_size(sixteen, capacity) == 126, "which parses");
+
+    auto sixty_four = client_frame(0x82, std::string(70000, 'c'));
+    test::check(sixty_four.size() == 2 + 8 + 4 + 70000, "past 65535, a 64-bit one");
+    test::check(payload_size(sixty_four, 80000) == 70000, "which parses too");
+}
+
+void refuses_broken_frames()
+{
+    auto unmasked = client_frame(0x81, "hi");
+    unmasked[1] = char(uint8_t(unmasked[1]) & 0x7f);
+    test::check(status_of(unmasked) == websocket::parse_status::malformed, "clients must mask");
+    test::check(status_of(unmasked, 1) == websocket::parse_status::incomplete, "which takes two bytes to see");
+
+    test::check(status_of(client_frame(0xc1, "hi")) == websocket::parse_status::malformed, "no reserved bits");
+    test::check(status_of(client_frame(0x09, "hi")) == websocket::parse_status::malformed, "no fragmented pings");
+
+    auto long_ping = client_frame(0x89, std::string(126, 'p'));
+    test::check(status_of(long_ping) == websocket::parse_status::malformed, "no control frame over 125 bytes");
+    test::check(status_of(long_ping, 8) == websocket::parse_status::malformed, "known as soon as the length and mask are in");
+}
+
+// Only a frame that could never fit in the buffer is too big: the header, mask and payload all count,
+// and a 64-bit length doesn't wrap around
+void refuses_frames_too_big_for_the_buffer()
+{
+    auto fits = client_frame(0x82, std::string(capacity - 8, 'f'));
+    test::check(fits.size() == capacity, "a frame as big as the buffer");
+    test::check(status_of(fits, 100) == websocket::parse_status::incomplete, "is worth waiting for");
+    test::check(status_of(fits) == websocket::parse_status::complete, "and parses");
+
+    auto over = client_frame(0x82, std::string(capacity - 7, 'f'));
+    test::check(status_of(over, 100) == websocket::parse_status::too_big, "one byte more never will");
+
+    auto huge = std::string("\x82\xff\x80\x00\x00\x00\x00\x00\x00\x00" "mask", 14);
+    test::check(status_of(huge) == websocket::parse_status::too_big, "nor 2^63 bytes");
+    auto wraps = std::string("\x82\xff\xff\xff\xff\xff\xff\xff\xff\xff" "mask", 14);
+    test::check(status_of(wraps) == websocket::parse_status::too_big, "nor 2^64 - 1, which mustn't wrap around");
+}
+
+void encodes_frames()
+{
+    char out[70000];
+    auto size = websocket::encode_frame(out, sizeof(out), websocket::opcode::text, "42");
+    test::check(std::string_view(out, size) == std::string_view("\x81\x02" "42", 4), "FIN, text, unmasked");
+
+    test::check(websocket::encode_frame(out, sizeof(out), websocket::opcode::text, std::string(125, 'x')) == 127, "2-byte header up to 125");
+    test::check(websocket::encode_frame(out, sizeof(out), websocket::opcode::text, std::string(126, 'x')) == 130, "4-byte from 126");
+    test::check(websocket::encode_frame(out, sizeof(out), websocket::opcode::text, std::string(65536, 'x')) == 65546, "10-byte past 65535");
+
+    test::check(websocket::encode_frame(out, 3, websocket::opcode::text, "42") == 0, "nothing when it doesn't fit");
+    test::check(websocket::encode_frame(out, 4, websocket::opcode::text, "42") == 4, "exactly fitting is fine");
+}
+
+// The example from RFC 6455 section 1.3
+void answers_the_handshake()
+{
+    char out[256];
+    auto size = websocket::format_handshake_response(out, sizeof(out), "dGhlIHNhbXBsZSBub25jZQ==");
+    auto response = std::string_view(out, size);
+    test::check(response.starts_with("HTTP/1.1 101 Switching Protocols\r\n"), "101");
+    test::check(response.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string_view::npos, "the accept key");
+    test::check(response.ends_with("\r\n\r\n"), "and the end of the head");
+
+    test::check(websocket::format_handshake_response(out, 16, "dGhlIHNhbXBsZSBub25jZQ==") >= 16, "too small a buffer says so");
+}
+
+}  // namespace
+
+int main()
+{
+    return test::run({
+        { "unmasks_a_whole_frame",                 unmasks_a_whole_frame },
+        { "waits_for_a_split_frame",               waits_for_a_split_frame },
+        { "takes_one_frame_at_a_time",             takes_one_frame_at_a_time },
+        { "extended_lengths",                      extended_lengths },
+        { "refuses_broken_frames",                 refuses_broken_frames },
+        { "refuses_frames_too_big_for_the_buffer", refuses_frames_too_big_for_the_buffer },
+        { "encodes_frames",                        encodes_frames },
+        { "answers_the_handshake",                 answers_the_handshake },
+    });
+}
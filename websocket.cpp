@@ -0,0 +1,212 @@
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+#include "websocket.hpp"
+
+namespace websocket {
+
+namespace {
+
+// Only the handshake needs a hash, once per connection, so a straightforward SHA-1 does; pulling in
+// a crypto library for it would be the only dependency we have
+auto sha1(std::string_view first, std::string_view second) -> std::array<uint8_t, 20>
+{
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+    auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+    auto process = [&](uint8_t const* block) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 | block[4 * i + 3];
+        }
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        auto a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else             { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+
+            auto temp = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    };
+
+    uint8_t block[64];
+    size_t used = 0;
+    uint64_t total = 0;
+
+    auto feed = [&](std::string_view bytes) {
+        for (auto byte : bytes) {
+            block[used++] = uint8_t(byte);
+            if (used == sizeof(block)) {
+                process(block);
+                used = 0;
+            }
+        }
+        total += bytes.size();
+    };
+
+    feed(first);
+    feed(second);
+
+    // Padding: a one bit, zeros, and the message length in bits as the last eight bytes
+    uint8_t length_bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        length_bytes[i] = uint8_t((total * 8) >> (56 - 8 * i));
+    }
+
+    feed("\x80");
+    while (used != 56) {
+        feed(std::string_view("\0", 1));
+    }
+    feed(std::string_view(reinterpret_cast<char const*>(length_bytes), sizeof(length_bytes)));
+
+    std::array<uint8_t, 20> digest;
+    for (int i = 0; i < 20; ++i) {
+        digest[i] = uint8_t(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+
+    return digest;
+}
+
+// Base64 of a SHA-1 digest is always 28 characters, padding included
+auto base64(std::array<uint8_t, 20> const& bytes) -> std::array<char, 28>
+{
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::array<char, 28> out;
+    size_t o = 0;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t chunk = uint32_t(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) chunk |= uint32_t(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) chunk |= bytes[i + 2];
+
+        out[o++] = alphabet[(chunk >> 18) & 63];
+        out[o++] = alphabet[(chunk >> 12) & 63];
+        out[o++] = i + 1 < bytes.size() ? alphabet[(chunk >> 6) & 63] : '=';
+        out[o++] = i + 2 < bytes.size() ? alphabet[chunk & 63] : '=';
+    }
+
+    return out;
+}
+
+}  // namespace
+
+auto parse_frame(char* buffer, size_t size, size_t capacity, frame* out, size_t* length) -> parse_status
+{
+    if (size < 2) {
+        return parse_status::incomplete;
+    }
+
+    auto first = uint8_t(buffer[0]);
+    auto second = uint8_t(buffer[1]);
+
+    // Reserved bits mean an extension we never agreed to, and clients must mask
+    if ((first & 0x70) || !(second & 0x80)) {
+        return parse_status::malformed;
+    }
+
+    out->fin = first & 0x80;
+    out->op = opcode(first & 0x0f);
+
+    size_t header = 2;
+    uint64_t payload_length = second & 0x7f;
+    if (payload_length == 126) {
+        header += 2;
+    }
+    else if (payload_length == 127) {
+        header += 8;
+    }
+
+    if (size < header + 4) {
+        return parse_status::incomplete;
+    }
+
+    if (header > 2) {
+        payload_length = 0;
+        for (size_t i = 2; i < header; ++i) {
+            payload_length = payload_length << 8 | uint8_t(buffer[i]);
+        }
+    }
+
+    // Control frames are never fragmented and never longer than 125 bytes
+    if (uint8_t(out->op) & 0x8 && (!out->fin || payload_length > 125)) {
+        return parse_status::malformed;
+    }
+
+    if (capacity < header + 4 || payload_length > capacity - header - 4) {
+        return parse_status::too_big;  // it would never all arrive
+    }
+
+    auto total = header + 4 + payload_length;
+    if (size < total) {
+        return parse_status::incomplete;
+    }
+
+    auto mask = reinterpret_cast<uint8_t const*>(buffer + header);
+    auto payload = buffer + header + 4;
+    for (size_t i = 0; i < payload_length; ++i) {
+        payload[i] = char(uint8_t(payload[i]) ^ mask[i % 4]);
+    }
+
+    out->payload = std::string_view(payload, payload_length);
+    *length = total;
+    return parse_status::complete;
+}
+
+auto encode_frame(char* out, size_t capacity, opcode op, std::string_view payload) -> size_t
+{
+    size_t header = payload.size() < 126 ? 2 : payload.size() <= 0xffff ? 4 : 10;
+    if (capacity < header + payload.size()) {
+        return 0;
+    }
+
+    out[0] = char(0x80 | uint8_t(op));
+    if (header == 2) {
+        out[1] = char(payload.size());
+    }
+    else if (header == 4) {
+        out[1] = char(126);
+        out[2] = char(payload.size() >> 8);
+        out[3] = char(payload.size());
+    }
+    else {
+        out[1] = char(127);
+        for (int i = 0; i < 8; ++i) {
+            out[2 + i] = char(uint64_t(payload.size()) >> (56 - 8 * i));
+        }
+    }
+
+    memcpy(out + header, payload.data(), payload.size());
+    return header + payload.size();
+}
+
+auto format_handshake_response(char* out, size_t capacity, std::string_view key) -> size_t
+{
+    auto accept = base64(sha1(key, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+
+    auto written = snprintf(out, capacity,
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %.*s\r\n"
+        "\r\n",
+        int(accept.size()), accept.data());
+
+    return written < 0 ? capacity : size_t(written);
+}
+
+}  // namespace websocket
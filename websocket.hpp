@@ -0,0 +1,57 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// RFC 6455 framing, for pushing the count to browsers
+
+// A client upgrades an HTTP request (see http.hpp) and from then on both sides exchange frames. We
+// only ever send unmasked frames with the whole message in one frame, which is what the count
+// updates are; frames from clients are always masked and are unmasked in place. Fragmented client
+// messages are accepted and ignored, since nothing a client sends us besides control frames means
+// anything.
+
+namespace websocket {
+
+enum class opcode : uint8_t {
+    continuation = 0x0,
+    text         = 0x1,
+    binary       = 0x2,
+    close        = 0x8,
+    ping         = 0x9,
+    pong         = 0xa,
+};
+
+// Close codes we send
+constexpr uint16_t going_away     = 1001;
+constexpr uint16_t protocol_error = 1002;
+constexpr uint16_t too_big        = 1009;
+
+// The largest frame header there is; a frame we encode is this plus its payload at most
+constexpr size_t max_header_size = 10;
+
+struct frame {
+    bool fin;
+    opcode op;
+    std::string_view payload;  // unmasked, in the caller's buffer
+};
+
+enum class parse_status { incomplete, complete, malformed, too_big };
+
+// Parses (and unmasks) the client frame at the front of `buffer`, which holds `size` bytes so far
+// and has room for `capacity`; when complete, *length is how many bytes it took up. A frame that
+// could never fit in `capacity` bytes is too big.
+auto parse_frame(char* buffer, size_t size, size_t capacity, frame* out, size_t* length) -> parse_status;
+
+// Writes one unmasked frame into `out`; returns its length, or 0 if `capacity` is too small
+auto encode_frame(char* out, size_t capacity, opcode op, std::string_view payload) -> size_t;
+
+// The 101 response to an upgrade request carrying `key`; returns its length, which is `capacity` or
+// more if it didn't fit
+auto format_handshake_response(char* out, size_t capacity, std::string_view key) -> size_t;
+
+}  // namespace websocket
+
+#endif  // WEBSOCKET_HPP